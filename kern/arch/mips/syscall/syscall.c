@@ -116,6 +116,11 @@ syscall(struct trapframe *tf)
 				 (userptr_t)tf->tf_a1);
 		break;
 
+	    case SYS_nanosleep:
+		err = sys_nanosleep((userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1);
+		break;
+
 	    /* Add stuff here */
 
 		case SYS_open:
@@ -147,6 +152,26 @@ syscall(struct trapframe *tf)
 		err = sys_dup2((int)tf->tf_a0, (int)tf->tf_a1, &retval);
 		break;
 
+		case SYS_getdirentry:
+		err = sys_getdirentry((int)tf->tf_a0, (userptr_t)tf->tf_a1, (size_t)tf->tf_a2, &retval);
+		break;
+
+		case SYS_getdirentries:
+		err = sys_getdirentries((int)tf->tf_a0, (userptr_t)tf->tf_a1, (size_t)tf->tf_a2, &retval);
+		break;
+
+		case SYS_sync:
+		err = sys_sync();
+		break;
+
+		case SYS_setaffinity:
+		err = sys_setaffinity((uint32_t)tf->tf_a0);
+		break;
+
+		case SYS_getaffinity:
+		err = sys_getaffinity((userptr_t)tf->tf_a0);
+		break;
+
 	    default:
 		kprintf("Unknown syscall %d\n", callno);
 		err = ENOSYS;
@@ -53,12 +53,17 @@
  */
 #define CPU_FREQUENCY 25000000 /* 25 MHz */
 
+/* Timer cycles per hardclock, and the most hardclocks we can wait */
+#define TIMER_PERIOD   (CPU_FREQUENCY / HZ)
+#define TIMER_MAXTICKS (0xffffffffU / TIMER_PERIOD)
+
 /*
  * Access to the on-chip timer.
  *
  * The c0_count register increments on every cycle; when the value
  * matches the c0_compare register, the timer interrupt line is
- * asserted. Writing to c0_compare again clears the interrupt.
+ * asserted and c0_count starts over from 0. Writing to c0_compare
+ * again clears the interrupt.
  */
 static
 void
@@ -76,6 +81,45 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+static
+uint32_t
+mips_timer_getcount(void)
+{
+	uint32_t count;
+
+	/* $9 == c0_count */
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mfc0 %0, $9;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		: "=r" (count));
+	return count;
+}
+
+/*
+ * Arrange for the next timer interrupt on this cpu to come TICKS
+ * hardclocks from now, or as late as possible if TICKS is 0.
+ */
+void
+mainbus_timer_set(unsigned ticks)
+{
+	uint32_t count, compare;
+
+	count = mips_timer_getcount();
+	if (ticks == 0 || ticks > TIMER_MAXTICKS) {
+		compare = 0xffffffff;
+	}
+	else {
+		compare = count + ticks * TIMER_PERIOD;
+		if (compare < count) {
+			/* Would wrap; go off early instead */
+			compare = 0xffffffff;
+		}
+	}
+	mips_timer_set(compare);
+}
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -116,7 +160,7 @@ mainbus_bootstrap(void)
 	/*
 	 * Configure the MIPS on-chip timer to interrupt HZ times a second.
 	 */
-	mips_timer_set(CPU_FREQUENCY / HZ);
+	mips_timer_set(TIMER_PERIOD);
 }
 
 /*
@@ -315,7 +359,7 @@ mainbus_interrupt(struct trapframe *tf)
 	}
 	if (cause & MIPS_TIMER_BIT) {
 		/* Reset the timer (this clears the interrupt) */
-		mips_timer_set(CPU_FREQUENCY / HZ);
+		mips_timer_set(TIMER_PERIOD);
 		/* and call hardclock */
 		hardclock();
 		seen = true;
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *        The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * RAM disk device. See ramdisk.h.
+ *
+ * The storage is a table of individually allocated kernel pages, so
+ * a large ramdisk doesn't need a large run of contiguous memory.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <uio.h>
+#include <vm.h>
+#include <vfs.h>
+#include <device.h>
+#include <ramdisk.h>
+
+#define RAMDISK_SECTPERPAGE (PAGE_SIZE / RAMDISK_SECTSIZE)
+
+/*
+ * Device data for a ramdisk.
+ */
+struct ramdisk {
+	vaddr_t *rd_pages;		/* storage, one page at a time */
+	unsigned rd_npages;		/* number of pages */
+	struct device rd_dev;		/* VFS device structure */
+};
+
+/* For assigning names */
+static unsigned ramdisk_count;
+static struct spinlock ramdisk_countlock = SPINLOCK_INITIALIZER;
+
+/*
+ * Function called when we are open()'d.
+ */
+static
+int
+ramdisk_eachopen(struct device *d, int openflags)
+{
+	(void)d;
+	(void)openflags;
+	return 0;
+}
+
+/*
+ * I/O function (for both reads and writes). Same rules as lhd:
+ * whole sectors only, and not past the end.
+ */
+static
+int
+ramdisk_io(struct device *d, struct uio *uio)
+{
+	struct ramdisk *rd = d->d_data;
+	off_t pos = uio->uio_offset;
+	off_t end = (off_t)rd->rd_dev.d_blocks * RAMDISK_SECTSIZE;
+	size_t len;
+	unsigned pageoff;
+	int result;
+
+	if (pos % RAMDISK_SECTSIZE != 0 ||
+	    uio->uio_resid % RAMDISK_SECTSIZE != 0) {
+		return EINVAL;
+	}
+	if (pos < 0 || pos > end || uio->uio_resid > end - pos) {
+		return EINVAL;
+	}
+
+	/* Go a page (or the part of one that's needed) at a time */
+	while (uio->uio_resid > 0) {
+		pos = uio->uio_offset;
+		pageoff = pos % PAGE_SIZE;
+		len = PAGE_SIZE - pageoff;
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = uiomove((char *)rd->rd_pages[pos / PAGE_SIZE] +
+				 pageoff, len, uio);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Function for handling ioctls.
+ */
+static
+int
+ramdisk_ioctl(struct device *d, int op, userptr_t data)
+{
+	(void)d;
+	(void)op;
+	(void)data;
+	return EIOCTL;
+}
+
+static const struct device_ops ramdisk_devops = {
+	.devop_eachopen = ramdisk_eachopen,
+	.devop_io = ramdisk_io,
+	.devop_ioctl = ramdisk_ioctl,
+};
+
+/*
+ * Release the pages of a ramdisk that didn't get set up.
+ */
+static
+void
+ramdisk_freepages(struct ramdisk *rd, unsigned npages)
+{
+	unsigned i;
+
+	for (i=0; i<npages; i++) {
+		free_kpages(rd->rd_pages[i]);
+	}
+	kfree(rd->rd_pages);
+}
+
+int
+ramdisk_create(size_t size, char *name)
+{
+	struct ramdisk *rd;
+	unsigned nsect, i;
+	int result;
+
+	nsect = DIVROUNDUP(size, RAMDISK_SECTSIZE);
+	if (nsect == 0) {
+		return EINVAL;
+	}
+
+	rd = kmalloc(sizeof(*rd));
+	if (rd == NULL) {
+		return ENOMEM;
+	}
+	rd->rd_npages = DIVROUNDUP(nsect, RAMDISK_SECTPERPAGE);
+	rd->rd_pages = kmalloc(rd->rd_npages * sizeof(vaddr_t));
+	if (rd->rd_pages == NULL) {
+		kfree(rd);
+		return ENOMEM;
+	}
+	for (i=0; i<rd->rd_npages; i++) {
+		rd->rd_pages[i] = alloc_kpages(1);
+		if (rd->rd_pages[i] == 0) {
+			ramdisk_freepages(rd, i);
+			kfree(rd);
+			return ENOMEM;
+		}
+		bzero((void *)rd->rd_pages[i], PAGE_SIZE);
+	}
+
+	rd->rd_dev.d_ops = &ramdisk_devops;
+	rd->rd_dev.d_blocks = nsect;
+	rd->rd_dev.d_blocksize = RAMDISK_SECTSIZE;
+	rd->rd_dev.d_data = rd;
+
+	spinlock_acquire(&ramdisk_countlock);
+	i = ramdisk_count++;
+	spinlock_release(&ramdisk_countlock);
+	snprintf(name, RAMDISK_NAMELEN, "ram%u", i);
+
+	result = vfs_adddev(name, &rd->rd_dev, 1);
+	if (result) {
+		ramdisk_freepages(rd, rd->rd_npages);
+		kfree(rd);
+		return result;
+	}
+	return 0;
+}
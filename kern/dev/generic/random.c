@@ -31,6 +31,7 @@
 #include <kern/errno.h>
 #include <kern/fcntl.h>
 #include <lib.h>
+#include <spinlock.h>
 #include <uio.h>
 #include <vfs.h>
 #include <generic/random.h>
@@ -39,16 +40,201 @@
 /*
  * Machine-independent generic randomness device.
  *
- * Remembers something that's a random source, and provides random()
- * and randmax() to the rest of the kernel.
+ * Remembers something that's a random source, and provides random(),
+ * randmax(), and random_bytes() to the rest of the kernel.
  *
  * The kernel config mechanism can be used to explicitly choose which
  * of the available random sources to use, if more than one is
  * available.
+ *
+ * Reading the hardware costs a bus access per 32-bit word, so it is
+ * only used to seed a pool: a ChaCha20 keystream generator, run a
+ * buffer at a time, with the key replaced from each buffer's output
+ * before any of it is handed out (so earlier output can't be
+ * recovered from the current state). Every RANDPOOL_RESEED refills,
+ * fresh words from the hardware are mixed into the key.
+ *
+ * Large requests don't hold the pool lock while generating: they take
+ * a key of their own from the pool and run a private generator.
  */
 
 static struct random_softc *the_random = NULL;
 
+#define RANDPOOL_KEYWORDS  8		/* 256-bit key */
+#define RANDPOOL_BLOCKS    16		/* ChaCha blocks per refill */
+#define RANDPOOL_BLOCKSIZE 64		/* bytes per ChaCha block */
+#define RANDPOOL_RESEED    64		/* refills between reseeds */
+#define RANDPOOL_CHUNK     1024		/* bytes per uiomove in randio */
+
+/* Requests bigger than this get a generator of their own */
+#define RANDPOOL_DIRECT    256
+
+static struct {
+	struct spinlock rp_lock;
+	uint32_t rp_key[RANDPOOL_KEYWORDS];
+	uint64_t rp_counter;		/* next block */
+	unsigned rp_refills;		/* refills since the last reseed */
+	unsigned rp_avail;		/* unused bytes at the end of rp_buf */
+	uint32_t rp_buf[RANDPOOL_BLOCKS * RANDPOOL_BLOCKSIZE / 4];
+} randpool = {
+	.rp_lock = SPINLOCK_INITIALIZER,
+};
+
+////////////////////////////////////////////////////////////
+// Generator
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define QUARTERROUND(a, b, c, d) \
+	(a += b, d ^= a, d = ROTL(d, 16), \
+	 c += d, b ^= c, b = ROTL(b, 12), \
+	 a += b, d ^= a, d = ROTL(d, 8), \
+	 c += d, b ^= c, b = ROTL(b, 7))
+
+/*
+ * Compute one ChaCha20 block for KEY and block number COUNTER.
+ */
+static
+void
+chacha_block(const uint32_t *key, uint64_t counter, uint32_t *out)
+{
+	uint32_t in[16];
+	unsigned i;
+
+	/* "expand 32-byte k" */
+	in[0] = 0x61707865;
+	in[1] = 0x3320646e;
+	in[2] = 0x79622d32;
+	in[3] = 0x6b206574;
+	for (i=0; i<RANDPOOL_KEYWORDS; i++) {
+		in[4+i] = key[i];
+	}
+	in[12] = (uint32_t)counter;
+	in[13] = (uint32_t)(counter >> 32);
+	in[14] = 0;
+	in[15] = 0;
+
+	for (i=0; i<16; i++) {
+		out[i] = in[i];
+	}
+	for (i=0; i<10; i++) {
+		/* Columns */
+		QUARTERROUND(out[0], out[4], out[8], out[12]);
+		QUARTERROUND(out[1], out[5], out[9], out[13]);
+		QUARTERROUND(out[2], out[6], out[10], out[14]);
+		QUARTERROUND(out[3], out[7], out[11], out[15]);
+		/* Diagonals */
+		QUARTERROUND(out[0], out[5], out[10], out[15]);
+		QUARTERROUND(out[1], out[6], out[11], out[12]);
+		QUARTERROUND(out[2], out[7], out[8], out[13]);
+		QUARTERROUND(out[3], out[4], out[9], out[14]);
+	}
+	for (i=0; i<16; i++) {
+		out[i] += in[i];
+	}
+}
+
+/*
+ * Fill BUF with LEN bytes of keystream for KEY, starting at block
+ * *COUNTER, and advance *COUNTER.
+ */
+static
+void
+chacha_stream(const uint32_t *key, uint64_t *counter, void *buf, size_t len)
+{
+	uint32_t block[16];
+	char *p = buf;
+	size_t n;
+
+	while (len > 0) {
+		n = len < sizeof(block) ? len : sizeof(block);
+		chacha_block(key, (*counter)++, block);
+		memcpy(p, block, n);
+		p += n;
+		len -= n;
+	}
+	bzero(block, sizeof(block));
+}
+
+////////////////////////////////////////////////////////////
+// Pool
+
+/*
+ * Mix some words from the hardware into the key. Pool lock held.
+ */
+static
+void
+randpool_reseed(void)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&randpool.rp_lock));
+	KASSERT(the_random != NULL);
+
+	for (i=0; i<RANDPOOL_KEYWORDS; i++) {
+		randpool.rp_key[i] ^= the_random->rs_random(
+			the_random->rs_devdata);
+	}
+	randpool.rp_refills = 0;
+}
+
+/*
+ * Generate a new buffer of output and replace the key with the start
+ * of it. Pool lock held.
+ */
+static
+void
+randpool_refill(void)
+{
+	KASSERT(spinlock_do_i_hold(&randpool.rp_lock));
+
+	if (randpool.rp_refills++ >= RANDPOOL_RESEED) {
+		randpool_reseed();
+	}
+
+	chacha_stream(randpool.rp_key, &randpool.rp_counter,
+		      randpool.rp_buf, sizeof(randpool.rp_buf));
+	memcpy(randpool.rp_key, randpool.rp_buf, sizeof(randpool.rp_key));
+	bzero(randpool.rp_buf, sizeof(randpool.rp_key));
+	randpool.rp_avail = sizeof(randpool.rp_buf) - sizeof(randpool.rp_key);
+}
+
+/*
+ * Copy LEN bytes of pool output to BUF. Output is erased from the
+ * pool as it's handed out.
+ */
+static
+void
+randpool_get(void *buf, size_t len)
+{
+	char *p = buf;
+	char *src;
+	size_t n;
+
+	if (the_random==NULL) {
+		panic("No random device\n");
+	}
+
+	spinlock_acquire(&randpool.rp_lock);
+	while (len > 0) {
+		if (randpool.rp_avail == 0) {
+			randpool_refill();
+		}
+		n = len < randpool.rp_avail ? len : randpool.rp_avail;
+		src = (char *)randpool.rp_buf +
+			sizeof(randpool.rp_buf) - randpool.rp_avail;
+		memcpy(p, src, n);
+		bzero(src, n);
+		randpool.rp_avail -= n;
+		p += n;
+		len -= n;
+	}
+	spinlock_release(&randpool.rp_lock);
+}
+
+////////////////////////////////////////////////////////////
+// Device
+
 /*
  * VFS device functions.
  * open: allow reading only.
@@ -67,19 +253,46 @@ randeachopen(struct device *dev, int openflags)
 }
 
 /*
- * VFS I/O function. Hand off to implementation.
+ * VFS I/O function. Generate a chunk at a time with a private key,
+ * so the pool isn't locked while we copy out to the user.
  */
 static
 int
 randio(struct device *dev, struct uio *uio)
 {
-	struct random_softc *rs = dev->d_data;
+	uint32_t key[RANDPOOL_KEYWORDS];
+	uint64_t counter = 0;
+	char *buf;
+	size_t n;
+	int result;
+
+	(void)dev;
 
 	if (uio->uio_rw != UIO_READ) {
 		return EIO;
 	}
 
-	return rs->rs_read(rs->rs_devdata, uio);
+	buf = kmalloc(RANDPOOL_CHUNK);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+	randpool_get(key, sizeof(key));
+
+	result = 0;
+	while (uio->uio_resid > 0) {
+		n = uio->uio_resid < RANDPOOL_CHUNK ?
+			uio->uio_resid : RANDPOOL_CHUNK;
+		chacha_stream(key, &counter, buf, n);
+		result = uiomove(buf, n, uio);
+		if (result) {
+			break;
+		}
+	}
+
+	bzero(key, sizeof(key));
+	bzero(buf, RANDPOOL_CHUNK);
+	kfree(buf);
+	return result;
 }
 
 /*
@@ -120,6 +333,11 @@ config_random(struct random_softc *rs, int unit)
 	KASSERT(the_random==NULL);
 	the_random = rs;
 
+	/* Seed the pool. */
+	spinlock_acquire(&randpool.rp_lock);
+	randpool_reseed();
+	spinlock_release(&randpool.rp_lock);
+
 	rs->rs_dev.d_ops = &random_devops;
 	rs->rs_dev.d_blocks = 0;
 	rs->rs_dev.d_blocksize = 1;
@@ -142,17 +360,34 @@ config_random(struct random_softc *rs, int unit)
 uint32_t
 random(void)
 {
-	if (the_random==NULL) {
-		panic("No random device\n");
-	}
-	return the_random->rs_random(the_random->rs_devdata);
+	uint32_t val;
+
+	randpool_get(&val, sizeof(val));
+	return val;
 }
 
+/*
+ * The pool hands out whole 32-bit words whatever the range of the
+ * hardware source, so this doesn't depend on the device.
+ */
 uint32_t
 randmax(void)
 {
-	if (the_random==NULL) {
-		panic("No random device\n");
+	return 0xffffffff;
+}
+
+void
+random_bytes(void *buf, size_t len)
+{
+	uint32_t key[RANDPOOL_KEYWORDS];
+	uint64_t counter = 0;
+
+	if (len <= RANDPOOL_DIRECT) {
+		randpool_get(buf, len);
+		return;
 	}
-	return the_random->rs_randmax(the_random->rs_devdata);
+
+	randpool_get(key, sizeof(key));
+	chacha_stream(key, &counter, buf, len);
+	bzero(key, sizeof(key));
 }
@@ -31,14 +31,11 @@
 #define _GENERIC_RANDOM_H_
 
 #include <device.h>
-struct uio;
 
 struct random_softc {
 	/* Initialized by lower-level attach routine */
 	void *rs_devdata;
 	uint32_t (*rs_random)(void *devdata);
-	uint32_t (*rs_randmax)(void *devdata);
-	int (*rs_read)(void *devdata, struct uio *uio);
 
 	struct device rs_dev;
 };
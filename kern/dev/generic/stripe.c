@@ -0,0 +1,522 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *        The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Striped (RAID-0) pseudo-disk. See stripe.h.
+ *
+ * A transfer is done in rounds of at most STRIPE_MAXIO bytes through
+ * a kernel bounce buffer (the caller's uio may point into a user
+ * address space, which the worker threads can't see). Each round is
+ * cut into chunk-sized pieces; the pieces that land on the same
+ * member are contiguous on that member, so they become a single
+ * multi-iovec job, and each member's job goes to its worker thread.
+ * The caller waits for all the jobs of a round before starting the
+ * next one. The bounce buffer and the other per-transfer state are
+ * allocated when the stripe is created, and st_iolock lets one
+ * transfer at a time use them.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <thread.h>
+#include <stat.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <device.h>
+#include <stripe.h>
+
+#define STRIPE_SECTSIZE  512
+#define STRIPE_MAXIO     (64*1024)	/* bytes per round */
+
+/* Most pieces a round can be cut into (with one-sector chunks) */
+#define STRIPE_MAXPIECES (STRIPE_MAXIO / STRIPE_SECTSIZE + 1)
+
+/*
+ * One member's share of a round.
+ */
+struct stripe_job {
+	struct stripe_job *sj_next;	/* member's queue */
+	struct uio sj_uio;		/* what to transfer */
+	int sj_result;			/* result, once done */
+	struct semaphore *sj_done;	/* V'd when done */
+};
+
+/*
+ * A member disk and its worker. sm_lock protects the queue and
+ * sm_exit.
+ */
+struct stripe_member {
+	struct vnode *sm_vn;		/* raw device vnode */
+	struct lock *sm_lock;
+	struct cv *sm_cv;		/* signaled when work arrives */
+	struct stripe_job *sm_head;	/* queued jobs */
+	struct stripe_job *sm_tail;
+	bool sm_exit;			/* worker should exit */
+	struct semaphore *sm_exited;	/* V'd by worker on exit */
+};
+
+struct stripe {
+	unsigned st_chunk;		/* sectors per chunk */
+	unsigned st_ndisks;		/* number of members */
+	struct stripe_member st_disks[STRIPE_MAXDISKS];
+	struct lock *st_iolock;		/* protects the fields below */
+	void *st_buf;			/* bounce buffer, STRIPE_MAXIO bytes */
+	struct iovec *st_iov;		/* pieces of a round */
+	struct semaphore *st_done;	/* V'd as each job finishes */
+	struct device st_dev;		/* VFS device structure */
+};
+
+/* For assigning names */
+static unsigned stripe_count;
+static struct spinlock stripe_countlock = SPINLOCK_INITIALIZER;
+
+////////////////////////////////////////////////////////////
+// Workers
+
+/*
+ * Worker thread for one member: do its jobs in order.
+ */
+static
+void
+stripe_worker(void *vsm, unsigned long junk)
+{
+	struct stripe_member *sm = vsm;
+	struct stripe_job *job;
+	int result;
+
+	(void)junk;
+
+	while (1) {
+		lock_acquire(sm->sm_lock);
+		while (sm->sm_head == NULL && !sm->sm_exit) {
+			cv_wait(sm->sm_cv, sm->sm_lock);
+		}
+		if (sm->sm_head == NULL) {
+			lock_release(sm->sm_lock);
+			break;
+		}
+		job = sm->sm_head;
+		sm->sm_head = job->sj_next;
+		if (sm->sm_head == NULL) {
+			sm->sm_tail = NULL;
+		}
+		lock_release(sm->sm_lock);
+
+		if (job->sj_uio.uio_rw == UIO_READ) {
+			result = VOP_READ(sm->sm_vn, &job->sj_uio);
+		}
+		else {
+			result = VOP_WRITE(sm->sm_vn, &job->sj_uio);
+		}
+		if (result == 0 && job->sj_uio.uio_resid != 0) {
+			result = EIO;
+		}
+		job->sj_result = result;
+		V(job->sj_done);
+	}
+
+	V(sm->sm_exited);
+}
+
+/*
+ * Hand a job to a member's worker.
+ */
+static
+void
+stripe_queue(struct stripe_member *sm, struct stripe_job *job)
+{
+	job->sj_next = NULL;
+
+	lock_acquire(sm->sm_lock);
+	if (sm->sm_tail == NULL) {
+		sm->sm_head = job;
+	}
+	else {
+		sm->sm_tail->sj_next = job;
+	}
+	sm->sm_tail = job;
+	cv_signal(sm->sm_cv, sm->sm_lock);
+	lock_release(sm->sm_lock);
+}
+
+////////////////////////////////////////////////////////////
+// I/O
+
+/*
+ * Do one round: transfer LEN bytes between BUF and the stripe,
+ * starting at byte offset POS.
+ */
+static
+int
+stripe_round(struct stripe *st, void *buf, off_t pos, size_t len,
+	     enum uio_rw rw, struct iovec *iov, struct semaphore *done)
+{
+	struct stripe_job jobs[STRIPE_MAXDISKS];
+	unsigned count[STRIPE_MAXDISKS], base[STRIPE_MAXDISKS];
+	uint32_t sect, end, unit, disk, msect, n;
+	unsigned i, njobs;
+	size_t bufpos;
+	int result;
+
+	sect = pos / STRIPE_SECTSIZE;
+	end = sect + len / STRIPE_SECTSIZE;
+
+	/* Count the pieces for each member */
+	bzero(count, sizeof(count));
+	for (; sect < end; sect += n) {
+		unit = sect / st->st_chunk;
+		n = st->st_chunk - sect % st->st_chunk;
+		if (n > end - sect) {
+			n = end - sect;
+		}
+		count[unit % st->st_ndisks]++;
+	}
+	for (i=0; i<st->st_ndisks; i++) {
+		base[i] = i == 0 ? 0 : base[i-1] + count[i-1];
+		jobs[i].sj_uio.uio_iov = &iov[base[i]];
+		jobs[i].sj_uio.uio_iovcnt = 0;
+		jobs[i].sj_uio.uio_resid = 0;
+	}
+
+	/* Fill in the pieces */
+	sect = pos / STRIPE_SECTSIZE;
+	bufpos = 0;
+	for (; sect < end; sect += n) {
+		unit = sect / st->st_chunk;
+		n = st->st_chunk - sect % st->st_chunk;
+		if (n > end - sect) {
+			n = end - sect;
+		}
+		disk = unit % st->st_ndisks;
+		if (jobs[disk].sj_uio.uio_iovcnt == 0) {
+			msect = (unit / st->st_ndisks) * st->st_chunk +
+				sect % st->st_chunk;
+			jobs[disk].sj_uio.uio_offset =
+				(off_t)msect * STRIPE_SECTSIZE;
+		}
+		i = base[disk] + jobs[disk].sj_uio.uio_iovcnt++;
+		iov[i].iov_kbase = (char *)buf + bufpos;
+		iov[i].iov_len = n * STRIPE_SECTSIZE;
+		jobs[disk].sj_uio.uio_resid += n * STRIPE_SECTSIZE;
+		bufpos += n * STRIPE_SECTSIZE;
+	}
+	KASSERT(bufpos == len);
+
+	/* Start them all, then wait for them all */
+	njobs = 0;
+	for (i=0; i<st->st_ndisks; i++) {
+		if (count[i] == 0) {
+			continue;
+		}
+		jobs[i].sj_uio.uio_segflg = UIO_SYSSPACE;
+		jobs[i].sj_uio.uio_rw = rw;
+		jobs[i].sj_uio.uio_space = NULL;
+		jobs[i].sj_result = 0;
+		jobs[i].sj_done = done;
+		stripe_queue(&st->st_disks[i], &jobs[i]);
+		njobs++;
+	}
+	for (i=0; i<njobs; i++) {
+		P(done);
+	}
+
+	result = 0;
+	for (i=0; i<st->st_ndisks; i++) {
+		if (count[i] > 0 && jobs[i].sj_result != 0 && result == 0) {
+			result = jobs[i].sj_result;
+		}
+	}
+	return result;
+}
+
+/*
+ * Function called when we are open()'d.
+ */
+static
+int
+stripe_eachopen(struct device *d, int openflags)
+{
+	(void)d;
+	(void)openflags;
+	return 0;
+}
+
+/*
+ * I/O function (for both reads and writes). Whole sectors only, and
+ * not past the end.
+ */
+static
+int
+stripe_io(struct device *d, struct uio *uio)
+{
+	struct stripe *st = d->d_data;
+	off_t end = (off_t)st->st_dev.d_blocks * STRIPE_SECTSIZE;
+	size_t len;
+	off_t pos;
+	int result;
+
+	if (uio->uio_offset % STRIPE_SECTSIZE != 0 ||
+	    uio->uio_resid % STRIPE_SECTSIZE != 0) {
+		return EINVAL;
+	}
+	if (uio->uio_offset < 0 || uio->uio_offset > end ||
+	    uio->uio_resid > end - uio->uio_offset) {
+		return EINVAL;
+	}
+	if (uio->uio_resid == 0) {
+		return 0;
+	}
+
+	lock_acquire(st->st_iolock);
+
+	result = 0;
+	while (uio->uio_resid > 0) {
+		pos = uio->uio_offset;
+		len = uio->uio_resid < STRIPE_MAXIO ?
+			uio->uio_resid : STRIPE_MAXIO;
+
+		if (uio->uio_rw == UIO_WRITE) {
+			result = uiomove(st->st_buf, len, uio);
+			if (result) {
+				break;
+			}
+		}
+		result = stripe_round(st, st->st_buf, pos, len, uio->uio_rw,
+				      st->st_iov, st->st_done);
+		if (result) {
+			break;
+		}
+		if (uio->uio_rw == UIO_READ) {
+			result = uiomove(st->st_buf, len, uio);
+			if (result) {
+				break;
+			}
+		}
+	}
+
+	lock_release(st->st_iolock);
+	return result;
+}
+
+/*
+ * Function for handling ioctls.
+ */
+static
+int
+stripe_ioctl(struct device *d, int op, userptr_t data)
+{
+	(void)d;
+	(void)op;
+	(void)data;
+	return EIOCTL;
+}
+
+static const struct device_ops stripe_devops = {
+	.devop_eachopen = stripe_eachopen,
+	.devop_io = stripe_io,
+	.devop_ioctl = stripe_ioctl,
+};
+
+////////////////////////////////////////////////////////////
+// Setup
+
+/*
+ * Tear down a stripe that didn't get set up: stop the first NWORKERS
+ * workers and wait for them, and let go of everything.
+ */
+static
+void
+stripe_destroy(struct stripe *st, unsigned nworkers)
+{
+	struct stripe_member *sm;
+	unsigned i;
+
+	for (i=0; i<nworkers; i++) {
+		sm = &st->st_disks[i];
+		lock_acquire(sm->sm_lock);
+		sm->sm_exit = true;
+		cv_signal(sm->sm_cv, sm->sm_lock);
+		lock_release(sm->sm_lock);
+		P(sm->sm_exited);
+	}
+	for (i=0; i<st->st_ndisks; i++) {
+		sm = &st->st_disks[i];
+		if (sm->sm_exited != NULL) {
+			sem_destroy(sm->sm_exited);
+		}
+		if (sm->sm_cv != NULL) {
+			cv_destroy(sm->sm_cv);
+		}
+		if (sm->sm_lock != NULL) {
+			lock_destroy(sm->sm_lock);
+		}
+		if (sm->sm_vn != NULL) {
+			vfs_releasedev(sm->sm_vn);
+		}
+	}
+	if (st->st_done != NULL) {
+		sem_destroy(st->st_done);
+	}
+	if (st->st_iov != NULL) {
+		kfree(st->st_iov);
+	}
+	if (st->st_buf != NULL) {
+		kfree(st->st_buf);
+	}
+	if (st->st_iolock != NULL) {
+		lock_destroy(st->st_iolock);
+	}
+	kfree(st);
+}
+
+/*
+ * Claim member disk DISK, which must be an unmounted mountable device
+ * not in use by anything else, get its raw vnode, and check its
+ * sector size. Called with the biglock held.
+ */
+static
+int
+stripe_getdisk(const char *disk, struct vnode **ret, uint32_t *nblocks)
+{
+	struct vnode *vn;
+	struct stat st;
+	int result;
+
+	result = vfs_claimdev(disk, &vn);
+	if (result) {
+		return result;
+	}
+	result = VOP_STAT(vn, &st);
+	if (result == 0 && st.st_blksize != STRIPE_SECTSIZE) {
+		result = EINVAL;
+	}
+	if (result) {
+		vfs_releasedev(vn);
+		return result;
+	}
+
+	*ret = vn;
+	*nblocks = st.st_blocks;
+	return 0;
+}
+
+int
+stripe_create(unsigned chunk, unsigned ndisks, char **disks, char *name)
+{
+	struct stripe *st;
+	struct stripe_member *sm;
+	uint32_t nblocks, minblocks = 0;
+	unsigned i, nworkers = 0;
+	int result;
+
+	if (chunk == 0 || ndisks == 0 || ndisks > STRIPE_MAXDISKS) {
+		return EINVAL;
+	}
+
+	st = kmalloc(sizeof(*st));
+	if (st == NULL) {
+		return ENOMEM;
+	}
+	bzero(st, sizeof(*st));
+	st->st_chunk = chunk;
+	st->st_ndisks = ndisks;
+
+	vfs_biglock_acquire();
+
+	for (i=0; i<ndisks; i++) {
+		sm = &st->st_disks[i];
+		/* (Naming the same disk twice fails here with EBUSY) */
+		result = stripe_getdisk(disks[i], &sm->sm_vn, &nblocks);
+		if (result) {
+			goto fail;
+		}
+		if (i == 0 || nblocks < minblocks) {
+			minblocks = nblocks;
+		}
+
+		sm->sm_lock = lock_create("stripe");
+		sm->sm_cv = cv_create("stripe");
+		sm->sm_exited = sem_create("stripe-exit", 0);
+		if (sm->sm_lock == NULL || sm->sm_cv == NULL ||
+		    sm->sm_exited == NULL) {
+			result = ENOMEM;
+			goto fail;
+		}
+	}
+
+	if (minblocks / chunk == 0) {
+		result = EINVAL;
+		goto fail;
+	}
+
+	st->st_iolock = lock_create("stripe-io");
+	st->st_buf = kmalloc(STRIPE_MAXIO);
+	st->st_iov = kmalloc(STRIPE_MAXPIECES * sizeof(*st->st_iov));
+	st->st_done = sem_create("stripe", 0);
+	if (st->st_iolock == NULL || st->st_buf == NULL ||
+	    st->st_iov == NULL || st->st_done == NULL) {
+		result = ENOMEM;
+		goto fail;
+	}
+
+	for (i=0; i<ndisks; i++) {
+		result = thread_fork("stripe", NULL, stripe_worker,
+				     &st->st_disks[i], 0);
+		if (result) {
+			goto fail;
+		}
+		nworkers++;
+	}
+
+	st->st_dev.d_ops = &stripe_devops;
+	st->st_dev.d_blocks = (minblocks / chunk) * chunk * ndisks;
+	st->st_dev.d_blocksize = STRIPE_SECTSIZE;
+	st->st_dev.d_data = st;
+
+	spinlock_acquire(&stripe_countlock);
+	i = stripe_count++;
+	spinlock_release(&stripe_countlock);
+	snprintf(name, STRIPE_NAMELEN, "stripe%u", i);
+
+	result = vfs_adddev(name, &st->st_dev, 1);
+	if (result) {
+		goto fail;
+	}
+
+	vfs_biglock_release();
+	return 0;
+
+ fail:
+	vfs_biglock_release();
+	stripe_destroy(st, nworkers);
+	return result;
+}
@@ -44,11 +44,14 @@
 #include <kern/errno.h>
 #include <kern/fcntl.h>
 #include <stat.h>
+#include <limits.h>
 #include <lib.h>
+#include <clock.h>
 #include <array.h>
 #include <uio.h>
 #include <membar.h>
 #include <synch.h>
+#include <thread.h>
 #include <lamebus/emu.h>
 #include <platform/bus.h>
 #include <vfs.h>
@@ -65,6 +68,20 @@
 /* I/O buffer offset */
 #define EMU_BUFFER    32768
 
+/*
+ * Size of a page in the emufs page cache. Small enough to come from
+ * kmalloc's subpage allocator, so pages freed with their vnode get
+ * reused; whole pages from the page allocator are never given back
+ * under dumbvm. Several consecutive pages are filled with one device
+ * operation, so EMUFS_RAPAGES of them must fit in EMU_MAXIO. Files
+ * can't get bigger than EMUFS_MAXOFF.
+ */
+#define EMUFS_PAGESIZE 1024
+#define EMUFS_MAXOFF   ((off_t)0x100000000LL)
+
+/* Tunable; see emufs.h. */
+unsigned emufs_attr_timeout = 1000;
+
 /* Operation codes for REG_OPER */
 #define EMU_OP_OPEN          1
 #define EMU_OP_CREATE        2
@@ -458,6 +475,169 @@ emufs_eachopendir(struct vnode *v, int openflags)
 	return 0;
 }
 
+/*
+ * Directory cache.
+ *
+ * The device returns one directory entry per operation. Rather than
+ * doing that for each getdirentry call, a directory read from the
+ * start is read in full into ev_dirents in one go, and the rest of
+ * the listing (and any other listings while it's fresh) comes from
+ * there. It's fresh for emufs_attr_timeout milliseconds, and
+ * creating a file in the directory makes it stale. Directories
+ * bigger than EMUFS_DIRMAX entries aren't cached.
+ *
+ * Protected by ev_lock.
+ */
+
+/*
+ * Free a list of cached entries.
+ */
+static
+void
+emufs_dirfree(struct emufs_dirent *de)
+{
+	struct emufs_dirent *next;
+
+	while (de != NULL) {
+		next = de->de_link;
+		kfree(de->de_name);
+		kfree(de);
+		de = next;
+	}
+}
+
+/*
+ * Throw away the cached listing.
+ */
+static
+void
+emufs_dirdrop(struct emufs_vnode *ev)
+{
+	emufs_dirfree(ev->ev_dirents);
+	ev->ev_dirents = NULL;
+	ev->ev_ndirents = 0;
+	ev->ev_dirhint = NULL;
+	ev->ev_dirvalid = false;
+}
+
+/*
+ * Is the cached listing fresh?
+ */
+static
+bool
+emufs_dirfresh(struct emufs_vnode *ev)
+{
+	struct timespec now, age;
+
+	if (!ev->ev_dirvalid) {
+		return false;
+	}
+	gettime(&now);
+	timespec_sub(&now, &ev->ev_dirtime, &age);
+	return (uint64_t)age.tv_sec * 1000 + age.tv_nsec / 1000000 <
+		emufs_attr_timeout;
+}
+
+/*
+ * Read the whole directory into the cache. If it's too big, or we run
+ * out of memory, just don't cache it.
+ */
+static
+int
+emufs_dirfill(struct emufs_vnode *ev)
+{
+	struct emufs_dirent *ents = NULL, **tailp = &ents, *de;
+	unsigned num = 0;
+	struct iovec iov;
+	struct uio ku;
+	char *name;
+	off_t offset = 0;
+	size_t len;
+	int result = 0;
+
+	KASSERT(lock_do_i_hold(ev->ev_lock));
+
+	emufs_dirdrop(ev);
+
+	name = kmalloc(NAME_MAX + 1);
+	if (name == NULL) {
+		return 0;
+	}
+
+	while (1) {
+		uio_kinit(&iov, &ku, name, NAME_MAX, offset, UIO_READ);
+		result = emu_readdir(ev->ev_emu, ev->ev_handle, NAME_MAX, &ku);
+		if (result) {
+			goto fail;
+		}
+		len = NAME_MAX - ku.uio_resid;
+		if (len == 0) {
+			/* End of directory */
+			break;
+		}
+		if (num == EMUFS_DIRMAX) {
+			goto fail;
+		}
+		de = kmalloc(sizeof(*de));
+		if (de == NULL) {
+			goto fail;
+		}
+		name[len] = 0;
+		de->de_name = kstrdup(name);
+		if (de->de_name == NULL) {
+			kfree(de);
+			goto fail;
+		}
+		de->de_offset = offset;
+		de->de_next = ku.uio_offset;
+		de->de_link = NULL;
+		*tailp = de;
+		tailp = &de->de_link;
+		offset = ku.uio_offset;
+		num++;
+	}
+
+	kfree(name);
+	ev->ev_dirents = ents;
+	ev->ev_ndirents = num;
+	ev->ev_dirhint = ents;
+	ev->ev_dirend = offset;
+	ev->ev_dirvalid = true;
+	gettime(&ev->ev_dirtime);
+	return 0;
+
+ fail:
+	emufs_dirfree(ents);
+	kfree(name);
+	return result;
+}
+
+/*
+ * Find the cached entry at directory offset OFFSET. Listings are
+ * usually read in order, so try the one after the last one found
+ * first.
+ */
+static
+struct emufs_dirent *
+emufs_dirfind(struct emufs_vnode *ev, off_t offset)
+{
+	struct emufs_dirent *de;
+
+	de = ev->ev_dirhint;
+	if (de == NULL || de->de_offset != offset) {
+		for (de = ev->ev_dirents; de != NULL; de = de->de_link) {
+			if (de->de_offset == offset) {
+				break;
+			}
+		}
+		if (de == NULL) {
+			return NULL;
+		}
+	}
+	ev->ev_dirhint = de->de_link;
+	return de;
+}
+
 /*
  * VOP_RECLAIM
  *
@@ -529,44 +709,418 @@ emufs_reclaim(struct vnode *v)
 	lock_release(ef->ef_emu->e_lock);
 	vfs_biglock_release();
 
+	/* A queued readahead holds a reference, so there isn't one */
+	KASSERT(ev->ev_rapending < 0);
+	for (i=0; i<EMUFS_NPAGES; i++) {
+		if (ev->ev_pages[i].ep_data != NULL) {
+			kfree(ev->ev_pages[i].ep_data);
+		}
+	}
+	emufs_dirdrop(ev);
+	lock_destroy(ev->ev_lock);
 	kfree(ev);
 	return 0;
 }
 
+/*
+ * Page cache.
+ *
+ * Each file vnode caches up to EMUFS_NPAGES pages of its data, so
+ * rereading a file (as the ELF loader does with headers, for
+ * instance) doesn't go back to the emulator. Writes go straight to
+ * the device, dropping any pages they overlap. Reads that miss the
+ * cache and run past the end of the page go straight to the caller,
+ * up to EMU_MAXIO at a time, so loading a big file costs no more
+ * device operations than it would without the cache; only small
+ * reads fill pages. When a file is being read sequentially, the next
+ * EMUFS_RAPAGES pages are read in advance, in one device operation,
+ * by the readahead thread while the reader is busy.
+ *
+ * A page shorter than EMUFS_PAGESIZE marks end of file, so any change
+ * in size drops it too. Changes made by the host are noticed only if
+ * they change the size (see emufs_getattr below).
+ *
+ * All of this is protected by ev_lock, which is held across device
+ * operations. It comes before e_lock and ef_ralock.
+ */
+
+/*
+ * Find the cached page at OFFSET, if there is one.
+ */
+static
+struct emufs_page *
+emufs_findpage(struct emufs_vnode *ev, off_t offset)
+{
+	unsigned i;
+
+	KASSERT(lock_do_i_hold(ev->ev_lock));
+
+	for (i=0; i<EMUFS_NPAGES; i++) {
+		if (ev->ev_pages[i].ep_offset == offset) {
+			return &ev->ev_pages[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Read up to NPAGES consecutive pages, starting with the page at
+ * OFFSET (a multiple of EMUFS_PAGESIZE, not cached), into the least
+ * recently used slots, with one device operation. Stops early at a
+ * page that's already cached, and at end of file.
+ */
+static
+int
+emufs_fillpages(struct emufs_vnode *ev, off_t offset, unsigned npages)
+{
+	struct emufs_page *pages[EMUFS_RAPAGES], *ep;
+	struct iovec iov[EMUFS_RAPAGES];
+	bool taken[EMUFS_NPAGES];
+	struct uio ku;
+	size_t oldresid, got;
+	unsigned i, n;
+	int result;
+
+	KASSERT(lock_do_i_hold(ev->ev_lock));
+	KASSERT(offset % EMUFS_PAGESIZE == 0);
+	KASSERT(npages > 0 && npages <= EMUFS_RAPAGES);
+	KASSERT(emufs_findpage(ev, offset) == NULL);
+
+	bzero(taken, sizeof(taken));
+	for (n=0; n<npages; n++) {
+		if (n > 0 && (offset + n * EMUFS_PAGESIZE >= EMUFS_MAXOFF ||
+			      emufs_findpage(ev, offset + n * EMUFS_PAGESIZE)
+			      != NULL)) {
+			break;
+		}
+
+		/* An unused slot, or else the least recently used */
+		ep = NULL;
+		for (i=0; i<EMUFS_NPAGES; i++) {
+			if (taken[i]) {
+				continue;
+			}
+			if (ev->ev_pages[i].ep_offset < 0) {
+				ep = &ev->ev_pages[i];
+				break;
+			}
+			if (ep == NULL ||
+			    ev->ev_pages[i].ep_stamp < ep->ep_stamp) {
+				ep = &ev->ev_pages[i];
+			}
+		}
+		taken[ep - ev->ev_pages] = true;
+		ep->ep_offset = -1;
+		if (ep->ep_data == NULL) {
+			ep->ep_data = kmalloc(EMUFS_PAGESIZE);
+			if (ep->ep_data == NULL) {
+				if (n == 0) {
+					return ENOMEM;
+				}
+				break;
+			}
+		}
+		pages[n] = ep;
+		iov[n].iov_kbase = ep->ep_data;
+		iov[n].iov_len = EMUFS_PAGESIZE;
+	}
+
+	ku.uio_iov = iov;
+	ku.uio_iovcnt = n;
+	ku.uio_offset = offset;
+	ku.uio_resid = n * EMUFS_PAGESIZE;
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = UIO_READ;
+	ku.uio_space = NULL;
+	while (ku.uio_resid > 0) {
+		oldresid = ku.uio_resid;
+		result = emu_read(ev->ev_emu, ev->ev_handle,
+				  ku.uio_resid, &ku);
+		if (result) {
+			return result;
+		}
+		if (ku.uio_resid == oldresid) {
+			/* EOF */
+			break;
+		}
+	}
+	got = n * EMUFS_PAGESIZE - ku.uio_resid;
+
+	for (i=0; i<n; i++) {
+		ep = pages[i];
+		ep->ep_offset = offset + i * EMUFS_PAGESIZE;
+		ep->ep_len = got < EMUFS_PAGESIZE ? got : EMUFS_PAGESIZE;
+		ep->ep_stamp = ++ev->ev_clock;
+		got -= ep->ep_len;
+
+		if (ep->ep_len < EMUFS_PAGESIZE) {
+			/* Found the end, so we know the size */
+			ev->ev_size = ep->ep_offset + ep->ep_len;
+			ev->ev_sizevalid = true;
+			gettime(&ev->ev_attrtime);
+			break;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Get the page at OFFSET (a multiple of EMUFS_PAGESIZE), reading it
+ * from the device if it isn't cached.
+ */
+static
+int
+emufs_getpage(struct emufs_vnode *ev, off_t offset, struct emufs_page **ret)
+{
+	struct emufs_page *ep;
+	int result;
+
+	KASSERT(lock_do_i_hold(ev->ev_lock));
+
+	ep = emufs_findpage(ev, offset);
+	if (ep == NULL) {
+		result = emufs_fillpages(ev, offset, 1);
+		if (result) {
+			return result;
+		}
+		ep = emufs_findpage(ev, offset);
+		KASSERT(ep != NULL);
+	}
+
+	ep->ep_stamp = ++ev->ev_clock;
+	*ret = ep;
+	return 0;
+}
+
+/*
+ * Drop cached pages that overlap the range from START to END, and
+ * the end-of-file page, if cached.
+ */
+static
+void
+emufs_droppages(struct emufs_vnode *ev, off_t start, off_t end)
+{
+	struct emufs_page *ep;
+	unsigned i;
+
+	KASSERT(lock_do_i_hold(ev->ev_lock));
+
+	for (i=0; i<EMUFS_NPAGES; i++) {
+		ep = &ev->ev_pages[i];
+		if (ep->ep_offset < 0) {
+			continue;
+		}
+		if ((ep->ep_offset < end &&
+		     ep->ep_offset + EMUFS_PAGESIZE > start) ||
+		    ep->ep_len < EMUFS_PAGESIZE) {
+			ep->ep_offset = -1;
+		}
+	}
+}
+
+/*
+ * Attribute cache.
+ *
+ * The type of a file can't change, so it's just kept in ev_type. The
+ * size is kept in ev_size: it's set from emu_getsize, from finding
+ * the end of the file while reading, and by local writes and
+ * truncates. To notice changes made by the host, it's fetched again
+ * when it's used and it's more than emufs_attr_timeout milliseconds
+ * old. If the size turns out to have changed, the cached pages are
+ * stale, so they're dropped.
+ */
+static
+int
+emufs_getattr(struct emufs_vnode *ev)
+{
+	struct timespec now, age;
+	off_t size;
+	int result;
+
+	KASSERT(lock_do_i_hold(ev->ev_lock));
+
+	gettime(&now);
+	if (ev->ev_sizevalid) {
+		timespec_sub(&now, &ev->ev_attrtime, &age);
+		if ((uint64_t)age.tv_sec * 1000 + age.tv_nsec / 1000000 <
+		    emufs_attr_timeout) {
+			return 0;
+		}
+	}
+
+	result = emu_getsize(ev->ev_emu, ev->ev_handle, &size);
+	if (result) {
+		return result;
+	}
+	if (ev->ev_sizevalid && size != ev->ev_size) {
+		/* Changed behind our back */
+		emufs_droppages(ev, 0, EMUFS_MAXOFF);
+	}
+	ev->ev_size = size;
+	ev->ev_sizevalid = true;
+	ev->ev_attrtime = now;
+	return 0;
+}
+
+/*
+ * Ask the readahead thread to read the pages from OFFSET on, unless
+ * that one's cached already, another readahead of this file is
+ * pending, or the queue is full.
+ */
+static
+void
+emufs_readahead(struct emufs_vnode *ev, off_t offset)
+{
+	struct emufs_fs *ef = ev->ev_v.vn_fs->fs_data;
+	struct emufs_ra *ra;
+
+	KASSERT(lock_do_i_hold(ev->ev_lock));
+
+	if (!ef->ef_rarunning || ev->ev_rapending >= 0 ||
+	    offset >= EMUFS_MAXOFF || emufs_findpage(ev, offset) != NULL) {
+		return;
+	}
+
+	lock_acquire(ef->ef_ralock);
+	if (ef->ef_racount < EMUFS_RAQUEUE) {
+		ra = &ef->ef_raq[(ef->ef_rahead + ef->ef_racount) %
+				 EMUFS_RAQUEUE];
+		VOP_INCREF(&ev->ev_v);
+		ra->ra_vnode = ev;
+		ra->ra_offset = offset;
+		ef->ef_racount++;
+		ev->ev_rapending = offset;
+		cv_signal(ef->ef_racv, ef->ef_ralock);
+	}
+	lock_release(ef->ef_ralock);
+}
+
+/*
+ * Readahead thread: read pages into the cache as requested.
+ */
+static
+void
+emufs_rathread(void *data, unsigned long junk)
+{
+	struct emufs_fs *ef = data;
+	struct emufs_vnode *ev;
+	off_t offset;
+
+	(void)junk;
+
+	while (1) {
+		lock_acquire(ef->ef_ralock);
+		while (ef->ef_racount == 0) {
+			cv_wait(ef->ef_racv, ef->ef_ralock);
+		}
+		ev = ef->ef_raq[ef->ef_rahead].ra_vnode;
+		offset = ef->ef_raq[ef->ef_rahead].ra_offset;
+		ef->ef_rahead = (ef->ef_rahead + 1) % EMUFS_RAQUEUE;
+		ef->ef_racount--;
+		lock_release(ef->ef_ralock);
+
+		lock_acquire(ev->ev_lock);
+		/* If this fails, the read will try again and see why. */
+		if (emufs_findpage(ev, offset) == NULL) {
+			(void)emufs_fillpages(ev, offset, EMUFS_RAPAGES);
+		}
+		ev->ev_rapending = -1;
+		lock_release(ev->ev_lock);
+
+		VOP_DECREF(&ev->ev_v);
+	}
+}
+
 /*
  * VOP_READ
+ *
+ * Read through the page cache, except for uncached stretches longer
+ * than a page, which go straight to the caller. If this read starts
+ * where the last one ended, start reading the next pages in advance.
  */
 static
 int
 emufs_read(struct vnode *v, struct uio *uio)
 {
 	struct emufs_vnode *ev = v->vn_data;
-	uint32_t amt;
+	struct emufs_page *ep;
+	off_t pageoff;
+	uint32_t skip, amt;
 	size_t oldresid;
-	int result;
+	bool sequential, eof = false;
+	int result = 0;
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
-	while (uio->uio_resid > 0) {
-		amt = uio->uio_resid;
-		if (amt > EMU_MAXIO) {
-			amt = EMU_MAXIO;
+	lock_acquire(ev->ev_lock);
+	sequential = uio->uio_offset == ev->ev_lastend;
+
+	/* If we know the size, check the host hasn't changed it */
+	if (ev->ev_sizevalid) {
+		result = emufs_getattr(ev);
+		if (result) {
+			goto out;
 		}
+	}
 
-		oldresid = uio->uio_resid;
+	while (uio->uio_resid > 0) {
+		if (uio->uio_offset >= EMUFS_MAXOFF) {
+			/* beyond the largest size the file can have */
+			eof = true;
+			break;
+		}
+		pageoff = uio->uio_offset - uio->uio_offset % EMUFS_PAGESIZE;
+		skip = uio->uio_offset - pageoff;
+		if (uio->uio_resid > EMUFS_PAGESIZE - skip &&
+		    emufs_findpage(ev, pageoff) == NULL) {
+			/* Big and not cached: skip the cache */
+			amt = uio->uio_resid;
+			if (amt > EMU_MAXIO) {
+				amt = EMU_MAXIO;
+			}
+			oldresid = uio->uio_resid;
+			result = emu_read(ev->ev_emu, ev->ev_handle, amt, uio);
+			if (result) {
+				goto out;
+			}
+			if (uio->uio_resid == oldresid) {
+				/* nothing read - EOF */
+				eof = true;
+				break;
+			}
+			continue;
+		}
 
-		result = emu_read(ev->ev_emu, ev->ev_handle, amt, uio);
+		result = emufs_getpage(ev, pageoff, &ep);
 		if (result) {
-			return result;
+			goto out;
 		}
-
-		if (uio->uio_resid == oldresid) {
-			/* nothing read - EOF */
+		if (skip < ep->ep_len) {
+			result = uiomove(ep->ep_data + skip,
+					 ep->ep_len - skip, uio);
+			if (result) {
+				goto out;
+			}
+		}
+		if (ep->ep_len < EMUFS_PAGESIZE) {
+			eof = true;
 			break;
 		}
 	}
 
-	return 0;
+	ev->ev_lastend = uio->uio_offset;
+	if (sequential && !eof) {
+		/* The page we'll need next that we don't have */
+		pageoff = uio->uio_offset - uio->uio_offset % EMUFS_PAGESIZE;
+		if (emufs_findpage(ev, pageoff) != NULL) {
+			pageoff += EMUFS_PAGESIZE;
+		}
+		emufs_readahead(ev, pageoff);
+	}
+
+ out:
+	lock_release(ev->ev_lock);
+	return result;
 }
 
 /*
@@ -577,16 +1131,49 @@ int
 emufs_getdirentry(struct vnode *v, struct uio *uio)
 {
 	struct emufs_vnode *ev = v->vn_data;
+	struct emufs_dirent *de;
 	uint32_t amt;
+	int result;
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
+	lock_acquire(ev->ev_lock);
+
+	/* Starting a listing: make sure the cache is fresh */
+	if (uio->uio_offset == 0 && !emufs_dirfresh(ev)) {
+		result = emufs_dirfill(ev);
+		if (result) {
+			lock_release(ev->ev_lock);
+			return result;
+		}
+	}
+
+	if (ev->ev_dirvalid) {
+		if (uio->uio_offset == ev->ev_dirend) {
+			/* EOF */
+			lock_release(ev->ev_lock);
+			return 0;
+		}
+		de = emufs_dirfind(ev, uio->uio_offset);
+		if (de != NULL) {
+			result = uiomove(de->de_name, strlen(de->de_name), uio);
+			if (result == 0) {
+				uio->uio_offset = de->de_next;
+			}
+			lock_release(ev->ev_lock);
+			return result;
+		}
+	}
+
+	/* Not cached; ask the device */
 	amt = uio->uio_resid;
 	if (amt > EMU_MAXIO) {
 		amt = EMU_MAXIO;
 	}
 
-	return emu_readdir(ev->ev_emu, ev->ev_handle, amt, uio);
+	result = emu_readdir(ev->ev_emu, ev->ev_handle, amt, uio);
+	lock_release(ev->ev_lock);
+	return result;
 }
 
 /*
@@ -599,10 +1186,14 @@ emufs_write(struct vnode *v, struct uio *uio)
 	struct emufs_vnode *ev = v->vn_data;
 	uint32_t amt;
 	size_t oldresid;
-	int result;
+	int result = 0;
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
+	lock_acquire(ev->ev_lock);
+
+	emufs_droppages(ev, uio->uio_offset, uio->uio_offset + uio->uio_resid);
+
 	while (uio->uio_resid > 0) {
 		amt = uio->uio_resid;
 		if (amt > EMU_MAXIO) {
@@ -613,7 +1204,7 @@ emufs_write(struct vnode *v, struct uio *uio)
 
 		result = emu_write(ev->ev_emu, ev->ev_handle, amt, uio);
 		if (result) {
-			return result;
+			break;
 		}
 
 		if (uio->uio_resid == oldresid) {
@@ -622,7 +1213,16 @@ emufs_write(struct vnode *v, struct uio *uio)
 		}
 	}
 
-	return 0;
+	/* Keep the cached size up to date */
+	if (result) {
+		ev->ev_sizevalid = false;
+	}
+	else if (ev->ev_sizevalid && uio->uio_offset > ev->ev_size) {
+		ev->ev_size = uio->uio_offset;
+	}
+
+	lock_release(ev->ev_lock);
+	return result;
 }
 
 /*
@@ -655,15 +1255,16 @@ emufs_stat(struct vnode *v, struct stat *statbuf)
 
 	bzero(statbuf, sizeof(struct stat));
 
-	result = emu_getsize(ev->ev_emu, ev->ev_handle, &statbuf->st_size);
+	lock_acquire(ev->ev_lock);
+	result = emufs_getattr(ev);
 	if (result) {
+		lock_release(ev->ev_lock);
 		return result;
 	}
+	statbuf->st_size = ev->ev_size;
+	lock_release(ev->ev_lock);
 
-	result = VOP_GETTYPE(v, &statbuf->st_mode);
-	if (result) {
-		return result;
-	}
+	statbuf->st_mode = ev->ev_type;
 	statbuf->st_mode |= 0644; /* possibly a lie */
 	statbuf->st_nlink = 1;    /* might be a lie, but doesn't matter much */
 	statbuf->st_blocks = 0;   /* almost certainly a lie */
@@ -672,26 +1273,15 @@ emufs_stat(struct vnode *v, struct stat *statbuf)
 }
 
 /*
- * VOP_GETTYPE for files
+ * VOP_GETTYPE
  */
 static
 int
-emufs_file_gettype(struct vnode *v, uint32_t *result)
+emufs_gettype(struct vnode *v, uint32_t *result)
 {
-	(void)v;
-	*result = S_IFREG;
-	return 0;
-}
+	struct emufs_vnode *ev = v->vn_data;
 
-/*
- * VOP_GETTYPE for directories
- */
-static
-int
-emufs_dir_gettype(struct vnode *v, uint32_t *result)
-{
-	(void)v;
-	*result = S_IFDIR;
+	*result = ev->ev_type;
 	return 0;
 }
 
@@ -725,7 +1315,21 @@ int
 emufs_truncate(struct vnode *v, off_t len)
 {
 	struct emufs_vnode *ev = v->vn_data;
-	return emu_trunc(ev->ev_emu, ev->ev_handle, len);
+	int result;
+
+	lock_acquire(ev->ev_lock);
+	emufs_droppages(ev, len, EMUFS_MAXOFF);
+	result = emu_trunc(ev->ev_emu, ev->ev_handle, len);
+	if (result) {
+		ev->ev_sizevalid = false;
+	}
+	else {
+		ev->ev_size = len;
+		ev->ev_sizevalid = true;
+		gettime(&ev->ev_attrtime);
+	}
+	lock_release(ev->ev_lock);
+	return result;
 }
 
 /*
@@ -751,6 +1355,12 @@ emufs_creat(struct vnode *dir, const char *name, bool excl, mode_t mode,
 		return result;
 	}
 
+	/* The directory may have grown */
+	lock_acquire(ev->ev_lock);
+	ev->ev_sizevalid = false;
+	emufs_dirdrop(ev);
+	lock_release(ev->ev_lock);
+
 	result = emufs_loadvnode(ef, handle, isdir, &newguy);
 	vfs_biglock_release();
 	if (result) {
@@ -1090,7 +1700,7 @@ static const struct vnode_ops emufs_fileops = {
 	.vop_write = emufs_write,
 	.vop_ioctl = emufs_ioctl,
 	.vop_stat = emufs_stat,
-	.vop_gettype = emufs_file_gettype,
+	.vop_gettype = emufs_gettype,
 	.vop_isseekable = emufs_isseekable,
 	.vop_fsync = emufs_fsync,
 	.vop_mmap = emufs_mmap,
@@ -1124,7 +1734,7 @@ static const struct vnode_ops emufs_dirops = {
 	.vop_write = emufs_uio_op_isdir,
 	.vop_ioctl = emufs_ioctl,
 	.vop_stat = emufs_stat,
-	.vop_gettype = emufs_dir_gettype,
+	.vop_gettype = emufs_gettype,
 	.vop_isseekable = emufs_isseekable,
 	.vop_fsync = emufs_void_op_isdir,
 	.vop_mmap = emufs_void_op_isdir,
@@ -1186,9 +1796,35 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 	ev->ev_emu = ef->ef_emu;
 	ev->ev_handle = handle;
 
+	ev->ev_lock = lock_create("emufs-vnode");
+	if (ev->ev_lock == NULL) {
+		lock_release(ef->ef_emu->e_lock);
+		vfs_biglock_release();
+		kfree(ev);
+		return ENOMEM;
+	}
+	for (i=0; i<EMUFS_NPAGES; i++) {
+		ev->ev_pages[i].ep_offset = -1;
+		ev->ev_pages[i].ep_len = 0;
+		ev->ev_pages[i].ep_stamp = 0;
+		ev->ev_pages[i].ep_data = NULL;
+	}
+	ev->ev_clock = 0;
+	ev->ev_lastend = 0;
+	ev->ev_rapending = -1;
+	ev->ev_type = isdir ? S_IFDIR : S_IFREG;
+	ev->ev_sizevalid = false;
+	ev->ev_size = 0;
+	ev->ev_dirents = NULL;
+	ev->ev_ndirents = 0;
+	ev->ev_dirhint = NULL;
+	ev->ev_dirend = 0;
+	ev->ev_dirvalid = false;
+
 	result = vnode_init(&ev->ev_v, isdir ? &emufs_dirops : &emufs_fileops,
 			    &ef->ef_fs, ev);
 	if (result) {
+		lock_destroy(ev->ev_lock);
 		lock_release(ef->ef_emu->e_lock);
 		vfs_biglock_release();
 		kfree(ev);
@@ -1199,6 +1835,7 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 	if (result) {
 		/* note: vnode_cleanup undoes vnode_init - it does not kfree */
 		vnode_cleanup(&ev->ev_v);
+		lock_destroy(ev->ev_lock);
 		lock_release(ef->ef_emu->e_lock);
 		vfs_biglock_release();
 		kfree(ev);
@@ -1316,6 +1953,23 @@ emufs_addtovfs(struct emu_softc *sc, const char *devname)
 		return ENOMEM;
 	}
 
+	ef->ef_ralock = lock_create("emufs-ra");
+	if (ef->ef_ralock == NULL) {
+		vnodearray_destroy(ef->ef_vnodes);
+		kfree(ef);
+		return ENOMEM;
+	}
+	ef->ef_racv = cv_create("emufs-ra");
+	if (ef->ef_racv == NULL) {
+		lock_destroy(ef->ef_ralock);
+		vnodearray_destroy(ef->ef_vnodes);
+		kfree(ef);
+		return ENOMEM;
+	}
+	ef->ef_rahead = 0;
+	ef->ef_racount = 0;
+	ef->ef_rarunning = false;
+
 	result = emufs_loadvnode(ef, EMU_ROOTHANDLE, 1, &ef->ef_root);
 	if (result) {
 		kfree(ef);
@@ -1328,8 +1982,18 @@ emufs_addtovfs(struct emu_softc *sc, const char *devname)
 	if (result) {
 		VOP_DECREF(&ef->ef_root->ev_v);
 		kfree(ef);
+		return result;
 	}
-	return result;
+
+	/* Readahead is optional, so it's not worth failing over */
+	result = thread_fork("emufs-ra", NULL, emufs_rathread, ef, 0);
+	if (result) {
+		kprintf("%s: no readahead: %s\n", devname, strerror(result));
+	}
+	else {
+		ef->ef_rarunning = true;
+	}
+	return 0;
 }
 
 //
@@ -36,7 +36,9 @@
 #include <lib.h>
 #include <uio.h>
 #include <membar.h>
+#include <spinlock.h>
 #include <synch.h>
+#include <wchan.h>
 #include <platform/bus.h>
 #include <vfs.h>
 #include <lamebus/lhd.h>
@@ -60,6 +62,14 @@
 /* Buffer (offset within slot)  */
 #define LHD_BUFFER      32768
 
+/*
+ * Largest request lhd_io makes (in sectors), and how often (in
+ * sectors) a long request checks whether to let another one go
+ * first.
+ */
+#define LHD_MAXIO       128
+#define LHD_BURST       16
+
 /*
  * Shortcut for reading a register.
  */
@@ -96,28 +106,143 @@ int lhd_code_to_errno(struct lhd_softc *lh, int code)
 }
 
 /*
- * Record that an I/O has completed: save the result and poke the
- * completion semaphore.
+ * Start the next sector transfer: the next sector of the current
+ * request, or if that's finished, the first sector of whichever
+ * queued request the scheduler picks. Does nothing if there's nothing
+ * to do. Called with lh_lock held, from either thread or interrupt
+ * context.
  */
 static
 void
+lhd_start(struct lhd_softc *lh)
+{
+	struct lhd_request *req;
+	struct iosched_req *ir;
+	uint32_t statval = LHD_WORKING;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_lock));
+
+	if (lh->lh_cur == NULL) {
+		ir = iosched_next(lh->lh_sched);
+		if (ir == NULL) {
+			/* Idle */
+			return;
+		}
+		lh->lh_cur = ir->ir_data;
+	}
+	req = lh->lh_cur;
+	KASSERT(req->lr_pos < req->lr_nsect);
+
+	/*
+	 * Are we writing? If so, transfer the data to the on-card
+	 * buffer.
+	 */
+	if (req->lr_write) {
+		memcpy(lh->lh_buf,
+		       (char *)req->lr_data + req->lr_pos * LHD_SECTSIZE,
+		       LHD_SECTSIZE);
+		membar_store_store();
+		statval |= LHD_ISWRITE;
+	}
+
+	/* Tell it what sector we want... */
+	lhd_wreg(lh, LHD_REG_SECT, req->lr_sector + req->lr_pos);
+
+	/* and start the operation. */
+	lhd_wreg(lh, LHD_REG_STAT, statval);
+}
+
+/*
+ * Record that a sector transfer has completed. If that finishes the
+ * current request (or it failed), take it off the device; either way,
+ * start the next transfer before returning. Returns the finished
+ * request, if any, for the caller to complete once it has released
+ * lh_lock.
+ */
+static
+struct lhd_request *
 lhd_iodone(struct lhd_softc *lh, int err)
 {
-	lh->lh_result = err;
-	V(lh->lh_done);
+	struct lhd_request *req;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_lock));
+
+	req = lh->lh_cur;
+	if (req == NULL) {
+		/* Spurious; nothing was running */
+		return NULL;
+	}
+
+	/*
+	 * Are we reading? If so, and if we succeeded, transfer the
+	 * data out of the on-card buffer.
+	 */
+	if (err == 0 && !req->lr_write) {
+		membar_load_load();
+		memcpy((char *)req->lr_data + req->lr_pos * LHD_SECTSIZE,
+		       lh->lh_buf, LHD_SECTSIZE);
+	}
+
+	if (err == 0) {
+		req->lr_pos++;
+	}
+	if (err == 0 && req->lr_pos < req->lr_nsect) {
+		/*
+		 * More of the same request. But after each burst, if
+		 * anything else is waiting, put the rest back and let
+		 * the scheduler choose, so a long transfer doesn't hold
+		 * up an overdue one until it's finished.
+		 */
+		if (req->lr_pos % LHD_BURST == 0 &&
+		    !iosched_isempty(lh->lh_sched)) {
+			req->lr_sched.ir_sector = req->lr_sector + req->lr_pos;
+			req->lr_sched.ir_nsect = req->lr_nsect - req->lr_pos;
+			iosched_requeue(lh->lh_sched, &req->lr_sched);
+			lh->lh_cur = NULL;
+		}
+		req = NULL;
+	}
+	else {
+		req->lr_result = err;
+		lh->lh_cur = NULL;
+	}
+
+	lhd_start(lh);
+	return req;
+}
+
+/*
+ * Finish a request: run the callback, then mark it done and wake up
+ * anyone in lhd_wait. Called without lh_lock held.
+ */
+static
+void
+lhd_complete(struct lhd_softc *lh, struct lhd_request *req)
+{
+	if (req->lr_callback != NULL) {
+		req->lr_callback(req);
+	}
+
+	spinlock_acquire(&lh->lh_lock);
+	req->lr_done = true;
+	wchan_wakeall(lh->lh_wchan, &lh->lh_lock);
+	spinlock_release(&lh->lh_lock);
 }
 
 /*
  * Interrupt handler for lhd.
  * Read the status register; if an operation finished, clear the status
- * register and report completion.
+ * register, record completion, and start the next operation.
  */
 void
 lhd_irq(void *vlh)
 {
 	struct lhd_softc *lh = vlh;
+	struct lhd_request *done = NULL;
 	uint32_t val;
 
+	spinlock_acquire(&lh->lh_lock);
+
 	val = lhd_rdreg(lh, LHD_REG_STAT);
 
 	switch (val & LHD_STATEMASK) {
@@ -128,9 +253,84 @@ lhd_irq(void *vlh)
 	    case LHD_INVSECT:
 	    case LHD_MEDIA:
 		lhd_wreg(lh, LHD_REG_STAT, 0);
-		lhd_iodone(lh, lhd_code_to_errno(lh, val));
+		done = lhd_iodone(lh, lhd_code_to_errno(lh, val));
 		break;
 	}
+
+	spinlock_release(&lh->lh_lock);
+
+	if (done != NULL) {
+		lhd_complete(lh, done);
+	}
+}
+
+/*
+ * Set up a request for NSECT sectors starting at SECTOR, to be read
+ * into or written from DATA. The caller may set lr_callback and
+ * lr_cbdata afterwards.
+ */
+void
+lhd_request_init(struct lhd_request *req, uint32_t sector, uint32_t nsect,
+		 bool write, void *data)
+{
+	req->lr_sector = sector;
+	req->lr_nsect = nsect;
+	req->lr_write = write;
+	req->lr_data = data;
+	req->lr_callback = NULL;
+	req->lr_cbdata = NULL;
+	req->lr_pos = 0;
+	req->lr_result = 0;
+	req->lr_done = false;
+}
+
+/*
+ * Queue a request. Returns at once; use lhd_wait or a callback to
+ * find out when it's finished. Fails (without queueing anything) if
+ * the request runs off the end of the disk.
+ *
+ * May be called from interrupt context.
+ */
+int
+lhd_submit(struct lhd_softc *lh, struct lhd_request *req)
+{
+	/* Don't allow I/O past the end of the disk. */
+	if (req->lr_nsect == 0 || req->lr_sector >= lh->lh_dev.d_blocks ||
+	    req->lr_nsect > lh->lh_dev.d_blocks - req->lr_sector) {
+		return EINVAL;
+	}
+
+	req->lr_pos = 0;
+	req->lr_result = 0;
+	req->lr_done = false;
+	req->lr_sched.ir_sector = req->lr_sector;
+	req->lr_sched.ir_nsect = req->lr_nsect;
+	req->lr_sched.ir_write = req->lr_write;
+	req->lr_sched.ir_data = req;
+
+	spinlock_acquire(&lh->lh_lock);
+	iosched_add(lh->lh_sched, &req->lr_sched);
+	if (lh->lh_cur == NULL) {
+		lhd_start(lh);
+	}
+	spinlock_release(&lh->lh_lock);
+
+	return 0;
+}
+
+/*
+ * Wait for a submitted request to finish, and return its result.
+ */
+int
+lhd_wait(struct lhd_softc *lh, struct lhd_request *req)
+{
+	spinlock_acquire(&lh->lh_lock);
+	while (!req->lr_done) {
+		wchan_sleep(lh->lh_wchan, &lh->lh_lock);
+	}
+	spinlock_release(&lh->lh_lock);
+
+	return req->lr_result;
 }
 
 /*
@@ -180,20 +380,49 @@ lhd_reset(struct lhd_softc *lh)
 #endif
 
 /*
- * I/O function (for both reads and writes)
+ * Do NSECT sectors starting at SECTOR, to or from BUF, as a single
+ * request, and wait for it.
+ */
+static
+int
+lhd_rw(struct lhd_softc *lh, uint32_t sector, uint32_t nsect, bool write,
+       void *buf)
+{
+	struct lhd_request req;
+	int result;
+
+	lhd_request_init(&req, sector, nsect, write, buf);
+	result = lhd_submit(lh, &req);
+	if (result) {
+		return result;
+	}
+	return lhd_wait(lh, &req);
+}
+
+/*
+ * I/O function (for both reads and writes). This is a synchronous
+ * wrapper around the request interface. Kernel buffers that hold
+ * whole sectors are handed to the device as they are; anything else
+ * (user memory, which can't be touched from the interrupt handler,
+ * or odd-sized pieces of an iovec) goes through the bounce buffer.
+ * Either way each piece of up to LHD_MAXIO sectors is a single
+ * request, so we sleep and wake up once per piece rather than once
+ * per sector.
  */
 static
 int
 lhd_io(struct device *d, struct uio *uio)
 {
 	struct lhd_softc *lh = d->d_data;
+	struct iovec *iov;
+	bool write = uio->uio_rw == UIO_WRITE;
 
 	uint32_t sector = uio->uio_offset / LHD_SECTSIZE;
 	uint32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
 	uint32_t len = uio->uio_resid / LHD_SECTSIZE;
 	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
-	uint32_t i;
-	uint32_t statval = LHD_WORKING;
+	uint32_t n;
+	size_t bytes;
 	int result;
 
 	/* Don't allow I/O that isn't sector-aligned. */
@@ -202,66 +431,70 @@ lhd_io(struct device *d, struct uio *uio)
 	}
 
 	/* Don't allow I/O past the end of the disk. */
-	/* XXX this check can overflow */
-	if (sector+len > lh->lh_dev.d_blocks) {
+	if (sector > lh->lh_dev.d_blocks ||
+	    len > lh->lh_dev.d_blocks - sector) {
 		return EINVAL;
 	}
 
-	/* Set up the value to write into the status register. */
-	if (uio->uio_rw==UIO_WRITE) {
-		statval |= LHD_ISWRITE;
-	}
-
 	/* Loop over all the sectors we were asked to do. */
-	for (i=0; i<len; i++) {
-
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
-
-		/*
-		 * Are we writing? If so, transfer the data to the
-		 * on-card buffer.
-		 */
-		if (uio->uio_rw == UIO_WRITE) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-			membar_store_store();
+	result = 0;
+	while (uio->uio_resid > 0) {
+		iov = uio->uio_iov;
+		if (iov->iov_len == 0) {
+			KASSERT(uio->uio_iovcnt > 1);
+			uio->uio_iov++;
+			uio->uio_iovcnt--;
+			continue;
+		}
+		sector = uio->uio_offset / LHD_SECTSIZE;
+
+		if (uio->uio_segflg == UIO_SYSSPACE &&
+		    iov->iov_len % LHD_SECTSIZE == 0) {
+			/* Straight to or from the caller's buffer. */
+			bytes = iov->iov_len < uio->uio_resid ?
+				iov->iov_len : uio->uio_resid;
+			n = bytes / LHD_SECTSIZE;
+			if (n > LHD_MAXIO) {
+				n = LHD_MAXIO;
+			}
+			bytes = n * LHD_SECTSIZE;
+			result = lhd_rw(lh, sector, n, write, iov->iov_kbase);
 			if (result) {
-				V(lh->lh_clear);
-				return result;
+				break;
 			}
+			iov->iov_kbase = (char *)iov->iov_kbase + bytes;
+			iov->iov_len -= bytes;
+			uio->uio_resid -= bytes;
+			uio->uio_offset += bytes;
+			continue;
 		}
 
-		/* Tell it what sector we want... */
-		lhd_wreg(lh, LHD_REG_SECT, sector+i);
-
-		/* and start the operation. */
-		lhd_wreg(lh, LHD_REG_STAT, statval);
-
-		/* Now wait until the interrupt handler tells us we're done. */
-		P(lh->lh_done);
-
-		/* Get the result value saved by the interrupt handler. */
-		result = lh->lh_result;
-
-		/*
-		 * Are we reading? If so, and if we succeeded,
-		 * transfer the data out of the on-card buffer.
-		 */
-		if (result==0 && uio->uio_rw==UIO_READ) {
-			membar_load_load();
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
+		/* Through the bounce buffer. */
+		n = uio->uio_resid / LHD_SECTSIZE;
+		if (n > LHD_MAXIO) {
+			n = LHD_MAXIO;
 		}
+		bytes = n * LHD_SECTSIZE;
 
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
+		lock_acquire(lh->lh_bouncelock);
+		if (write) {
+			result = uiomove(lh->lh_bounce, bytes, uio);
+		}
+		if (result == 0) {
+			result = lhd_rw(lh, sector, n, write, lh->lh_bounce);
+		}
+		if (result == 0 && !write) {
+			result = uiomove(lh->lh_bounce, bytes, uio);
+		}
+		lock_release(lh->lh_bouncelock);
 
 		/* If we failed, return the error. */
 		if (result) {
-			return result;
+			break;
 		}
 	}
 
-	return 0;
+	return result;
 }
 
 static const struct device_ops lhd_devops = {
@@ -284,15 +517,34 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
-	/* Create the semaphores. */
-	lh->lh_clear = sem_create("lhd-clear", 1);
-	if (lh->lh_clear == NULL) {
+	/* Set up the request queue. */
+	spinlock_init(&lh->lh_lock);
+	lh->lh_wchan = wchan_create("lhd");
+	if (lh->lh_wchan == NULL) {
+		spinlock_cleanup(&lh->lh_lock);
+		return ENOMEM;
+	}
+	lh->lh_cur = NULL;
+	lh->lh_sched = iosched_create(name, &lh->lh_lock);
+	if (lh->lh_sched == NULL) {
+		wchan_destroy(lh->lh_wchan);
+		spinlock_cleanup(&lh->lh_lock);
 		return ENOMEM;
 	}
-	lh->lh_done = sem_create("lhd-done", 0);
-	if (lh->lh_done == NULL) {
-		sem_destroy(lh->lh_clear);
-		lh->lh_clear = NULL;
+
+	/* Allocated once; lhd_io would otherwise need it on every call */
+	lh->lh_bounce = kmalloc(LHD_MAXIO * LHD_SECTSIZE);
+	lh->lh_bouncelock = lock_create("lhd bounce");
+	if (lh->lh_bounce == NULL || lh->lh_bouncelock == NULL) {
+		if (lh->lh_bounce != NULL) {
+			kfree(lh->lh_bounce);
+		}
+		if (lh->lh_bouncelock != NULL) {
+			lock_destroy(lh->lh_bouncelock);
+		}
+		iosched_destroy(lh->lh_sched);
+		wchan_destroy(lh->lh_wchan);
+		spinlock_cleanup(&lh->lh_lock);
 		return ENOMEM;
 	}
 
@@ -31,12 +31,51 @@
 #define _LAMEBUS_LHD_H_
 
 #include <device.h>
+#include <spinlock.h>
+#include <iosched.h>
 
 /*
  * Our sector size
  */
 #define LHD_SECTSIZE  512
 
+/*
+ * Asynchronous block request.
+ *
+ * The caller fills in the first group of fields (lhd_request_init
+ * does this) and passes the request to lhd_submit, which queues it
+ * and returns at once. The device's I/O scheduler (see iosched.h)
+ * decides the order in which queued requests are started. The
+ * driver transfers the sectors one at a time, moving from one to the
+ * next in the interrupt handler, so no thread needs to be involved
+ * until the whole request is finished. Then it calls lr_callback, if
+ * there is one, and marks the request done; lhd_wait sleeps until
+ * that happens. A long request may be put back in the queue partway
+ * through (see iosched_requeue) to let an overdue one go first.
+ *
+ * lr_data must be kernel memory (it's touched in interrupt context)
+ * holding lr_nsect sectors. The callback is called in interrupt
+ * context and must not sleep; it may submit further requests. It
+ * must not free the request: the driver still uses it afterwards.
+ * The request belongs to the driver from lhd_submit until lr_done is
+ * set.
+ */
+struct lhd_request {
+	/* Set up by the caller */
+	uint32_t lr_sector;		/* First sector */
+	uint32_t lr_nsect;		/* Number of sectors */
+	bool lr_write;			/* Write (otherwise read) */
+	void *lr_data;			/* Buffer */
+	void (*lr_callback)(struct lhd_request *);  /* Completion, or NULL */
+	void *lr_cbdata;		/* For the callback's use */
+
+	/* Maintained by the driver */
+	uint32_t lr_pos;		/* Sectors transferred so far */
+	int lr_result;			/* Result (errno), once done */
+	volatile bool lr_done;		/* Finished */
+	struct iosched_req lr_sched;	/* Queue entry */
+};
+
 /*
  * Hardware device data associated with lhd (LAMEbus hard disk)
  */
@@ -51,9 +90,12 @@ struct lhd_softc {
 	 */
 
 	void *lh_buf;			/* Pointer to on-card I/O buffer */
-	int lh_result;			/* Result from I/O operation */
-	struct semaphore *lh_clear;	/* Synchronization */
-	struct semaphore *lh_done;
+	struct spinlock lh_lock;	/* Protects the fields below */
+	struct wchan *lh_wchan;		/* For lhd_wait */
+	struct lhd_request *lh_cur;	/* Request on the device, or NULL */
+	struct iosched *lh_sched;	/* Requests waiting their turn */
+	void *lh_bounce;		/* lhd_io buffer, LHD_MAXIO sectors */
+	struct lock *lh_bouncelock;	/* Protects lh_bounce */
 
 	struct device lh_dev;		/* VFS device structure */
 };
@@ -61,4 +103,10 @@ struct lhd_softc {
 /* Functions called by lower-level drivers */
 void lhd_irq(/*struct lhd_softc*/ void *);	/* Interrupt handler */
 
+/* Block request interface */
+void lhd_request_init(struct lhd_request *req, uint32_t sector,
+		      uint32_t nsect, bool write, void *data);
+int lhd_submit(struct lhd_softc *lh, struct lhd_request *req);
+int lhd_wait(struct lhd_softc *lh, struct lhd_request *req);
+
 #endif /* _LAMEBUS_LHD_H_ */
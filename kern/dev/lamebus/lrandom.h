@@ -30,8 +30,6 @@
 #ifndef _LAMEBUS_LRANDOM_H_
 #define _LAMEBUS_LRANDOM_H_
 
-struct uio;
-
 struct lrandom_softc {
 	/* Initialized by lower-level attach routine */
 	void *lr_bus;
@@ -40,7 +38,5 @@ struct lrandom_softc {
 
 /* Functions called by higher-level drivers */
 uint32_t lrandom_random(/*struct lrandom_softc*/ void *devdata);
-uint32_t lrandom_randmax(/*struct lrandom_softc*/ void *devdata);
-int lrandom_read(/*struct lrandom_softc*/ void *, struct uio *);
 
 #endif /* _LAMEBUS_LRANDOM_H_ */
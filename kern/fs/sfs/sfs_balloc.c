@@ -51,6 +51,24 @@ sfs_clearblock(struct sfs_fs *sfs, daddr_t block)
 	return sfs_writeblock(sfs, block, zeros, SFS_BLOCKSIZE);
 }
 
+/*
+ * Note that the freemap bit for DISKBLOCK has changed. Besides the
+ * overall dirty flag, we keep track of which block of the freemap the
+ * bit lives in, so sync only has to write out the freemap blocks that
+ * actually changed.
+ */
+static
+void
+sfs_freemap_dirty(struct sfs_fs *sfs, daddr_t diskblock)
+{
+	unsigned fmblock = diskblock / SFS_BITSPERBLOCK;
+
+	if (!bitmap_isset(sfs->sfs_freemapblkdirty, fmblock)) {
+		bitmap_mark(sfs->sfs_freemapblkdirty, fmblock);
+	}
+	sfs->sfs_freemapdirty = true;
+}
+
 /*
  * Allocate a block.
  */
@@ -59,11 +77,22 @@ sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
 {
 	int result;
 
-	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
+	/*
+	 * Skip blocks the journal still has images of; see
+	 * sfs_journal.c. (If those are the only free blocks left, we
+	 * report ENOSPC until the next checkpoint.)
+	 */
+	do {
+		result = bitmap_alloc(sfs->sfs_freemap, diskblock);
+	} while (result == 0 && sfs->sfs_journal != NULL &&
+		 sfs_jhold(sfs, *diskblock));
+	if (sfs->sfs_journal != NULL) {
+		sfs_junhold(sfs);
+	}
 	if (result) {
 		return result;
 	}
-	sfs->sfs_freemapdirty = true;
+	sfs_freemap_dirty(sfs, *diskblock);
 
 	if (*diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: %s: balloc: invalid block %u\n",
@@ -85,7 +114,42 @@ void
 sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
 {
 	bitmap_unmark(sfs->sfs_freemap, diskblock);
-	sfs->sfs_freemapdirty = true;
+	sfs_freemap_dirty(sfs, diskblock);
+}
+
+/*
+ * Free a whole list of blocks at once. The list is sorted in place
+ * (files are mostly allocated in order, so it's usually close to
+ * sorted already) and each run of consecutive blocks is cleared from
+ * the freemap with a single range operation.
+ */
+void
+sfs_bfreelist(struct sfs_fs *sfs, daddr_t *blocks, unsigned n)
+{
+	daddr_t b, fmblock;
+	unsigned i, j, run;
+
+	for (i=1; i<n; i++) {
+		b = blocks[i];
+		for (j=i; j>0 && blocks[j-1] > b; j--) {
+			blocks[j] = blocks[j-1];
+		}
+		blocks[j] = b;
+	}
+
+	for (i=0; i<n; i+=run) {
+		for (run=1; i+run<n && blocks[i+run] == blocks[i]+run; run++) {
+			/* nothing */
+		}
+		bitmap_unmark_range(sfs->sfs_freemap, blocks[i], run);
+
+		/* Note each freemap block the run touches as dirty */
+		for (fmblock = blocks[i] / SFS_BITSPERBLOCK;
+		     fmblock <= (blocks[i]+run-1) / SFS_BITSPERBLOCK;
+		     fmblock++) {
+			sfs_freemap_dirty(sfs, fmblock * SFS_BITSPERBLOCK);
+		}
+	}
 }
 
 /*
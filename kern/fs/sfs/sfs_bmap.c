@@ -89,7 +89,7 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 
 			/* Remember what we allocated; mark inode dirty */
 			sv->sv_i.sfi_direct[fileblock] = block;
-			sv->sv_dirty = true;
+			sfs_dirty_inode(sv);
 		}
 
 		/*
@@ -152,7 +152,7 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		sv->sv_i.sfi_indirect = idblock;
 
 		/* Mark the inode dirty */
-		sv->sv_dirty = true;
+		sfs_dirty_inode(sv);
 
 		/* Clear the indirect block buffer */
 		bzero(idbuf, sizeof(idbuf));
@@ -181,7 +181,7 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		idbuf[idoff] = block;
 
 		/* The indirect block is now dirty; write it back */
-		result = sfs_writeblock(sfs, idblock, idbuf, sizeof(idbuf));
+		result = sfs_jwrite(sfs, idblock, idbuf, sizeof(idbuf));
 		if (result) {
 			return result;
 		}
@@ -198,10 +198,18 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 }
 
 /*
- * Called for ftruncate() and from sfs_reclaim.
+ * Free the blocks of the on-disk inode SFI that are at or past block
+ * BLOCKLEN of the file, and clear the pointers to them. Sets *DIRTY
+ * if SFI was changed.
+ *
+ * Rather than going through sfs_bfree one block at a time, the blocks
+ * are collected in a list and released with one sfs_bfreelist call.
+ * If the indirect block is going away entirely it isn't updated,
+ * just freed along with everything it points to.
  */
 int
-sfs_itrunc(struct sfs_vnode *sv, off_t len)
+sfs_dinode_trunc(struct sfs_fs *sfs, struct sfs_dinode *sfi,
+		 uint32_t blocklen, bool *dirty)
 {
 	/*
 	 * I/O buffer for handling the indirect block.
@@ -212,36 +220,38 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 	 */
 	static uint32_t idbuf[SFS_DBPERIDB];
 
-	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
-
-	/* Length in blocks (divide rounding up) */
-	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
+	/* Blocks to free: all the direct and indirect ones, at most */
+	static daddr_t freelist[SFS_NDIRECT + SFS_DBPERIDB + 1];
 
 	uint32_t i, j;
 	daddr_t block, idblock;
 	uint32_t baseblock, highblock;
-	int result;
+	unsigned nfree = 0;
+	int result = 0;
 	int hasnonzero, iddirty;
 
 	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
 
-	vfs_biglock_acquire();
+	/* Since we're using static buffers, we'd better be locked. */
+	KASSERT(vfs_biglock_do_i_hold());
+
+	*dirty = false;
 
 	/*
 	 * Go through the direct blocks. Discard any that are
 	 * past the limit we're truncating to.
 	 */
 	for (i=0; i<SFS_NDIRECT; i++) {
-		block = sv->sv_i.sfi_direct[i];
+		block = sfi->sfi_direct[i];
 		if (i >= blocklen && block != 0) {
-			sfs_bfree(sfs, block);
-			sv->sv_i.sfi_direct[i] = 0;
-			sv->sv_dirty = true;
+			freelist[nfree++] = block;
+			sfi->sfi_direct[i] = 0;
+			*dirty = true;
 		}
 	}
 
 	/* Indirect block number */
-	idblock = sv->sv_i.sfi_indirect;
+	idblock = sfi->sfi_indirect;
 
 	/* The lowest block in the indirect block */
 	baseblock = SFS_NDIRECT;
@@ -249,22 +259,37 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 	/* The highest block in the indirect block */
 	highblock = baseblock + SFS_DBPERIDB - 1;
 
-	if (blocklen < highblock && idblock != 0) {
+	if (blocklen <= highblock && idblock != 0) {
 		/* We're past the proposed EOF; may need to free stuff */
 
 		/* Read the indirect block */
 		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
 		if (result) {
-			vfs_biglock_release();
-			return result;
+			goto out;
+		}
+
+		if (blocklen <= baseblock) {
+			/*
+			 * All of it goes, including the indirect block
+			 * itself, so there's no point updating it.
+			 */
+			for (j=0; j<SFS_DBPERIDB; j++) {
+				if (idbuf[j] != 0) {
+					freelist[nfree++] = idbuf[j];
+				}
+			}
+			freelist[nfree++] = idblock;
+			sfi->sfi_indirect = 0;
+			*dirty = true;
+			goto out;
 		}
 
 		hasnonzero = 0;
 		iddirty = 0;
 		for (j=0; j<SFS_DBPERIDB; j++) {
 			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
+			if (blocklen <= baseblock+j && idbuf[j] != 0) {
+				freelist[nfree++] = idbuf[j];
 				idbuf[j] = 0;
 				iddirty = 1;
 			}
@@ -276,28 +301,53 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 
 		if (!hasnonzero) {
 			/* The whole indirect block is empty now; free it */
-			sfs_bfree(sfs, idblock);
-			sv->sv_i.sfi_indirect = 0;
-			sv->sv_dirty = true;
+			freelist[nfree++] = idblock;
+			sfi->sfi_indirect = 0;
+			*dirty = true;
 		}
 		else if (iddirty) {
 			/* The indirect block is dirty; write it back */
-			result = sfs_writeblock(sfs, idblock, idbuf,
-						sizeof(idbuf));
-			if (result) {
-				vfs_biglock_release();
-				return result;
-			}
+			result = sfs_jwrite(sfs, idblock, idbuf,
+					    sizeof(idbuf));
 		}
 	}
 
+ out:
+	sfs_bfreelist(sfs, freelist, nfree);
+	return result;
+}
+
+/*
+ * Called for ftruncate() and from sfs_reclaim.
+ */
+int
+sfs_itrunc(struct sfs_vnode *sv, off_t len)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+
+	/* Length in blocks (divide rounding up) */
+	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
+
+	bool dirty;
+	int result;
+
+	vfs_biglock_acquire();
+
+	result = sfs_dinode_trunc(sfs, &sv->sv_i, blocklen, &dirty);
+	if (dirty) {
+		sfs_dirty_inode(sv);
+	}
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+
 	/* Set the file size */
 	sv->sv_i.sfi_size = len;
 
 	/* Mark the inode dirty */
-	sv->sv_dirty = true;
+	sfs_dirty_inode(sv);
 
 	vfs_biglock_release();
 	return 0;
 }
-
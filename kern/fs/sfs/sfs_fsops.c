@@ -52,8 +52,10 @@
 
 /*
  * Routine for doing I/O (reads or writes) on the free block bitmap.
- * We always do the whole bitmap at once; writing individual sectors
- * might or might not be a worthwhile optimization.
+ * Reads always do the whole bitmap at once. Writes only do the
+ * sectors marked in sfs_freemapblkdirty, in ascending order, and
+ * clear the marks as they go; a one-bit change to the freemap of a
+ * large volume thus costs one sector write rather than hundreds.
  *
  * The free block bitmap consists of SFS_FREEMAPBLOCKS 512-byte
  * sectors of bits, one bit for each sector on the filesystem. The
@@ -93,8 +95,15 @@ sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
 					       SFS_BLOCKSIZE);
 		}
 		else {
-			result = sfs_writeblock(sfs, SFS_FREEMAP_START+j, ptr,
-						SFS_BLOCKSIZE);
+			/* Skip blocks that haven't changed. */
+			if (!bitmap_isset(sfs->sfs_freemapblkdirty, j)) {
+				continue;
+			}
+			result = sfs_jwrite(sfs, SFS_FREEMAP_START+j, ptr,
+					    SFS_BLOCKSIZE);
+			if (result == 0) {
+				bitmap_unmark(sfs->sfs_freemapblkdirty, j);
+			}
 		}
 
 		/* If we failed, stop. */
@@ -107,26 +116,46 @@ sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
 
 /*
  * Sync routine for the vnode table.
+ *
+ * Collect the dirty inodes in batches of SFS_SYNCER_MAXBATCH and let
+ * sfs_sync_inodes write each batch in block order.
  */
 static
 int
 sfs_sync_vnodes(struct sfs_fs *sfs)
 {
-	unsigned i, num;
+	struct sfs_vnode *batch[SFS_SYNCER_MAXBATCH];
+	struct sfs_vnode *sv;
+	unsigned i, num, n;
+	int result, firsterr = 0;
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
 	num = vnodearray_num(sfs->sfs_vnodes);
-	for (i=0; i<num; i++) {
-		struct vnode *v = vnodearray_get(sfs->sfs_vnodes, i);
-		VOP_FSYNC(v);
+	n = 0;
+	for (i=0; i<num && sfs->sfs_ndirty > 0; i++) {
+		sv = vnodearray_get(sfs->sfs_vnodes, i)->vn_data;
+		if (!sv->sv_dirty) {
+			continue;
+		}
+		batch[n++] = sv;
+		if (n == SFS_SYNCER_MAXBATCH) {
+			result = sfs_sync_inodes(sfs, batch, n);
+			if (result && firsterr == 0) {
+				firsterr = result;
+			}
+			n = 0;
+		}
 	}
-	return 0;
+
+	result = sfs_sync_inodes(sfs, batch, n);
+	if (result && firsterr == 0) {
+		firsterr = result;
+	}
+	return firsterr;
 }
 
 /*
  * Sync routine for the freemap.
  */
-static
 int
 sfs_sync_freemap(struct sfs_fs *sfs)
 {
@@ -146,15 +175,14 @@ sfs_sync_freemap(struct sfs_fs *sfs)
 /*
  * Sync routine for the superblock.
  */
-static
 int
 sfs_sync_superblock(struct sfs_fs *sfs)
 {
 	int result;
 
 	if (sfs->sfs_superdirty) {
-		result = sfs_writeblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
-					sizeof(sfs->sfs_sb));
+		result = sfs_jwrite(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
+				    sizeof(sfs->sfs_sb));
 		if (result) {
 			return result;
 		}
@@ -208,6 +236,16 @@ sfs_sync(struct fs *fs)
 
 	sfs = fs->fs_data;
 
+	/* Finish freeing any unlinked files first. */
+	sfs_reap_all(sfs);
+
+	/* With a journal, commit and then checkpoint everything. */
+	if (sfs->sfs_journal != NULL) {
+		result = sfs_jsync(sfs);
+		vfs_biglock_release();
+		return result;
+	}
+
 	/* If any vnodes need to be written, write them. */
 	result = sfs_sync_vnodes(sfs);
 	if (result) {
@@ -259,9 +297,18 @@ static
 void
 sfs_fs_destroy(struct sfs_fs *sfs)
 {
+	KASSERT(sfs->sfs_syncer == NULL);
+	KASSERT(sfs->sfs_reaper == NULL);
+	sfs_journal_destroy(sfs);
 	if (sfs->sfs_freemap != NULL) {
 		bitmap_destroy(sfs->sfs_freemap);
 	}
+	if (sfs->sfs_freemapblkdirty != NULL) {
+		bitmap_destroy(sfs->sfs_freemapblkdirty);
+	}
+	if (sfs->sfs_orphans != NULL) {
+		bitmap_destroy(sfs->sfs_orphans);
+	}
 	vnodearray_destroy(sfs->sfs_vnodes);
 	KASSERT(sfs->sfs_device == NULL);
 	kfree(sfs);
@@ -290,6 +337,10 @@ sfs_unmount(struct fs *fs)
 	KASSERT(sfs->sfs_superdirty == false);
 	KASSERT(sfs->sfs_freemapdirty == false);
 
+	/* Cut the syncer and reaper loose; they clean up after themselves */
+	sfs_syncer_stop(sfs);
+	sfs_reaper_stop(sfs);
+
 	/* The vfs layer takes care of the device for us */
 	sfs->sfs_device = NULL;
 
@@ -359,6 +410,20 @@ sfs_fs_create(void)
 	/* freemap */
 	sfs->sfs_freemap = NULL;
 	sfs->sfs_freemapdirty = false;
+	sfs->sfs_freemapblkdirty = NULL;
+
+	/* write-back state */
+	sfs->sfs_ndirty = 0;
+	sfs->sfs_syncer = NULL;
+
+	/* journal */
+	sfs->sfs_journal = NULL;
+
+	/* deferred frees */
+	sfs->sfs_orphans = NULL;
+	sfs->sfs_norphans = 0;
+	sfs->sfs_orphanscan = SFS_ROOTDIR_INO+1;
+	sfs->sfs_reaper = NULL;
 
 	return sfs;
 
@@ -448,9 +513,34 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* Ensure null termination of the volume name */
 	sfs->sfs_sb.sb_volname[sizeof(sfs->sfs_sb.sb_volname)-1] = 0;
 
+	/* Replay the journal, if there is one */
+	result = sfs_journal_init(sfs);
+	if (result) {
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
+		vfs_biglock_release();
+		return result;
+	}
+
+	/* Replay may have updated the superblock; reload it */
+	if (sfs->sfs_journal != NULL) {
+		result = sfs_readblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
+				       sizeof(sfs->sfs_sb));
+		if (result) {
+			sfs->sfs_device = NULL;
+			sfs_fs_destroy(sfs);
+			vfs_biglock_release();
+			return result;
+		}
+		sfs->sfs_sb.sb_volname[sizeof(sfs->sfs_sb.sb_volname)-1] = 0;
+	}
+
 	/* Load free block bitmap */
 	sfs->sfs_freemap = bitmap_create(SFS_FS_FREEMAPBITS(sfs));
-	if (sfs->sfs_freemap == NULL) {
+	sfs->sfs_freemapblkdirty = bitmap_create(SFS_FS_FREEMAPBLOCKS(sfs));
+	sfs->sfs_orphans = bitmap_create(SFS_FS_NBLOCKS(sfs));
+	if (sfs->sfs_freemap == NULL || sfs->sfs_freemapblkdirty == NULL ||
+	    sfs->sfs_orphans == NULL) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
 		vfs_biglock_release();
@@ -464,6 +554,23 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		return result;
 	}
 
+	/* Start the background syncer and reaper */
+	result = sfs_syncer_start(sfs);
+	if (result) {
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
+		vfs_biglock_release();
+		return result;
+	}
+	result = sfs_reaper_start(sfs);
+	if (result) {
+		sfs_syncer_stop(sfs);
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
+		vfs_biglock_release();
+		return result;
+	}
+
 	/* Hand back the abstract fs */
 	*ret = &sfs->sfs_absfs;
 
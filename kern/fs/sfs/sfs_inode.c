@@ -35,11 +35,44 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <clock.h>
 #include <vfs.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 
+/*
+ * Mark an inode dirty. Remember when it became dirty, so the syncer
+ * can tell how long it has been waiting, and keep the per-volume count
+ * of dirty inodes that is used for throttling writers.
+ */
+void
+sfs_dirty_inode(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (!sv->sv_dirty) {
+		sv->sv_dirty = true;
+		gettime(&sv->sv_dirtytime);
+		sfs->sfs_ndirty++;
+	}
+}
+
+/*
+ * Mark an inode clean after it's been written.
+ */
+static
+void
+sfs_clean_inode(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	KASSERT(sv->sv_dirty);
+	sv->sv_dirty = false;
+	KASSERT(sfs->sfs_ndirty > 0);
+	sfs->sfs_ndirty--;
+}
+
 /*
  * Write an on-disk inode structure back out to disk.
  */
@@ -50,16 +83,81 @@ sfs_sync_inode(struct sfs_vnode *sv)
 	int result;
 
 	if (sv->sv_dirty) {
-		result = sfs_writeblock(sfs, sv->sv_ino, &sv->sv_i,
-					sizeof(sv->sv_i));
+		result = sfs_jwrite(sfs, sv->sv_ino, &sv->sv_i,
+				    sizeof(sv->sv_i));
 		if (result) {
 			return result;
 		}
-		sv->sv_dirty = false;
+		sfs_clean_inode(sfs, sv);
 	}
 	return 0;
 }
 
+/*
+ * Write back a set of dirty inodes. SVS is sorted in place by inode
+ * number, which is also the block number, and the inodes are written
+ * in ascending order; each run of inodes in adjacent blocks goes to
+ * the disk as a single multi-sector write (up to SFS_SYNC_MAXRUN
+ * sectors). This beats writing them in whatever order they happen to
+ * sit in the vnode table, which makes the disk seek back and forth.
+ *
+ * With a journal the writes only go into the running transaction, so
+ * there's nothing to merge; the checkpoint does the same thing later.
+ *
+ * Inodes that couldn't be written stay dirty; returns the first error.
+ */
+int
+sfs_sync_inodes(struct sfs_fs *sfs, struct sfs_vnode **svs, unsigned n)
+{
+	struct iovec iov[SFS_SYNC_MAXRUN];
+	struct sfs_vnode *sv;
+	unsigned i, j, run;
+	int result, firsterr = 0;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	for (i=1; i<n; i++) {
+		sv = svs[i];
+		for (j=i; j>0 && svs[j-1]->sv_ino > sv->sv_ino; j--) {
+			svs[j] = svs[j-1];
+		}
+		svs[j] = sv;
+	}
+
+	for (i=0; i<n; i+=run) {
+		if (sfs->sfs_journal != NULL) {
+			run = 1;
+			result = sfs_sync_inode(svs[i]);
+			if (result && firsterr == 0) {
+				firsterr = result;
+			}
+			continue;
+		}
+
+		for (run=0; i+run<n && run<SFS_SYNC_MAXRUN; run++) {
+			sv = svs[i+run];
+			KASSERT(sv->sv_dirty);
+			if (run > 0 && sv->sv_ino != svs[i]->sv_ino + run) {
+				break;
+			}
+			iov[run].iov_kbase = &sv->sv_i;
+			iov[run].iov_len = sizeof(sv->sv_i);
+		}
+
+		result = sfs_writeblocks(sfs, svs[i]->sv_ino, iov, run);
+		if (result) {
+			if (firsterr == 0) {
+				firsterr = result;
+			}
+			continue;
+		}
+		for (j=0; j<run; j++) {
+			sfs_clean_inode(sfs, svs[i+j]);
+		}
+	}
+	return firsterr;
+}
+
 /*
  * Called when the vnode refcount (in-memory usage count) hits zero.
  *
@@ -71,6 +169,7 @@ sfs_reclaim(struct vnode *v)
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	unsigned ix, i, num;
+	bool defer = false;
 	int result;
 
 	vfs_biglock_acquire();
@@ -93,12 +192,20 @@ sfs_reclaim(struct vnode *v)
 	}
 	spinlock_release(&v->vn_countlock);
 
-	/* If there are no on-disk references to the file either, erase it. */
+	/*
+	 * If there are no on-disk references to the file either, erase
+	 * it, or leave that to the reaper.
+	 */
 	if (sv->sv_i.sfi_linkcount == 0) {
-		result = sfs_itrunc(sv, 0);
-		if (result) {
-			vfs_biglock_release();
-			return result;
+		if (sfs_deferfree && sfs->sfs_reaper != NULL) {
+			defer = true;
+		}
+		else {
+			result = sfs_itrunc(sv, 0);
+			if (result) {
+				vfs_biglock_release();
+				return result;
+			}
 		}
 	}
 
@@ -110,7 +217,10 @@ sfs_reclaim(struct vnode *v)
 	}
 
 	/* If there are no on-disk references, discard the inode */
-	if (sv->sv_i.sfi_linkcount==0) {
+	if (defer) {
+		sfs_reaper_add(sfs, sv->sv_ino);
+	}
+	else if (sv->sv_i.sfi_linkcount==0) {
 		sfs_bfree(sfs, sv->sv_ino);
 	}
 
@@ -213,7 +323,6 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	if (forcetype != SFS_TYPE_INVAL) {
 		KASSERT(sv->sv_i.sfi_type == SFS_TYPE_INVAL);
 		sv->sv_i.sfi_type = forcetype;
-		sv->sv_dirty = true;
 	}
 
 	/*
@@ -250,6 +359,11 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		return result;
 	}
 
+	/* A newly created object needs its type written out */
+	if (forcetype != SFS_TYPE_INVAL) {
+		sfs_dirty_inode(sv);
+	}
+
 	/* Hand it back */
 	*ret = sv;
 	return 0;
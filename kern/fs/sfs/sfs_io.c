@@ -49,7 +49,7 @@
  * Note: sfs_readblock is used to read the superblock
  * early in mount, before sfs is fully (or even mostly)
  * initialized, and so may not use anything from sfs
- * except sfs_device.
+ * except sfs_device and sfs_journal (which is NULL then).
  */
 
 /*
@@ -69,14 +69,14 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 	      uio->uio_offset / SFS_BLOCKSIZE);
 
  retry:
-	result = DEVOP_IO(sfs->sfs_device, uio);
+	result = dev_io(sfs->sfs_device, uio);
 	if (result == EINVAL) {
 		/*
 		 * This means the sector we requested was out of range,
 		 * or the seek address we gave wasn't sector-aligned,
 		 * or a couple of other things that are our fault.
 		 */
-		panic("sfs: %s: DEVOP_IO returned EINVAL\n",
+		panic("sfs: %s: dev_io returned EINVAL\n",
 		      sfs->sfs_sb.sb_volname);
 	}
 	if (result == EIO) {
@@ -103,6 +103,9 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 
 /*
  * Read a block.
+ *
+ * If the journal holds a newer image of the block than the one on
+ * disk, that's what we return.
  */
 int
 sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
@@ -112,6 +115,10 @@ sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 
 	KASSERT(len == SFS_BLOCKSIZE);
 
+	if (sfs->sfs_journal != NULL && sfs_jread(sfs, block, data)) {
+		return 0;
+	}
+
 	SFSUIO(&iov, &ku, data, block, UIO_READ);
 	return sfs_rwblock(sfs, &ku);
 }
@@ -131,6 +138,31 @@ sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 	return sfs_rwblock(sfs, &ku);
 }
 
+/*
+ * Write NIOV consecutive blocks starting at BLOCK as a single device
+ * request. Each iovec must describe exactly one block.
+ */
+int
+sfs_writeblocks(struct sfs_fs *sfs, daddr_t block,
+		struct iovec *iov, unsigned niov)
+{
+	struct uio ku;
+	unsigned i;
+
+	for (i=0; i<niov; i++) {
+		KASSERT(iov[i].iov_len == SFS_BLOCKSIZE);
+	}
+
+	ku.uio_iov = iov;
+	ku.uio_iovcnt = niov;
+	ku.uio_offset = ((off_t)block) * SFS_BLOCKSIZE;
+	ku.uio_resid = niov * SFS_BLOCKSIZE;
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = UIO_WRITE;
+	ku.uio_space = NULL;
+	return sfs_rwblock(sfs, &ku);
+}
+
 ////////////////////////////////////////////////////////////
 //
 // File-level I/O
@@ -378,7 +410,7 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	    uio->uio_rw == UIO_WRITE &&
 	    uio->uio_offset > (off_t)sv->sv_i.sfi_size) {
 		sv->sv_i.sfi_size = uio->uio_offset;
-		sv->sv_dirty = true;
+		sfs_dirty_inode(sv);
 	}
 
 	/* Add in any extra amount we couldn't read because of EOF */
@@ -461,8 +493,8 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 		memcpy(metaiobuf + blockoffset, data, len);
 
 		/* Write the block back */
-		result = sfs_writeblock(sfs, diskblock,
-					metaiobuf, sizeof(metaiobuf));
+		result = sfs_jwrite(sfs, diskblock,
+				    metaiobuf, sizeof(metaiobuf));
 		if (result) {
 			return result;
 		}
@@ -471,7 +503,7 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 		endpos = actualpos + len;
 		if (endpos > (off_t)sv->sv_i.sfi_size) {
 			sv->sv_i.sfi_size = endpos;
-			sv->sv_dirty = true;
+			sfs_dirty_inode(sv);
 		}
 	}
 
@@ -0,0 +1,747 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *        The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * SFS filesystem
+ *
+ * Write-ahead metadata journal.
+ *
+ * On a volume made with a journal (see kern/sfs.h for the on-disk
+ * layout), metadata blocks -- inodes, directory blocks, indirect
+ * blocks, freemap blocks, and the superblock -- are not written in
+ * place. sfs_jwrite instead copies the new image into the running
+ * transaction, which is kept in memory. A commit writes the running
+ * transaction to the log as a single sequential request (descriptor,
+ * images, commit block). The images stay in memory after that, and
+ * sfs_readblock returns them in preference to what's on disk, until
+ * a checkpoint writes them all to their home locations and marks the
+ * log empty.
+ *
+ * Operations run start to finish under the biglock, and commits only
+ * happen between operations, so a transaction never contains half an
+ * operation. (The exception is when a single operation dirties more
+ * blocks than a transaction can hold; then it gets split.) Because
+ * a commit takes everything that's dirty -- all dirty inodes, the
+ * freemap, and the superblock -- fsync commits on behalf of everyone:
+ * fsync callers queued behind a commit find nothing left to do when
+ * they get the biglock and return without touching the disk. The
+ * syncer commits too, once something has been waiting long enough.
+ *
+ * Checkpoints happen when the log gets half full (so the next commit
+ * always fits) and on sync. Data blocks are not journaled; they are
+ * written directly, as before, which means they reach the disk before
+ * the commit that makes them reachable.
+ *
+ * A block that was freed while the log still holds an image of it
+ * can't be reallocated until the next checkpoint: otherwise, after a
+ * crash, replay would put the stale image over whatever the block was
+ * reused for. sfs_balloc uses sfs_jhold to skip such blocks.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <clock.h>
+#include <vfs.h>
+#include <sfs.h>
+#include "sfsprivate.h"
+
+/*
+ * In-memory copy of a journaled block.
+ */
+struct sfs_jbuf {
+	daddr_t jb_block;		/* home location */
+	bool jb_running;		/* changed in the running transaction */
+	bool jb_held;			/* skipped by the current sfs_balloc */
+	char jb_data[SFS_BLOCKSIZE];	/* latest contents */
+};
+
+/*
+ * Per-volume journal state. Protected by the biglock.
+ */
+struct sfs_journal {
+	uint32_t j_start;		/* first block of log area (header) */
+	uint32_t j_nblocks;		/* size of log area */
+	uint32_t j_txnmax;		/* max blocks per transaction */
+	uint32_t j_seq;			/* seq # of the running transaction */
+	uint32_t j_pos;			/* next free log block (from j_start) */
+
+	struct sfs_jbuf **j_bufs;	/* logged and running blocks */
+	unsigned j_nbufs;		/* number of entries in j_bufs */
+	unsigned j_maxbufs;		/* size of j_bufs */
+	unsigned j_nrunning;		/* entries with jb_running set */
+	struct timespec j_opentime;	/* when j_nrunning became nonzero */
+
+	struct iovec *j_iov;		/* for writing a transaction */
+	struct sfs_jdesc j_desc;	/* descriptor being written */
+	struct sfs_jcommit j_commit;	/* commit block being written */
+
+	unsigned j_ncommits;		/* statistics */
+	unsigned j_ncheckpoints;
+};
+
+/* Usable size of the log (everything except the header) */
+#define SFS_JUSABLE(j) ((j)->j_nblocks - 1)
+
+////////////////////////////////////////////////////////////
+// Block table
+
+/*
+ * Find the entry for BLOCK, or return NULL.
+ */
+static
+struct sfs_jbuf *
+sfs_jlookup(struct sfs_journal *j, daddr_t block)
+{
+	unsigned i;
+
+	for (i=0; i<j->j_nbufs; i++) {
+		if (j->j_bufs[i]->jb_block == block) {
+			return j->j_bufs[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Sort the table by home location, for checkpointing.
+ */
+static
+void
+sfs_jsort(struct sfs_journal *j)
+{
+	struct sfs_jbuf *jb;
+	unsigned i, k;
+
+	for (i=1; i<j->j_nbufs; i++) {
+		jb = j->j_bufs[i];
+		for (k=i; k>0 && j->j_bufs[k-1]->jb_block > jb->jb_block; k--) {
+			j->j_bufs[k] = j->j_bufs[k-1];
+		}
+		j->j_bufs[k] = jb;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Log I/O
+
+/*
+ * Fold one block image into a transaction checksum.
+ */
+static
+uint32_t
+sfs_jsum_block(uint32_t sum, const void *data)
+{
+	const uint32_t *words = data;
+	unsigned i;
+
+	for (i=0; i<SFS_BLOCKSIZE/sizeof(uint32_t); i++) {
+		sum = SFS_JSUM(sum, words[i]);
+	}
+	return sum;
+}
+
+/*
+ * Write the log header, saying the log starts with transaction SEQ.
+ */
+static
+int
+sfs_jwriteheader(struct sfs_fs *sfs, uint32_t seq)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jheader jh;
+
+	bzero(&jh, sizeof(jh));
+	jh.jh_magic = SFS_JMAGIC_HEADER;
+	jh.jh_seq = seq;
+	return sfs_writeblock(sfs, j->j_start, &jh, sizeof(jh));
+}
+
+/*
+ * Copy every logged block to its home location, in block order,
+ * merging adjacent blocks into multi-sector writes, and then mark the
+ * log empty. There must be no running transaction,
+ * because its blocks haven't been committed yet.
+ */
+static
+int
+sfs_jcheckpoint(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jbuf *jb;
+	unsigned i, run;
+	int result;
+
+	KASSERT(j->j_nrunning == 0);
+
+	if (j->j_nbufs == 0) {
+		return 0;
+	}
+
+	/* Blocks that are next to each other go out in one request. */
+	sfs_jsort(j);
+	for (i=0; i<j->j_nbufs; i+=run) {
+		for (run=0; i+run<j->j_nbufs && run<j->j_txnmax+2; run++) {
+			jb = j->j_bufs[i+run];
+			if (jb->jb_block != j->j_bufs[i]->jb_block + run) {
+				break;
+			}
+			j->j_iov[run].iov_kbase = jb->jb_data;
+			j->j_iov[run].iov_len = SFS_BLOCKSIZE;
+		}
+		result = sfs_writeblocks(sfs, j->j_bufs[i]->jb_block,
+					 j->j_iov, run);
+		if (result) {
+			return result;
+		}
+	}
+
+	/* Everything is home; invalidate what's in the log. */
+	result = sfs_jwriteheader(sfs, j->j_seq);
+	if (result) {
+		return result;
+	}
+
+	for (i=0; i<j->j_nbufs; i++) {
+		kfree(j->j_bufs[i]);
+	}
+	j->j_nbufs = 0;
+	j->j_pos = 1;
+	j->j_ncheckpoints++;
+	return 0;
+}
+
+/*
+ * Write the running transaction to the log. Afterwards, checkpoint
+ * if the log is more than half full; this guarantees that there's
+ * always room for the next transaction.
+ */
+static
+int
+sfs_jflush(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jbuf *jb;
+	uint32_t sum;
+	unsigned i, n;
+	int result;
+
+	if (j->j_nrunning == 0) {
+		return 0;
+	}
+	KASSERT(j->j_nrunning <= j->j_txnmax);
+	KASSERT(j->j_pos + j->j_nrunning + 2 <= j->j_nblocks);
+
+	bzero(&j->j_desc, sizeof(j->j_desc));
+	j->j_desc.jd_magic = SFS_JMAGIC_DESC;
+	j->j_desc.jd_seq = j->j_seq;
+	j->j_desc.jd_nblocks = j->j_nrunning;
+	j->j_iov[0].iov_kbase = &j->j_desc;
+	j->j_iov[0].iov_len = SFS_BLOCKSIZE;
+
+	sum = j->j_seq;
+	n = 0;
+	for (i=0; i<j->j_nbufs; i++) {
+		jb = j->j_bufs[i];
+		if (!jb->jb_running) {
+			continue;
+		}
+		j->j_desc.jd_blocks[n] = jb->jb_block;
+		sum = sfs_jsum_block(sum, jb->jb_data);
+		n++;
+		j->j_iov[n].iov_kbase = jb->jb_data;
+		j->j_iov[n].iov_len = SFS_BLOCKSIZE;
+	}
+	KASSERT(n == j->j_nrunning);
+
+	bzero(&j->j_commit, sizeof(j->j_commit));
+	j->j_commit.jc_magic = SFS_JMAGIC_COMMIT;
+	j->j_commit.jc_seq = j->j_seq;
+	j->j_commit.jc_nblocks = n;
+	j->j_commit.jc_checksum = sum;
+	j->j_iov[n+1].iov_kbase = &j->j_commit;
+	j->j_iov[n+1].iov_len = SFS_BLOCKSIZE;
+
+	result = sfs_writeblocks(sfs, j->j_start + j->j_pos, j->j_iov, n+2);
+	if (result) {
+		/* Leave it all running; the next commit will retry. */
+		return result;
+	}
+
+	for (i=0; i<j->j_nbufs; i++) {
+		j->j_bufs[i]->jb_running = false;
+	}
+	j->j_nrunning = 0;
+	j->j_pos += n + 2;
+	j->j_seq++;
+	j->j_ncommits++;
+
+	if (j->j_pos - 1 > SFS_JUSABLE(j) / 2) {
+		return sfs_jcheckpoint(sfs);
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Interface for the rest of sfs
+
+/*
+ * Write a metadata block. With a journal, this just puts the image in
+ * the running transaction; without one, it writes the block in place.
+ */
+int
+sfs_jwrite(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jbuf *jb;
+	int result;
+
+	KASSERT(len == SFS_BLOCKSIZE);
+
+	if (j == NULL) {
+		return sfs_writeblock(sfs, block, data, len);
+	}
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	jb = sfs_jlookup(j, block);
+	if ((jb == NULL || !jb->jb_running) && j->j_nrunning == j->j_txnmax) {
+		/* Transaction full; have to split it here. */
+		result = sfs_jflush(sfs);
+		if (result) {
+			return result;
+		}
+		/* The flush may have checkpointed and freed JB. */
+		jb = sfs_jlookup(j, block);
+	}
+	else if (j->j_nrunning == 0 && j->j_pos - 1 > SFS_JUSABLE(j) / 2) {
+		/* The checkpoint after the last commit failed; retry. */
+		result = sfs_jcheckpoint(sfs);
+		if (result) {
+			return result;
+		}
+		jb = NULL;
+	}
+
+	if (jb == NULL) {
+		KASSERT(j->j_nbufs < j->j_maxbufs);
+		jb = kmalloc(sizeof(*jb));
+		if (jb == NULL) {
+			return ENOMEM;
+		}
+		jb->jb_block = block;
+		jb->jb_running = false;
+		jb->jb_held = false;
+		j->j_bufs[j->j_nbufs++] = jb;
+	}
+
+	memcpy(jb->jb_data, data, SFS_BLOCKSIZE);
+	if (!jb->jb_running) {
+		jb->jb_running = true;
+		if (j->j_nrunning == 0) {
+			gettime(&j->j_opentime);
+		}
+		j->j_nrunning++;
+	}
+	return 0;
+}
+
+/*
+ * If the journal has an image of BLOCK, copy it to DATA and return
+ * true.
+ */
+bool
+sfs_jread(struct sfs_fs *sfs, daddr_t block, void *data)
+{
+	struct sfs_jbuf *jb;
+
+	jb = sfs_jlookup(sfs->sfs_journal, block);
+	if (jb == NULL) {
+		return false;
+	}
+	memcpy(data, jb->jb_data, SFS_BLOCKSIZE);
+	return true;
+}
+
+/*
+ * Called by sfs_balloc for each block it gets from the freemap. If
+ * the journal has an image of the block, it can't be used yet:
+ * remember it (sfs_balloc leaves it marked in the freemap for the
+ * moment, so it won't be offered again) and return true.
+ */
+bool
+sfs_jhold(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_jbuf *jb;
+
+	jb = sfs_jlookup(sfs->sfs_journal, block);
+	if (jb == NULL) {
+		return false;
+	}
+	KASSERT(!jb->jb_held);
+	jb->jb_held = true;
+	return true;
+}
+
+/*
+ * Give the blocks sfs_jhold kept back to the freemap.
+ */
+void
+sfs_junhold(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	unsigned i;
+
+	for (i=0; i<j->j_nbufs; i++) {
+		if (j->j_bufs[i]->jb_held) {
+			bitmap_unmark(sfs->sfs_freemap, j->j_bufs[i]->jb_block);
+			j->j_bufs[i]->jb_held = false;
+		}
+	}
+}
+
+/*
+ * Commit: put all dirty inodes, the freemap, and the superblock into
+ * the running transaction and write it to the log. If there's nothing
+ * to do (because someone else's commit already covered it) this
+ * returns without doing any I/O.
+ */
+int
+sfs_jcommit(struct sfs_fs *sfs)
+{
+	struct sfs_vnode *sv;
+	unsigned i, num;
+	int result;
+
+	KASSERT(sfs->sfs_journal != NULL);
+	KASSERT(vfs_biglock_do_i_hold());
+
+	num = vnodearray_num(sfs->sfs_vnodes);
+	for (i=0; i<num && sfs->sfs_ndirty > 0; i++) {
+		sv = vnodearray_get(sfs->sfs_vnodes, i)->vn_data;
+		result = sfs_sync_inode(sv);
+		if (result) {
+			return result;
+		}
+	}
+
+	result = sfs_sync_freemap(sfs);
+	if (result) {
+		return result;
+	}
+	result = sfs_sync_superblock(sfs);
+	if (result) {
+		return result;
+	}
+
+	return sfs_jflush(sfs);
+}
+
+/*
+ * Commit and checkpoint, so everything is in its home location and the
+ * log is empty. Used by sync (and so by unmount).
+ */
+int
+sfs_jsync(struct sfs_fs *sfs)
+{
+	int result;
+
+	result = sfs_jcommit(sfs);
+	if (result) {
+		return result;
+	}
+	return sfs_jcheckpoint(sfs);
+}
+
+/*
+ * Syncer pass for a journaled volume. Individual inodes can't be
+ * written back by themselves, as that would commit part of an
+ * operation, so instead commit everything once any dirty inode or the
+ * running transaction has been waiting at least MINAGE seconds.
+ *
+ * Returns the number of dirty inodes that were committed.
+ */
+unsigned
+sfs_jwriteback(struct sfs_fs *sfs, unsigned minage)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct timespec now, age;
+	struct sfs_vnode *sv;
+	unsigned i, num, ndirty;
+	bool due = false;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (sfs->sfs_ndirty == 0 && j->j_nrunning == 0 &&
+	    !sfs->sfs_freemapdirty && !sfs->sfs_superdirty) {
+		return 0;
+	}
+
+	gettime(&now);
+	if (j->j_nrunning > 0) {
+		timespec_sub(&now, &j->j_opentime, &age);
+		due = age.tv_sec >= minage;
+	}
+	num = vnodearray_num(sfs->sfs_vnodes);
+	for (i=0; i<num && !due; i++) {
+		sv = vnodearray_get(sfs->sfs_vnodes, i)->vn_data;
+		if (sv->sv_dirty) {
+			timespec_sub(&now, &sv->sv_dirtytime, &age);
+			due = age.tv_sec >= minage;
+		}
+	}
+	if (!due && minage > 0) {
+		return 0;
+	}
+
+	ndirty = sfs->sfs_ndirty;
+	result = sfs_jcommit(sfs);
+	if (result) {
+		kprintf("sfs: %s: syncer: journal commit: %s\n",
+			sfs->sfs_sb.sb_volname, strerror(result));
+	}
+	return ndirty - sfs->sfs_ndirty;
+}
+
+////////////////////////////////////////////////////////////
+// Mount and unmount
+
+/*
+ * Replay the log: copy the images of each complete transaction to
+ * their home locations, in order. A transaction is complete if its
+ * descriptor and commit block match, its blocks are all plausible,
+ * and the checksum is right. Stop at the first one that isn't.
+ * Afterwards mark the log empty.
+ */
+static
+int
+sfs_jreplay(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jheader *jh;
+	struct sfs_jdesc *jd = &j->j_desc;
+	struct sfs_jcommit *jc = &j->j_commit;
+	uint32_t seq, pos, sum, block, i;
+	unsigned ntxns = 0, nblocks = 0;
+	char *buf;
+	int result;
+
+	buf = kmalloc(SFS_BLOCKSIZE);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+
+	result = sfs_readblock(sfs, j->j_start, buf, SFS_BLOCKSIZE);
+	if (result) {
+		goto out;
+	}
+	jh = (struct sfs_jheader *)buf;
+	if (jh->jh_magic != SFS_JMAGIC_HEADER) {
+		kprintf("sfs: %s: bad journal header (run sfsck)\n",
+			sfs->sfs_sb.sb_volname);
+		result = EINVAL;
+		goto out;
+	}
+	seq = jh->jh_seq;
+
+	for (pos = 1; pos + 2 <= j->j_nblocks; pos += jd->jd_nblocks + 2) {
+		result = sfs_readblock(sfs, j->j_start + pos, jd,
+				       sizeof(*jd));
+		if (result) {
+			goto out;
+		}
+		if (jd->jd_magic != SFS_JMAGIC_DESC || jd->jd_seq != seq ||
+		    jd->jd_nblocks > SFS_JMAXBLOCKS ||
+		    pos + jd->jd_nblocks + 2 > j->j_nblocks) {
+			break;
+		}
+		result = sfs_readblock(sfs, j->j_start + pos + jd->jd_nblocks + 1,
+				       jc, sizeof(*jc));
+		if (result) {
+			goto out;
+		}
+		if (jc->jc_magic != SFS_JMAGIC_COMMIT || jc->jc_seq != seq ||
+		    jc->jc_nblocks != jd->jd_nblocks) {
+			break;
+		}
+
+		/* Check the images before applying any of them. */
+		sum = seq;
+		for (i=0; i<jd->jd_nblocks; i++) {
+			block = jd->jd_blocks[i];
+			if (block >= sfs->sfs_sb.sb_nblocks ||
+			    (block >= j->j_start &&
+			     block < j->j_start + j->j_nblocks)) {
+				break;
+			}
+			result = sfs_readblock(sfs, j->j_start + pos + 1 + i,
+					       buf, SFS_BLOCKSIZE);
+			if (result) {
+				goto out;
+			}
+			sum = sfs_jsum_block(sum, buf);
+		}
+		if (i < jd->jd_nblocks || sum != jc->jc_checksum) {
+			break;
+		}
+
+		for (i=0; i<jd->jd_nblocks; i++) {
+			result = sfs_readblock(sfs, j->j_start + pos + 1 + i,
+					       buf, SFS_BLOCKSIZE);
+			if (result) {
+				goto out;
+			}
+			result = sfs_writeblock(sfs, jd->jd_blocks[i],
+						buf, SFS_BLOCKSIZE);
+			if (result) {
+				goto out;
+			}
+		}
+		ntxns++;
+		nblocks += jd->jd_nblocks;
+		seq++;
+	}
+
+	if (ntxns > 0) {
+		kprintf("sfs: %s: replayed %u transactions (%u blocks) "
+			"from journal\n", sfs->sfs_sb.sb_volname,
+			ntxns, nblocks);
+		result = sfs_jwriteheader(sfs, seq);
+		if (result) {
+			goto out;
+		}
+	}
+
+	j->j_seq = seq;
+	j->j_pos = 1;
+	result = 0;
+
+ out:
+	kfree(buf);
+	return result;
+}
+
+/*
+ * Set up the journal for a volume being mounted, and replay it. The
+ * superblock must already be loaded; the caller should reload it
+ * afterwards, since replay may have changed it.
+ */
+int
+sfs_journal_init(struct sfs_fs *sfs)
+{
+	struct sfs_superblock *sb = &sfs->sfs_sb;
+	struct sfs_journal *j;
+	int result;
+
+	KASSERT(sfs->sfs_journal == NULL);
+
+	if (sb->sb_journalblocks == 0) {
+		return 0;
+	}
+	if (sb->sb_journalblocks < SFS_JMINSIZE ||
+	    sb->sb_journalstart < SFS_FREEMAP_START +
+	                          SFS_FREEMAPBLOCKS(sb->sb_nblocks) ||
+	    sb->sb_journalstart + sb->sb_journalblocks > sb->sb_nblocks) {
+		kprintf("sfs: %s: invalid journal location %u+%u\n",
+			sb->sb_volname, sb->sb_journalstart,
+			sb->sb_journalblocks);
+		return EINVAL;
+	}
+
+	j = kmalloc(sizeof(*j));
+	if (j == NULL) {
+		return ENOMEM;
+	}
+	j->j_start = sb->sb_journalstart;
+	j->j_nblocks = sb->sb_journalblocks;
+	j->j_txnmax = SFS_JUSABLE(j) / 2 - 2;
+	if (j->j_txnmax > SFS_JMAXBLOCKS) {
+		j->j_txnmax = SFS_JMAXBLOCKS;
+	}
+	j->j_seq = 0;
+	j->j_pos = 1;
+	j->j_nbufs = 0;
+	j->j_maxbufs = SFS_JUSABLE(j);
+	j->j_nrunning = 0;
+	j->j_ncommits = 0;
+	j->j_ncheckpoints = 0;
+
+	j->j_bufs = kmalloc(j->j_maxbufs * sizeof(j->j_bufs[0]));
+	if (j->j_bufs == NULL) {
+		kfree(j);
+		return ENOMEM;
+	}
+	j->j_iov = kmalloc((j->j_txnmax + 2) * sizeof(j->j_iov[0]));
+	if (j->j_iov == NULL) {
+		kfree(j->j_bufs);
+		kfree(j);
+		return ENOMEM;
+	}
+
+	/*
+	 * The block table is empty during replay, so sfs_readblock
+	 * goes straight to the disk.
+	 */
+	sfs->sfs_journal = j;
+	result = sfs_jreplay(sfs);
+	if (result) {
+		sfs_journal_destroy(sfs);
+		return result;
+	}
+	return 0;
+}
+
+/*
+ * Tear down the journal at unmount (or failed mount).
+ */
+void
+sfs_journal_destroy(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	unsigned i;
+
+	if (j == NULL) {
+		return;
+	}
+
+	if (j->j_ncommits > 0) {
+		DEBUG(DB_SFS, "sfs: %s: journal: %u commits, %u checkpoints\n",
+		      sfs->sfs_sb.sb_volname, j->j_ncommits,
+		      j->j_ncheckpoints);
+	}
+
+	for (i=0; i<j->j_nbufs; i++) {
+		kfree(j->j_bufs[i]);
+	}
+	kfree(j->j_iov);
+	kfree(j->j_bufs);
+	kfree(j);
+	sfs->sfs_journal = NULL;
+}
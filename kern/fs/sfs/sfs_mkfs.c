@@ -0,0 +1,241 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *        The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * SFS filesystem
+ *
+ * Creating a filesystem from inside the kernel. This lays out the
+ * same structures as userland mksfs (superblock, root directory,
+ * freemap, and optionally a journal), so a freshly created ramdisk
+ * can be formatted and mounted without any userland at all.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <limits.h>
+#include <lib.h>
+#include <stat.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <sfs.h>
+
+/* Default journal size; never more than 1/SFS_MKFS_JFRACTION of the volume */
+#define SFS_MKFS_JBLOCKS   256
+#define SFS_MKFS_JFRACTION 8
+
+/*
+ * Write one block to the device.
+ */
+static
+int
+sfs_mkfs_write(struct vnode *dev, daddr_t block, void *data)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, data, SFS_BLOCKSIZE,
+		  (off_t)block * SFS_BLOCKSIZE, UIO_WRITE);
+	result = VOP_WRITE(dev, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return EIO;
+	}
+	return 0;
+}
+
+/*
+ * Is BLOCK in use on a new volume?
+ */
+static
+bool
+sfs_mkfs_inuse(uint32_t block, uint32_t nblocks,
+	       uint32_t jstart, uint32_t jblocks)
+{
+	return block == SFS_SUPER_BLOCK || block == SFS_ROOTDIR_INO ||
+		(block >= SFS_FREEMAP_START &&
+		 block < SFS_FREEMAP_START + SFS_FREEMAPBLOCKS(nblocks)) ||
+		(block >= jstart && block < jstart + jblocks) ||
+		block >= nblocks;
+}
+
+/*
+ * Write the filesystem structures.
+ */
+static
+int
+sfs_mkfs_layout(struct vnode *dev, const char *volname, uint32_t nblocks,
+		uint32_t jstart, uint32_t jblocks, void *buf)
+{
+	struct sfs_superblock *sb = buf;
+	struct sfs_dinode *sfi = buf;
+	struct sfs_jheader *jh = buf;
+	uint8_t *map = buf;
+	uint32_t i, bit, block;
+	int result;
+
+	/* Superblock */
+	bzero(buf, SFS_BLOCKSIZE);
+	sb->sb_magic = SFS_MAGIC;
+	sb->sb_nblocks = nblocks;
+	strcpy(sb->sb_volname, volname);
+	sb->sb_journalstart = jstart;
+	sb->sb_journalblocks = jblocks;
+	result = sfs_mkfs_write(dev, SFS_SUPER_BLOCK, buf);
+	if (result) {
+		return result;
+	}
+
+	/* Root directory */
+	bzero(buf, SFS_BLOCKSIZE);
+	sfi->sfi_type = SFS_TYPE_DIR;
+	sfi->sfi_linkcount = 1;
+	result = sfs_mkfs_write(dev, SFS_ROOTDIR_INO, buf);
+	if (result) {
+		return result;
+	}
+
+	/* Freemap */
+	for (i=0; i<SFS_FREEMAPBLOCKS(nblocks); i++) {
+		bzero(buf, SFS_BLOCKSIZE);
+		for (bit=0; bit<SFS_BITSPERBLOCK; bit++) {
+			block = i * SFS_BITSPERBLOCK + bit;
+			if (sfs_mkfs_inuse(block, nblocks, jstart, jblocks)) {
+				map[bit / CHAR_BIT] |= 1 << (bit % CHAR_BIT);
+			}
+		}
+		result = sfs_mkfs_write(dev, SFS_FREEMAP_START + i, buf);
+		if (result) {
+			return result;
+		}
+	}
+
+	/* Journal: header, then an empty first log block */
+	if (jblocks > 0) {
+		bzero(buf, SFS_BLOCKSIZE);
+		jh->jh_magic = SFS_JMAGIC_HEADER;
+		jh->jh_seq = 0;
+		result = sfs_mkfs_write(dev, jstart, buf);
+		if (result) {
+			return result;
+		}
+		bzero(buf, SFS_BLOCKSIZE);
+		result = sfs_mkfs_write(dev, jstart + 1, buf);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Create an empty SFS volume called VOLNAME on device DEVNAME (e.g.
+ * "ram0"), with a journal of JBLOCKS blocks, or a default-sized one
+ * if JBLOCKS is negative. The device must not be mounted or in use.
+ */
+int
+sfs_mkfs(const char *devname, const char *volname, int jblocks)
+{
+	struct vnode *dev;
+	struct stat st;
+	uint32_t nblocks, jstart, nj;
+	void *buf;
+	int result;
+
+	if (strlen(volname) == 0 || strlen(volname) >= SFS_VOLNAME_SIZE ||
+	    strchr(volname, ':') != NULL || strchr(volname, '/') != NULL) {
+		return EINVAL;
+	}
+
+	vfs_biglock_acquire();
+
+	/*
+	 * Claiming the device fails if it's mounted, used for swap or
+	 * by a stripe, or not a disk, and keeps anyone from mounting
+	 * it while we work.
+	 */
+	result = vfs_claimdev(devname, &dev);
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+
+	result = VOP_STAT(dev, &st);
+	if (result) {
+		goto out;
+	}
+	if (st.st_blksize != SFS_BLOCKSIZE) {
+		result = EINVAL;
+		goto out;
+	}
+	nblocks = st.st_blocks;
+
+	/* The journal goes right after the freemap, as in mksfs. */
+	jstart = SFS_FREEMAP_START + SFS_FREEMAPBLOCKS(nblocks);
+	if (jblocks < 0) {
+		nj = nblocks / SFS_MKFS_JFRACTION;
+		if (nj > SFS_MKFS_JBLOCKS) {
+			nj = SFS_MKFS_JBLOCKS;
+		}
+		if (nj < SFS_JMINSIZE) {
+			nj = 0;
+		}
+	}
+	else {
+		nj = jblocks;
+		if (nj > 0 && (nj < SFS_JMINSIZE || jstart + nj > nblocks)) {
+			result = EINVAL;
+			goto out;
+		}
+	}
+	if (nj == 0) {
+		jstart = 0;
+	}
+	if (jstart + nj >= nblocks ||
+	    SFS_FREEMAP_START + SFS_FREEMAPBLOCKS(nblocks) >= nblocks) {
+		/* No room for any files */
+		result = ENOSPC;
+		goto out;
+	}
+
+	buf = kmalloc(SFS_BLOCKSIZE);
+	if (buf == NULL) {
+		result = ENOMEM;
+		goto out;
+	}
+	result = sfs_mkfs_layout(dev, volname, nblocks, jstart, nj, buf);
+	kfree(buf);
+
+ out:
+	vfs_releasedev(dev);
+	vfs_biglock_release();
+	return result;
+}
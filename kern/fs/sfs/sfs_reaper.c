@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *        The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * SFS filesystem
+ *
+ * Deferred freeing of unlinked files.
+ *
+ * Normally, when the last reference to a file with no links goes
+ * away, sfs_reclaim truncates it and frees the inode right there,
+ * which for a big file means a lot of work with the biglock held
+ * while the caller of remove() (or close()) waits. If sfs_deferfree
+ * is set, sfs_reclaim instead writes the inode out as it is (with a
+ * link count of zero), notes it in sfs_orphans, and queues the
+ * volume's reaper work on the system workqueue, which frees the
+ * blocks later, one file per biglock hold. sync reaps whatever is
+ * still pending, so nothing is left over at unmount.
+ *
+ * If the system crashes with orphans pending, they are unreachable
+ * inodes with a link count of zero; sfsck releases their blocks. An
+ * orphan that can't be freed (because of an I/O error, say) is left
+ * the same way: it's reported and dropped from sfs_orphans, rather
+ * than making every later sync, and so unmount, fail on it.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <workqueue.h>
+#include <vfs.h>
+#include <sfs.h>
+#include "sfsprivate.h"
+
+/* Tunable; see sfs.h. */
+bool sfs_deferfree = false;
+
+/*
+ * State shared between a volume and its reaper work. As with the
+ * syncer, this is separate from the struct sfs_fs so unmount can cut
+ * the work loose instead of waiting for it (which it couldn't do
+ * holding the biglock, since the work takes the biglock): it clears
+ * rp_fs and makes sure the work runs once more, and the work frees
+ * this. rp_fs and rp_queued are protected by the biglock.
+ */
+struct sfs_reaper {
+	struct sfs_fs *rp_fs;		/* Volume we work for, or NULL */
+	struct work rp_work;		/* Reaps one orphan */
+	bool rp_queued;			/* rp_work queued and not started */
+};
+
+/*
+ * Free the blocks of orphaned inode INO, and then the inode itself.
+ * Either way, INO is no longer pending afterwards; if it couldn't be
+ * freed, it's left on disk for sfsck.
+ */
+static
+void
+sfs_reap_one(struct sfs_fs *sfs, uint32_t ino)
+{
+	/* Static because it's too big for the stack; we hold the biglock */
+	static struct sfs_dinode sfi;
+	bool dirty;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(bitmap_isset(sfs->sfs_orphans, ino));
+
+	result = sfs_readblock(sfs, ino, &sfi, sizeof(sfi));
+	if (result) {
+		goto done;
+	}
+	if (sfi.sfi_linkcount != 0) {
+		/* The disk says it's still linked; don't trust either */
+		result = EIO;
+		goto done;
+	}
+
+	result = sfs_dinode_trunc(sfs, &sfi, 0, &dirty);
+	if (result) {
+		/* Record what did get freed */
+		if (dirty) {
+			sfs_jwrite(sfs, ino, &sfi, sizeof(sfi));
+		}
+		goto done;
+	}
+
+	sfs_bfree(sfs, ino);
+
+ done:
+	if (result) {
+		kprintf("sfs: %s: orphan inode %u: %s; leaving it for sfsck\n",
+			sfs->sfs_sb.sb_volname, ino, strerror(result));
+	}
+	bitmap_unmark(sfs->sfs_orphans, ino);
+	KASSERT(sfs->sfs_norphans > 0);
+	sfs->sfs_norphans--;
+}
+
+/*
+ * Reap one pending orphan. There must be one.
+ *
+ * The search picks up where the last one left off (sfs_orphanscan)
+ * and wraps around once, so reaping a batch of orphans is one pass
+ * over the bitmap rather than one per orphan.
+ */
+static
+void
+sfs_reap_next(struct sfs_fs *sfs)
+{
+	uint32_t ino, nblocks, i;
+
+	KASSERT(sfs->sfs_norphans > 0);
+
+	nblocks = sfs->sfs_sb.sb_nblocks;
+	ino = sfs->sfs_orphanscan;
+	for (i = SFS_ROOTDIR_INO+1; i < nblocks; i++) {
+		if (ino >= nblocks) {
+			ino = SFS_ROOTDIR_INO+1;
+		}
+		if (bitmap_isset(sfs->sfs_orphans, ino)) {
+			sfs->sfs_orphanscan = ino+1;
+			sfs_reap_one(sfs, ino);
+			return;
+		}
+		ino++;
+	}
+	panic("sfs: %s: %u orphans pending but none found\n",
+	      sfs->sfs_sb.sb_volname, sfs->sfs_norphans);
+}
+
+/*
+ * Reap all pending orphans. Called from sync.
+ */
+void
+sfs_reap_all(struct sfs_fs *sfs)
+{
+	KASSERT(vfs_biglock_do_i_hold());
+
+	while (sfs->sfs_norphans > 0) {
+		sfs_reap_next(sfs);
+	}
+}
+
+/*
+ * Make sure the reaper work is going to run.
+ */
+static
+void
+sfs_reaper_kick(struct sfs_reaper *rp)
+{
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (!rp->rp_queued) {
+		rp->rp_queued = true;
+		workqueue_queue(system_workqueue, &rp->rp_work);
+	}
+}
+
+/*
+ * Called by sfs_reclaim to hand over an unlinked inode whose blocks
+ * haven't been freed. The inode must already have been written out.
+ */
+void
+sfs_reaper_add(struct sfs_fs *sfs, uint32_t ino)
+{
+	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(sfs->sfs_reaper != NULL);
+
+	bitmap_mark(sfs->sfs_orphans, ino);
+	sfs->sfs_norphans++;
+	sfs_reaper_kick(sfs->sfs_reaper);
+}
+
+/*
+ * The reaper work. Takes the biglock for one file at a time, so
+ * other operations get a chance in between, and queues itself again
+ * if there are more.
+ */
+static
+void
+sfs_reaper_work(void *vrp)
+{
+	struct sfs_reaper *rp = vrp;
+
+	vfs_biglock_acquire();
+	rp->rp_queued = false;
+	if (rp->rp_fs == NULL) {
+		/* Unmounted */
+		vfs_biglock_release();
+		kfree(rp);
+		return;
+	}
+	if (rp->rp_fs->sfs_norphans > 0) {
+		/* sync may have got to them first */
+		sfs_reap_next(rp->rp_fs);
+	}
+	if (rp->rp_fs->sfs_norphans > 0) {
+		sfs_reaper_kick(rp);
+	}
+	vfs_biglock_release();
+}
+
+/*
+ * Start the reaper for a newly mounted volume.
+ */
+int
+sfs_reaper_start(struct sfs_fs *sfs)
+{
+	struct sfs_reaper *rp;
+
+	KASSERT(sfs->sfs_reaper == NULL);
+
+	if (system_workqueue == NULL) {
+		/* Too early in boot; free files right away instead */
+		return 0;
+	}
+
+	rp = kmalloc(sizeof(*rp));
+	if (rp == NULL) {
+		return ENOMEM;
+	}
+	rp->rp_fs = sfs;
+	work_init(&rp->rp_work, sfs_reaper_work, rp);
+	rp->rp_queued = false;
+
+	sfs->sfs_reaper = rp;
+	return 0;
+}
+
+/*
+ * Detach the reaper from a volume being unmounted. There must be no
+ * orphans left (sync takes care of that).
+ */
+void
+sfs_reaper_stop(struct sfs_fs *sfs)
+{
+	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(sfs->sfs_norphans == 0);
+
+	if (sfs->sfs_reaper != NULL) {
+		sfs->sfs_reaper->rp_fs = NULL;
+		sfs_reaper_kick(sfs->sfs_reaper);
+		sfs->sfs_reaper = NULL;
+	}
+}
@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *        The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * SFS filesystem
+ *
+ * Background write-back of dirty metadata.
+ *
+ * Without this, dirty inodes (and the freemap and superblock) are
+ * only written when someone calls sync or fsync, or at unmount, so
+ * they pile up and then get flushed all at once. Each mounted volume
+ * gets a syncer thread that wakes up every sfs_syncer_interval
+ * seconds and writes back inodes that have been dirty for at least
+ * sfs_syncer_age seconds, at most sfs_syncer_batch of them per pass,
+ * in block order (see sfs_sync_inodes). Writers that let the number
+ * of dirty inodes get past sfs_syncer_dirtymax are made to do a pass
+ * themselves.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <vfs.h>
+#include <sfs.h>
+#include "sfsprivate.h"
+
+/* Tunables; see sfs.h. */
+unsigned sfs_syncer_interval = 1;
+unsigned sfs_syncer_age = 5;
+unsigned sfs_syncer_batch = 16;
+unsigned sfs_syncer_dirtymax = 64;
+
+/*
+ * State shared between a volume and its syncer thread.
+ *
+ * This is allocated separately from the struct sfs_fs so that
+ * unmount does not have to wait for the thread to exit (which it
+ * couldn't do while holding the biglock): unmount just clears sy_fs,
+ * and the thread notices the next time it wakes up, frees this
+ * structure, and exits. sy_fs is protected by the biglock.
+ */
+struct sfs_syncer {
+	struct sfs_fs *sy_fs;		/* Volume we work for, or NULL */
+};
+
+/*
+ * Write back dirty inodes that have been dirty for at least MINAGE
+ * seconds, but not more than MAX of them. The inodes are written in
+ * ascending block order to keep the disk head moving in one
+ * direction (sfs_sync_inodes takes care of that). Afterwards write
+ * out the freemap and superblock if needed. (The order is the same as
+ * in sfs_sync.)
+ *
+ * Returns the number of inodes written.
+ */
+unsigned
+sfs_writeback(struct sfs_fs *sfs, unsigned minage, unsigned max)
+{
+	struct sfs_vnode *batch[SFS_SYNCER_MAXBATCH];
+	struct timespec now, age;
+	struct sfs_vnode *sv;
+	unsigned i, num, n;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (sfs->sfs_journal != NULL) {
+		/* Journaled volumes commit everything at once */
+		return sfs_jwriteback(sfs, minage);
+	}
+
+	if (max > SFS_SYNCER_MAXBATCH) {
+		max = SFS_SYNCER_MAXBATCH;
+	}
+
+	gettime(&now);
+
+	/* Collect the eligible inodes */
+	n = 0;
+	num = vnodearray_num(sfs->sfs_vnodes);
+	for (i=0; i<num && n<max; i++) {
+		sv = vnodearray_get(sfs->sfs_vnodes, i)->vn_data;
+		if (!sv->sv_dirty) {
+			continue;
+		}
+		timespec_sub(&now, &sv->sv_dirtytime, &age);
+		if (age.tv_sec < minage) {
+			continue;
+		}
+		batch[n++] = sv;
+	}
+
+	result = sfs_sync_inodes(sfs, batch, n);
+	if (result) {
+		kprintf("sfs: %s: syncer: inodes: %s\n",
+			sfs->sfs_sb.sb_volname, strerror(result));
+	}
+
+	result = sfs_sync_freemap(sfs);
+	if (result) {
+		kprintf("sfs: %s: syncer: freemap: %s\n",
+			sfs->sfs_sb.sb_volname, strerror(result));
+	}
+	result = sfs_sync_superblock(sfs);
+	if (result) {
+		kprintf("sfs: %s: syncer: superblock: %s\n",
+			sfs->sfs_sb.sb_volname, strerror(result));
+	}
+
+	return n;
+}
+
+/*
+ * Called by writers (with the biglock held) after they've dirtied
+ * things. If there are too many dirty inodes, make the writer do a
+ * write-back pass itself, regardless of age. This pushes back on
+ * whoever is generating the dirty metadata instead of letting it
+ * accumulate until the next sync.
+ */
+void
+sfs_syncer_throttle(struct sfs_fs *sfs)
+{
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (sfs->sfs_ndirty > sfs_syncer_dirtymax) {
+		sfs_writeback(sfs, 0, sfs_syncer_batch);
+	}
+}
+
+/*
+ * The syncer thread.
+ */
+static
+void
+sfs_syncer_thread(void *vsy, unsigned long junk)
+{
+	struct sfs_syncer *sy = vsy;
+
+	(void)junk;
+
+	while (1) {
+		clocksleep(sfs_syncer_interval > 0 ? sfs_syncer_interval : 1);
+
+		vfs_biglock_acquire();
+		if (sy->sy_fs == NULL) {
+			/* Unmounted while we were asleep */
+			vfs_biglock_release();
+			break;
+		}
+		sfs_writeback(sy->sy_fs, sfs_syncer_age, sfs_syncer_batch);
+		vfs_biglock_release();
+	}
+
+	kfree(sy);
+}
+
+/*
+ * Start the syncer for a newly mounted volume.
+ */
+int
+sfs_syncer_start(struct sfs_fs *sfs)
+{
+	struct sfs_syncer *sy;
+	int result;
+
+	KASSERT(sfs->sfs_syncer == NULL);
+
+	sy = kmalloc(sizeof(*sy));
+	if (sy == NULL) {
+		return ENOMEM;
+	}
+	sy->sy_fs = sfs;
+
+	result = thread_fork("sfs_syncer", NULL, sfs_syncer_thread, sy, 0);
+	if (result) {
+		kfree(sy);
+		return result;
+	}
+
+	sfs->sfs_syncer = sy;
+	return 0;
+}
+
+/*
+ * Detach the syncer from a volume being unmounted. The thread exits
+ * the next time it wakes up.
+ */
+void
+sfs_syncer_stop(struct sfs_fs *sfs)
+{
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (sfs->sfs_syncer != NULL) {
+		sfs->sfs_syncer->sy_fs = NULL;
+		sfs->sfs_syncer = NULL;
+	}
+}
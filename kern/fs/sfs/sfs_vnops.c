@@ -123,6 +123,7 @@ sfs_write(struct vnode *v, struct uio *uio)
 
 	vfs_biglock_acquire();
 	result = sfs_io(sv, uio);
+	sfs_syncer_throttle(v->vn_fs->fs_data);
 	vfs_biglock_release();
 
 	return result;
@@ -222,10 +223,15 @@ int
 sfs_fsync(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	int result;
 
 	vfs_biglock_acquire();
 	result = sfs_sync_inode(sv);
+	if (result == 0 && sfs->sfs_journal != NULL) {
+		/* Only durable once committed; see sfs_journal.c */
+		result = sfs_jcommit(sfs);
+	}
 	vfs_biglock_release();
 
 	return result;
@@ -338,7 +344,7 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	newguy->sv_i.sfi_linkcount++;
 
 	/* and consequently mark it dirty. */
-	newguy->sv_dirty = true;
+	sfs_dirty_inode(newguy);
 
 	*ret = &newguy->sv_absvn;
 
@@ -378,7 +384,7 @@ sfs_link(struct vnode *dir, const char *name, struct vnode *file)
 
 	/* and update the link count, marking the inode dirty */
 	f->sv_i.sfi_linkcount++;
-	f->sv_dirty = true;
+	sfs_dirty_inode(f);
 
 	vfs_biglock_release();
 	return 0;
@@ -411,7 +417,7 @@ sfs_remove(struct vnode *dir, const char *name)
 		/* If we succeeded, decrement the link count. */
 		KASSERT(victim->sv_i.sfi_linkcount > 0);
 		victim->sv_i.sfi_linkcount--;
-		victim->sv_dirty = true;
+		sfs_dirty_inode(victim);
 	}
 
 	/* Discard the reference that sfs_lookonce got us */
@@ -468,7 +474,7 @@ sfs_rename(struct vnode *d1, const char *n1,
 
 	/* Increment the link count, and mark inode dirty */
 	g1->sv_i.sfi_linkcount++;
-	g1->sv_dirty = true;
+	sfs_dirty_inode(g1);
 
 	/* Unlink the old slot */
 	result = sfs_dir_unlink(sv, slot1);
@@ -482,7 +488,7 @@ sfs_rename(struct vnode *d1, const char *n1,
 	 */
 	KASSERT(g1->sv_i.sfi_linkcount>0);
 	g1->sv_i.sfi_linkcount--;
-	g1->sv_dirty = true;
+	sfs_dirty_inode(g1);
 
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_absvn);
@@ -37,6 +37,9 @@
 extern const struct vnode_ops sfs_fileops;
 extern const struct vnode_ops sfs_dirops;
 
+/* Most inodes sfs_sync_inodes will merge into one write */
+#define SFS_SYNC_MAXRUN 16
+
 /* Macro for initializing a uio structure */
 #define SFSUIO(iov, uio, ptr, block, rw) \
     uio_kinit(iov, uio, ptr, SFS_BLOCKSIZE, ((off_t)(block))*SFS_BLOCKSIZE, rw)
@@ -45,11 +48,14 @@ extern const struct vnode_ops sfs_dirops;
 /* Functions in sfs_balloc.c */
 int sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock);
 void sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock);
+void sfs_bfreelist(struct sfs_fs *sfs, daddr_t *blocks, unsigned n);
 int sfs_bused(struct sfs_fs *sfs, daddr_t diskblock);
 
 /* Functions in sfs_bmap.c */
 int sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		daddr_t *diskblock);
+int sfs_dinode_trunc(struct sfs_fs *sfs, struct sfs_dinode *sfi,
+		uint32_t blocklen, bool *dirty);
 int sfs_itrunc(struct sfs_vnode *sv, off_t len);
 
 /* Functions in sfs_dir.c */
@@ -62,8 +68,14 @@ int sfs_lookonce(struct sfs_vnode *sv, const char *name,
 		struct sfs_vnode **ret,
 		int *slot);
 
+/* Functions in sfs_fsops.c */
+int sfs_sync_freemap(struct sfs_fs *sfs);
+int sfs_sync_superblock(struct sfs_fs *sfs);
+
 /* Functions in sfs_inode.c */
+void sfs_dirty_inode(struct sfs_vnode *sv);
 int sfs_sync_inode(struct sfs_vnode *sv);
+int sfs_sync_inodes(struct sfs_fs *sfs, struct sfs_vnode **svs, unsigned n);
 int sfs_reclaim(struct vnode *v);
 int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		struct sfs_vnode **ret);
@@ -73,9 +85,34 @@ int sfs_getroot(struct fs *fs, struct vnode **ret);
 /* Functions in sfs_io.c */
 int sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
 int sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
+int sfs_writeblocks(struct sfs_fs *sfs, daddr_t block,
+		struct iovec *iov, unsigned niov);
 int sfs_io(struct sfs_vnode *sv, struct uio *uio);
 int sfs_metaio(struct sfs_vnode *sv, off_t pos, void *data, size_t len,
 	       enum uio_rw rw);
 
+/* Functions in sfs_journal.c */
+int sfs_jwrite(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
+bool sfs_jread(struct sfs_fs *sfs, daddr_t block, void *data);
+bool sfs_jhold(struct sfs_fs *sfs, daddr_t block);
+void sfs_junhold(struct sfs_fs *sfs);
+int sfs_jcommit(struct sfs_fs *sfs);
+int sfs_jsync(struct sfs_fs *sfs);
+unsigned sfs_jwriteback(struct sfs_fs *sfs, unsigned minage);
+int sfs_journal_init(struct sfs_fs *sfs);
+void sfs_journal_destroy(struct sfs_fs *sfs);
+
+/* Functions in sfs_reaper.c */
+void sfs_reap_all(struct sfs_fs *sfs);
+void sfs_reaper_add(struct sfs_fs *sfs, uint32_t ino);
+int sfs_reaper_start(struct sfs_fs *sfs);
+void sfs_reaper_stop(struct sfs_fs *sfs);
+
+/* Functions in sfs_syncer.c */
+int sfs_syncer_start(struct sfs_fs *sfs);
+void sfs_syncer_stop(struct sfs_fs *sfs);
+unsigned sfs_writeback(struct sfs_fs *sfs, unsigned minage, unsigned max);
+void sfs_syncer_throttle(struct sfs_fs *sfs);
+
 
 #endif /* _SFSPRIVATE_H_ */
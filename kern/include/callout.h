@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *        The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _CALLOUT_H_
+#define _CALLOUT_H_
+
+/*
+ * Callouts: functions to be called from hardclock after a delay.
+ *
+ * Each cpu keeps its pending callouts in a hierarchical timer wheel
+ * (see callout.c), so scheduling and stopping a callout take constant
+ * time however many are pending. A callout runs on the cpu that
+ * scheduled it, from the timer interrupt, so it must not sleep;
+ * usually it just wakes something up.
+ *
+ * Delays are in hardclock ticks (1/HZ seconds); see clock_ticks()
+ * and clock_mstoticks() in clock.h.
+ */
+
+struct cpu;		/* from cpu.h */
+struct callwheel;	/* private to callout.c */
+
+struct callout {
+	struct callout *co_next;	/* Next in wheel slot */
+	struct callout **co_prevp;	/* Link to us; NULL if not pending */
+	unsigned co_expire;		/* clock_ticks() value to run at */
+	void (*co_func)(void *);	/* Function to call */
+	void *co_arg;			/* Argument for co_func */
+	struct cpu *co_cpu;		/* Cpu last scheduled on, if any */
+};
+
+/* Set up CO to call FUNC(ARG). It doesn't run until scheduled. */
+void callout_init(struct callout *co, void (*func)(void *), void *arg);
+
+/*
+ * Run CO on the current cpu once clock_ticks() has gone past its
+ * current value plus TICKS; so never sooner than TICKS ticks from
+ * now, and usually less than a tick after that. If CO was already
+ * pending it is moved. Very long delays (years) are cut short.
+ */
+void callout_schedule(struct callout *co, unsigned ticks);
+
+/*
+ * Cancel CO. Returns true if it was pending. If its function is
+ * running on another cpu, waits for it to finish, so afterwards CO
+ * may be freed. Must not be called from CO's own function, or while
+ * holding a spinlock that function takes.
+ *
+ * Callers must not schedule or stop the same callout concurrently.
+ */
+bool callout_stop(struct callout *co);
+
+/* Make a wheel for a new cpu; NULL if out of memory. */
+struct callwheel *callwheel_create(void);
+
+/* From hardclock: run the current cpu's callouts that are due. */
+void callout_hardclock(void);
+
+/*
+ * Ticks until the current cpu's wheel next needs hardclock, or 0 if
+ * nothing is pending. For programming the timer; it counts from the
+ * last hardclock rather than reading the clock, so it is cheap enough
+ * for the context switch path.
+ */
+unsigned callout_nextticks(void);
+
+#endif /* _CALLOUT_H_ */
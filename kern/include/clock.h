@@ -38,8 +38,10 @@
 
 
 /*
- * hardclock() is called on every CPU HZ times a second, possibly only
- * when the CPU is not idle, for scheduling.
+ * hardclock() is called on every CPU HZ times a second, for
+ * scheduling -- but not while the CPU is idle, and less often while
+ * it's running one thread with nothing else waiting. (See
+ * thread_timer() and mainbus_timer_set().)
  */
 
 /* hardclocks per second */
@@ -79,5 +81,20 @@ void timespec_sub(const struct timespec *t1,
  */
 void clocksleep(int seconds);
 
+/*
+ * Finer-grained time, for timeouts (see also callout.h).
+ *
+ * clock_ticks() returns the time in hardclock ticks. It comes from
+ * the time of day clock, so it keeps going when idle cpus stop their
+ * timers. It wraps, so compare values with (int)(a - b).
+ *
+ * clock_mstoticks() converts milliseconds to ticks, rounding up.
+ *
+ * clocksleep_ticks() suspends execution for at least TICKS ticks.
+ */
+unsigned clock_ticks(void);
+unsigned clock_mstoticks(unsigned ms);
+void clocksleep_ticks(unsigned ticks);
+
 
 #endif /* _CLOCK_H_ */
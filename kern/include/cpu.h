@@ -33,9 +33,16 @@
 
 #include <spinlock.h>
 #include <threadlist.h>
+#include <workqueue.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
 
+/*
+ * Number of scheduler priority levels. Level 0 is the highest. See
+ * the scheduler notes in thread.c.
+ */
+#define SCHED_NLEVELS	4
+
 /*
  * Per-cpu structure
  *
@@ -59,16 +66,25 @@ struct cpu {
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
-	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	struct work c_exorcism;		/* Cleans up c_zombies */
+	struct threadlist c_threadcache; /* Spare threads, with stacks */
+	unsigned c_hardclocks;		/* Counter of hardclock periods */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	unsigned c_lastboost;		/* c_hardclocks at last priority boost */
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
+	 *
+	 * There is one run queue for each priority level; ready
+	 * threads wait on the queue for their t_prio.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	bool c_evict;			/* Run queue has disallowed threads */
+	unsigned c_timerticks;		/* Ticks timer is set for; 0 = off */
+	struct threadlist c_runqueue[SCHED_NLEVELS]; /* Run queues */
 	struct spinlock c_runqueue_lock;
+	struct callwheel *c_callwheel;	/* Pending callouts */
 
 	/*
 	 * Accessed by other cpus.
@@ -112,6 +128,12 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * Number of cpus. cpu numbers run from 0 to one less than this. It
+ * doesn't change once thread_start_cpus() has returned.
+ */
+unsigned cpu_count(void);
+
 /*
  * Produce a string describing the CPU type.
  */
@@ -36,6 +36,7 @@
 
 
 struct uio;  /* in <uio.h> */
+struct devstats;  /* in vfs/iostat.c */
 
 /*
  * Filesystem-namespace-accessible device.
@@ -49,6 +50,8 @@ struct device {
 	dev_t d_devnumber;	/* serial number for this device */
 
 	void *d_data;		/* device-specific data */
+
+	struct devstats *d_stats;	/* I/O statistics (see iostat.h) */
 };
 
 /*
@@ -70,6 +73,12 @@ struct device_ops {
 #define DEVOP_IO(d, u)		((d)->d_ops->devop_io(d, u))
 #define DEVOP_IOCTL(d, op, p)	((d)->d_ops->devop_ioctl(d, op, p))
 
+/*
+ * DEVOP_IO with I/O statistics (see iostat.h). Code that does I/O on
+ * a device directly rather than through its vnode should use this.
+ */
+int dev_io(struct device *d, struct uio *uio);
+
 
 /* Create vnode for a vfs-level device. */
 struct vnode *dev_create_vnode(struct device *dev);
@@ -34,6 +34,7 @@
 /*
  * Get abstract structure definitions
  */
+#include <kern/time.h>
 #include <fs.h>
 #include <vnode.h>
 
@@ -41,17 +42,93 @@
  * Our structures
  */
 
+/*
+ * Number of pages of file data cached per vnode, number of pages a
+ * readahead request reads (in one device operation), and number of
+ * readahead requests that can be waiting at once.
+ */
+#define EMUFS_NPAGES    16
+#define EMUFS_RAPAGES   8
+#define EMUFS_RAQUEUE   8
+
+/*
+ * A cached page of file data (EMUFS_PAGESIZE bytes; see emu.c).
+ * ep_len is less than a full page only at end of file.
+ */
+struct emufs_page {
+	off_t ep_offset;		/* file offset, or -1 if unused */
+	uint32_t ep_len;		/* valid bytes */
+	unsigned ep_stamp;		/* last use, for LRU */
+	char *ep_data;			/* the data (allocated when first used) */
+};
+
+/*
+ * A cached directory entry. Directory offsets are cookies from the
+ * device, so each entry records where the next one is. Entries are
+ * kept in a list in directory order; each one is allocated on its own
+ * so that big directories don't need one big allocation.
+ */
+struct emufs_dirent {
+	off_t de_offset;		/* offset of this entry */
+	off_t de_next;			/* offset of the next entry */
+	struct emufs_dirent *de_link;	/* next entry in the list */
+	char *de_name;
+};
+
+/* Most directory entries cached per directory */
+#define EMUFS_DIRMAX    4096
+
 struct emufs_vnode {
 	struct vnode ev_v;		/* abstract vnode structure */
 	struct emu_softc *ev_emu;	/* device */
 	uint32_t ev_handle;		/* file handle */
+
+	struct lock *ev_lock;		/* protects the fields below */
+	struct emufs_page ev_pages[EMUFS_NPAGES]; /* cached file data */
+	unsigned ev_clock;		/* stamp source for ev_pages */
+	off_t ev_lastend;		/* where the last read ended */
+	off_t ev_rapending;		/* page queued for readahead, or -1 */
+	uint32_t ev_type;		/* S_IFREG or S_IFDIR */
+	bool ev_sizevalid;		/* ev_size has been set */
+	off_t ev_size;			/* cached file size */
+	struct timespec ev_attrtime;	/* when ev_size was last checked */
+
+	/* Directories only */
+	struct emufs_dirent *ev_dirents; /* cached listing */
+	unsigned ev_ndirents;		/* entries in ev_dirents */
+	struct emufs_dirent *ev_dirhint; /* likely next entry to be read */
+	off_t ev_dirend;		/* offset of end of directory */
+	bool ev_dirvalid;		/* ev_dirents is the whole listing */
+	struct timespec ev_dirtime;	/* when it was read */
 };
 
+/*
+ * A readahead request, for the per-filesystem readahead thread. The
+ * queue holds a reference to the vnode.
+ */
+struct emufs_ra {
+	struct emufs_vnode *ra_vnode;
+	off_t ra_offset;
+};
+
+/*
+ * Tunable: how long (in milliseconds) a cached file size is trusted
+ * before asking the host again. 0 means always ask.
+ */
+extern unsigned emufs_attr_timeout;
+
 struct emufs_fs {
 	struct fs ef_fs;		/* abstract filesystem structure */
 	struct emu_softc *ef_emu;	/* device */
 	struct emufs_vnode *ef_root;	/* root vnode */
 	struct vnodearray *ef_vnodes;	/* table of loaded vnodes */
+
+	struct lock *ef_ralock;		/* protects the readahead queue */
+	struct cv *ef_racv;		/* signaled when it's nonempty */
+	struct emufs_ra ef_raq[EMUFS_RAQUEUE];	/* circular queue */
+	unsigned ef_rahead;		/* first entry */
+	unsigned ef_racount;		/* number of entries */
+	bool ef_rarunning;		/* readahead thread exists */
 };
 
 
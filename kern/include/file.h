@@ -15,6 +15,9 @@
  * Put your function declarations and data types here ...
  */
 
+/* Largest batch of names sys_getdirentries returns at once */
+#define GETDIRENTRIES_MAX 4096
+
 /* Entry in the open file table array */
 typedef struct _oftEntry {
     struct vnode *vnode; /* Pointer to the vnode for the file */
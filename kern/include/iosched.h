@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *        The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _IOSCHED_H_
+#define _IOSCHED_H_
+
+/*
+ * I/O scheduler for block device drivers.
+ *
+ * A driver that keeps a queue of requests embeds a struct
+ * iosched_req in each of them, and instead of keeping the queue in
+ * arrival order itself, passes them to iosched_add and asks
+ * iosched_next which one to start when the device goes idle. The
+ * order is decided by the device's policy:
+ *
+ *    fifo      - arrival order.
+ *    clook     - C-LOOK elevator: the nearest request at or beyond the
+ *                head position, sweeping upward; after the highest
+ *                one, jump back to the lowest. Every request waits at
+ *                most one sweep.
+ *    deadline  - C-LOOK, except that a request that has been waiting
+ *                longer than its deadline (iosched_read_expire or
+ *                iosched_write_expire milliseconds) is taken first.
+ *
+ * The policy can be changed at any time with iosched_setpolicy; the
+ * queue is the same for all policies, so nothing needs to move.
+ *
+ * All the calls that take a struct iosched must be made with the
+ * driver's lock (passed to iosched_create) held; they may be made
+ * from interrupt context.
+ */
+
+#include <kern/time.h>
+
+struct spinlock;	/* from spinlock.h */
+struct iosched_policy;	/* Opaque */
+
+/*
+ * Per-request scheduling information. The driver sets the first
+ * group of fields before calling iosched_add.
+ */
+struct iosched_req {
+	uint32_t ir_sector;		/* First sector */
+	uint32_t ir_nsect;		/* Number of sectors */
+	bool ir_write;			/* Write (otherwise read) */
+	void *ir_data;			/* The driver's request */
+
+	struct timespec ir_deadline;	/* Set by iosched_add */
+	struct iosched_req *ir_next;	/* Queue links, arrival order */
+	struct iosched_req *ir_prev;
+};
+
+/*
+ * Per-device scheduler state.
+ */
+struct iosched {
+	char *is_name;			/* Device name */
+	const struct iosched_policy *is_policy;
+	struct spinlock *is_lock;	/* The driver's lock */
+	struct iosched_req *is_head;	/* Oldest request */
+	struct iosched_req *is_tail;	/* Newest request */
+	unsigned is_count;		/* Number of queued requests */
+	uint32_t is_pos;		/* Sector after the last one started */
+};
+
+/* Tunables: deadlines, in milliseconds */
+extern unsigned iosched_read_expire;
+extern unsigned iosched_write_expire;
+
+/* Set up a queue for device DEVNAME, whose driver uses lock LOCK. */
+struct iosched *iosched_create(const char *devname, struct spinlock *lock);
+void iosched_destroy(struct iosched *is);
+
+/* Queue a request. */
+void iosched_add(struct iosched *is, struct iosched_req *ir);
+
+/* Dequeue the request to start next, or return NULL if none. */
+struct iosched_req *iosched_next(struct iosched *is);
+
+/*
+ * Put back a request that was started but not finished, so that
+ * something else can go first, after updating ir_sector and ir_nsect
+ * to describe what's left. It goes back at the front of the queue
+ * with its original deadline, and the head is taken to be at
+ * ir_sector. So fifo and clook pick it again straight away (it wins
+ * ties by being at the front); only deadline picks something else,
+ * and then only a request whose deadline is earlier and has passed.
+ */
+void iosched_requeue(struct iosched *is, struct iosched_req *ir);
+
+/* Is the queue empty? */
+bool iosched_isempty(struct iosched *is);
+
+/*
+ * Change the policy of device DEVNAME to POLICY. Returns ENODEV if
+ * there's no such device, EINVAL if there's no such policy.
+ */
+int iosched_setpolicy(const char *devname, const char *policy);
+
+/* Print the devices and their policies (for the menu). */
+void iosched_print(void);
+
+#endif /* _IOSCHED_H_ */
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *        The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _IOSTAT_H_
+#define _IOSTAT_H_
+
+/*
+ * Per-device I/O statistics.
+ *
+ * Block devices get a set of counters when they're added with
+ * vfs_adddev. dev_io in vfs/device.c brackets DEVOP_IO with
+ * iostat_begin and iostat_end. The device vnode uses it, and so does
+ * sfs for its block I/O, so both user and filesystem I/O is counted.
+ *
+ * The counters can be seen with the "iostat" menu command, or read
+ * from the "iostat:" device as an array of struct iostat (see
+ * <kern/iostat.h>), which is what /sbin/iostat does.
+ */
+
+#include <kern/iostat.h>
+
+struct device;		/* from device.h */
+struct timespec;	/* from kern/time.h */
+
+/* Start keeping statistics for block device DEV, named NAME. */
+void iostat_attach(struct device *dev, const char *name);
+
+/* Record the start and end of a request. */
+void iostat_begin(struct device *dev, struct timespec *start);
+void iostat_end(struct device *dev, const struct timespec *start,
+		bool write, size_t bytes, int result);
+
+/* Print all the counters (for the menu). */
+void iostat_print(void);
+
+/* Create the iostat: device. */
+void iostat_bootstrap(void);
+
+#endif /* _IOSTAT_H_ */
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *        The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_IOSTAT_H_
+#define _KERN_IOSTAT_H_
+
+/*
+ * Block device I/O statistics, as read from the "iostat:" device.
+ *
+ * Reading iostat: returns one struct iostat for each block device,
+ * as of the time of the read. All counters are cumulative since boot;
+ * tools that want rates take two samples and subtract.
+ *
+ * ios_busyusec is the total time during which at least one request
+ * was in progress on the device; ios_latusec is the total time spent
+ * by all requests, which exceeds busy time when requests overlap.
+ *
+ * The latency histograms count requests by completion time: bucket 0
+ * is under 1 ms, bucket i (0 < i < IOSTAT_NBUCKETS-1) is from 2^(i-1)
+ * ms up to 2^i ms, and the last bucket is everything slower.
+ */
+
+#define IOSTAT_NAMELEN   16	/* includes the null terminator */
+#define IOSTAT_NBUCKETS  12
+
+/* Indexes for the per-direction counters */
+#define IOSTAT_READ      0
+#define IOSTAT_WRITE     1
+
+struct iostat {
+	char ios_name[IOSTAT_NAMELEN];		/* device name, e.g. lhd0 */
+	uint32_t ios_blocksize;			/* sector size */
+	uint32_t ios_inflight;			/* requests in progress now */
+	uint32_t ios_maxinflight;		/* most ever in progress */
+	uint32_t ios_errors;			/* requests that failed */
+	uint64_t ios_ops[2];			/* requests */
+	uint64_t ios_sectors[2];		/* sectors transferred */
+	uint64_t ios_bytes[2];			/* bytes transferred */
+	uint64_t ios_latusec[2];		/* total request time */
+	uint64_t ios_busyusec;			/* time with requests pending */
+	uint32_t ios_hist[2][IOSTAT_NBUCKETS];	/* latency histograms */
+};
+
+#endif /* _KERN_IOSTAT_H_ */
@@ -74,7 +74,9 @@ struct sfs_superblock {
 	uint32_t sb_magic;		/* Magic number; should be SFS_MAGIC */
 	uint32_t sb_nblocks;			/* Number of blocks in fs */
 	char sb_volname[SFS_VOLNAME_SIZE];	/* Name of this volume */
-	uint32_t reserved[118];			/* unused, set to 0 */
+	uint32_t sb_journalstart;		/* First block of journal */
+	uint32_t sb_journalblocks;		/* Size of journal (0 = none) */
+	uint32_t reserved[116];			/* unused, set to 0 */
 };
 
 /*
@@ -97,5 +99,58 @@ struct sfs_direntry {
 	char sfd_name[SFS_NAMELEN];		/* Filename */
 };
 
+/*
+ * Metadata journal.
+ *
+ * If sb_journalblocks is nonzero, that many blocks starting at
+ * sb_journalstart are reserved (and marked in use in the freemap) for
+ * a write-ahead log of metadata blocks. The first block of the area
+ * is a header; the rest holds transactions, written one after another
+ * starting right after the header. A transaction is a descriptor
+ * block listing the home locations of the blocks that follow it, the
+ * block images themselves, and a commit block. A transaction counts
+ * only if its descriptor and commit block both carry the expected
+ * sequence number and the commit block's checksum (SFS_JSUM over
+ * every word of the images in order, starting from the sequence
+ * number) matches.
+ *
+ * Replay starts right after the header, expecting sequence number
+ * jh_seq, and copies the images of each complete transaction to
+ * their home locations until it finds one that isn't. Once every
+ * logged block has been written home the header is rewritten with
+ * the next sequence number, which makes the whole log stale.
+ */
+#define SFS_JMAGIC_HEADER 0x5f4a4844    /* journal header block */
+#define SFS_JMAGIC_DESC   0x5f4a4453    /* transaction descriptor */
+#define SFS_JMAGIC_COMMIT 0x5f4a434d    /* transaction commit block */
+#define SFS_JMAXBLOCKS    125           /* max blocks in a transaction */
+#define SFS_JMINSIZE      16            /* smallest usable journal */
+
+struct sfs_jheader {
+	uint32_t jh_magic;			/* SFS_JMAGIC_HEADER */
+	uint32_t jh_seq;			/* Sequence # of first txn */
+	uint32_t reserved[126];			/* unused, set to 0 */
+};
+
+struct sfs_jdesc {
+	uint32_t jd_magic;			/* SFS_JMAGIC_DESC */
+	uint32_t jd_seq;			/* Transaction sequence # */
+	uint32_t jd_nblocks;			/* Number of block images */
+	uint32_t jd_blocks[SFS_JMAXBLOCKS];	/* Their home locations */
+};
+
+struct sfs_jcommit {
+	uint32_t jc_magic;			/* SFS_JMAGIC_COMMIT */
+	uint32_t jc_seq;			/* Same as jd_seq */
+	uint32_t jc_nblocks;			/* Same as jd_nblocks */
+	uint32_t jc_checksum;			/* Checksum of the images */
+	uint32_t reserved[124];			/* unused, set to 0 */
+};
+
+/*
+ * Checksum step for journal images: fold in one 32-bit word.
+ */
+#define SFS_JSUM(sum, word) ((((sum) << 1) | ((sum) >> 31)) ^ (word))
+
 
 #endif /* _KERN_SFS_H_ */
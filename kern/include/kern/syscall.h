@@ -197,6 +197,11 @@
 #define SYS_reboot       119
 //#define SYS___sysctl   120
 
+//                              -- OS/161 extensions --
+#define SYS_getdirentries 121
+#define SYS_setaffinity  122
+#define SYS_getaffinity  123
+
 /*CALLEND*/
 
 
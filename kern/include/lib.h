@@ -114,10 +114,13 @@ extern uint32_t dbflags;
  * Random number generator, using the random device.
  *
  * random() returns a number between 0 and randmax() inclusive.
+ * random_bytes() fills a buffer with random bytes; it's much cheaper
+ * than calling random() repeatedly for large amounts.
  */
 #define RANDOM_MAX (randmax())
 uint32_t randmax(void);
 uint32_t random(void);
+void random_bytes(void *buf, size_t len);
 
 /*
  * Kernel heap memory allocation. Like malloc/free.
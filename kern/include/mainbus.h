@@ -48,6 +48,14 @@ void mainbus_start_cpus(void);
 /* Bus-level interrupt handler, called from cpu-level trap/interrupt code */
 void mainbus_interrupt(struct trapframe *);
 
+/*
+ * Set when the next hardclock comes on the current cpu: in TICKS
+ * hardclock periods (1/HZ second), or not until further notice if
+ * TICKS is 0. Interrupts should be off. Each timer interrupt resets
+ * the timer to one period before calling hardclock.
+ */
+void mainbus_timer_set(unsigned ticks);
+
 /* Find the size of main memory. */
 /* XXX this interface is not adequately MI */
 size_t mainbus_ramsize(void);
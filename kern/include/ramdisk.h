@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *        The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _RAMDISK_H_
+#define _RAMDISK_H_
+
+/*
+ * RAM disk: a block device whose contents live in kernel memory.
+ *
+ * Useful for measuring filesystem code without disk latency, and as
+ * a scratch volume. Each ramdisk created gets the next name ram0,
+ * ram1, ... and is added as a mountable device, so it can be
+ * formatted with sfs_mkfs (or mksfs on ramNraw:) and mounted like an
+ * lhd. The contents are lost at shutdown. Devices are permanent, so
+ * a ramdisk can't be destroyed once created.
+ *
+ * ramdisk_create makes one of SIZE bytes (rounded up to a whole
+ * number of sectors) and returns its name in NAME, which must have
+ * room for RAMDISK_NAMELEN bytes.
+ */
+
+#define RAMDISK_SECTSIZE  512
+#define RAMDISK_NAMELEN   16
+
+int ramdisk_create(size_t size, char *name);
+
+#endif /* _RAMDISK_H_ */
@@ -41,6 +41,7 @@
  */
 #include <fs.h>
 #include <vnode.h>
+#include <kern/time.h>
 
 /*
  * Get on-disk structures and constants that are made available to
@@ -56,6 +57,7 @@ struct sfs_vnode {
 	struct sfs_dinode sv_i;		/* copy of on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	struct timespec sv_dirtytime;   /* when sv_dirty was last set */
 };
 
 /*
@@ -69,6 +71,14 @@ struct sfs_fs {
 	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+	struct bitmap *sfs_freemapblkdirty; /* which freemap blocks modified */
+	unsigned sfs_ndirty;            /* number of dirty inodes */
+	struct sfs_syncer *sfs_syncer;  /* background write-back thread */
+	struct sfs_journal *sfs_journal; /* metadata log, or NULL */
+	struct bitmap *sfs_orphans;     /* unlinked inodes not yet freed */
+	unsigned sfs_norphans;          /* number of bits set in sfs_orphans */
+	uint32_t sfs_orphanscan;        /* where to look for the next orphan */
+	struct sfs_reaper *sfs_reaper;  /* work that frees orphans */
 };
 
 /*
@@ -76,5 +86,35 @@ struct sfs_fs {
  */
 int sfs_mount(const char *device);
 
+/*
+ * Function for creating an empty sfs on an unmounted device, like
+ * mksfs does (in sfs_mkfs.c). Negative JBLOCKS means default size.
+ */
+int sfs_mkfs(const char *device, const char *volname, int jblocks);
+
+/*
+ * Tunables for the background syncer (in sfs_syncer.c).
+ *
+ * sfs_syncer_interval  - seconds between syncer passes
+ * sfs_syncer_age       - inodes dirty for at least this many seconds
+ *                        get written back by a pass
+ * sfs_syncer_batch     - maximum number of inodes written per pass
+ * sfs_syncer_dirtymax  - once a volume has more dirty inodes than
+ *                        this, writers do write-back themselves
+ */
+extern unsigned sfs_syncer_interval;
+extern unsigned sfs_syncer_age;
+extern unsigned sfs_syncer_batch;
+extern unsigned sfs_syncer_dirtymax;
+
+/* Upper bound for sfs_syncer_batch. */
+#define SFS_SYNCER_MAXBATCH  64
+
+/*
+ * If set, the blocks of unlinked files are freed in the background
+ * instead of by whoever drops the last reference (in sfs_reaper.c).
+ */
+extern bool sfs_deferfree;
+
 
 #endif /* _SFS_H_ */
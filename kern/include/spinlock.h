@@ -37,6 +37,7 @@
 
 #include <cdefs.h>
 #include <hangman.h>
+#include "opt-ticketlock.h"
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -51,30 +52,54 @@
  *
  * Note that spinlocks are held by CPUs, not by threads.
  *
+ * A spinlock is either a test-and-set lock, where waiting cpus all
+ * fight over the lock word, or a ticket lock, where they take a
+ * number and are let in first come, first served. Ticket locks are
+ * fair, and waiters only read while they spin, so they behave better
+ * under heavy contention between cpus; test-and-set locks are a
+ * little cheaper when nobody is waiting. spinlock_init makes a
+ * test-and-set lock unless the kernel is configured with "options
+ * ticketlock"; spinlock_init_ticket and spinlock_init_tas choose
+ * explicitly.
+ *
  * This structure is made public so spinlocks do not have to be
  * malloc'd; however, code that uses spinlocks should not look inside
  * the structure directly but always use the spinlock API functions.
  */
 struct spinlock {
 	volatile spinlock_data_t splk_lock; /* Memory word where we spin. */
+	volatile unsigned splk_next;	    /* Ticket lock: next to hand out */
+	volatile unsigned splk_serving;	    /* Ticket lock: holder's ticket */
 	struct cpu *splk_holder;	    /* CPU holding this lock. */
+	bool splk_ticket;		    /* True if a ticket lock. */
 	HANGMAN_LOCKABLE(splk_hangman);     /* Deadlock detector hook. */
 };
 
+/* What spinlock_init and SPINLOCK_INITIALIZER make. */
+#if OPT_TICKETLOCK
+#define SPINLOCK_TICKET_DEFAULT	true
+#else
+#define SPINLOCK_TICKET_DEFAULT	false
+#endif
+
 /*
  * Initializer for cases where a spinlock needs to be static or global.
  */
 #ifdef OPT_HANGMAN
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL, \
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, 0, 0, NULL, \
+				  SPINLOCK_TICKET_DEFAULT, \
 				  HANGMAN_LOCKABLE_INITIALIZER }
 #else
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, 0, 0, NULL, \
+				  SPINLOCK_TICKET_DEFAULT }
 #endif
 
 /*
  * Spinlock functions.
  *
  * init		Initialize the contents of a spinlock.
+ * init_ticket	Likewise, making it a ticket lock.
+ * init_tas	Likewise, making it a test-and-set lock.
  * cleanup	Opposite of init. Lock must be unlocked.
  *
  * acquire	Get the lock, spinning as necessary. Also disables interrupts.
@@ -84,6 +109,8 @@ struct spinlock {
  */
 
 void spinlock_init(struct spinlock *lk);
+void spinlock_init_ticket(struct spinlock *lk);
+void spinlock_init_tas(struct spinlock *lk);
 void spinlock_cleanup(struct spinlock *lk);
 
 void spinlock_acquire(struct spinlock *lk);
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *        The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _STRIPE_H_
+#define _STRIPE_H_
+
+/*
+ * Striped (RAID-0) pseudo-disk.
+ *
+ * Combines several disks into one device named stripeN, whose
+ * sectors are dealt out to the member disks CHUNK sectors at a time:
+ * chunk 0 on the first disk, chunk 1 on the second, and so on. Each
+ * member has a worker thread, and a transfer that covers several
+ * chunks is split up and handed to the workers, so the members
+ * seek and transfer in parallel.
+ *
+ * The members must be unmounted mountable devices (e.g. lhd1, lhd2)
+ * with 512-byte sectors; the stripe is as big as the number of
+ * members times the smallest member (rounded down to whole chunks).
+ * The stripe is itself mountable. The members are claimed (see
+ * vfs_claimdev), so mounting one, swapping to it, or putting it in
+ * another stripe fails with EBUSY; nothing stops writes through its
+ * raw device, though, so don't.
+ *
+ * stripe_create returns the new device's name in NAME, which must
+ * have room for STRIPE_NAMELEN bytes.
+ */
+
+#define STRIPE_MAXDISKS  8
+#define STRIPE_NAMELEN   16
+
+int stripe_create(unsigned chunk, unsigned ndisks, char **disks, char *name);
+
+#endif /* _STRIPE_H_ */
@@ -62,6 +62,13 @@ void sem_destroy(struct semaphore *);
 void P(struct semaphore *);
 void V(struct semaphore *);
 
+/*
+ * P, but give up and return ETIMEDOUT if the count stays 0 for
+ * TIMEOUT_MS milliseconds. Returns 0 on success. (Timeouts are
+ * rounded up to whole hardclock ticks.)
+ */
+int P_timed(struct semaphore *, unsigned timeout_ms);
+
 
 /*
  * Simple lock for mutual exclusion.
@@ -75,9 +82,10 @@ void V(struct semaphore *);
 struct lock {
         char *lk_name;
         HANGMAN_LOCKABLE(lk_hangman);   /* Deadlock detector hook. */
+        volatile unsigned lk_owner;     /* Holder, and waiters flag. */
+        struct cpu *volatile lk_cpu;    /* Where the holder got it. */
         struct wchan *lk_wchan;
-        struct spinlock lk_lock;
-        struct thread *volatile lk_holder;
+        struct spinlock lk_lock;        /* For sleeping and waking. */
 };
 
 struct lock *lock_create(const char *name);
@@ -98,6 +106,18 @@ void lock_acquire(struct lock *);
 void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
 
+/*
+ * lock_acquire, but give up and return ETIMEDOUT if the lock can't
+ * be had within TIMEOUT_MS milliseconds. Returns 0 on success.
+ */
+int lock_acquire_timed(struct lock *, unsigned timeout_ms);
+
+/*
+ * A thread that finds a lock held spins, rather than sleeping, while
+ * the holder is running on another cpu, up to this many times.
+ */
+extern unsigned lock_spinmax;
+
 
 /*
  * Condition variable.
@@ -139,5 +159,67 @@ void cv_wait(struct cv *cv, struct lock *lock);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
+/*
+ * cv_wait, but wake up anyway after TIMEOUT_MS milliseconds. Returns
+ * ETIMEDOUT if that's why it woke up and 0 otherwise; either way the
+ * lock is held again on return, and as with cv_wait the caller should
+ * recheck its condition.
+ */
+int cv_timedwait(struct cv *cv, struct lock *lock, unsigned timeout_ms);
+
+
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers can hold the lock at once, or one writer.
+ * Writers are preferred: a reader that comes along while a writer is
+ * waiting waits too. So, unlike a plain lock, it's for structures that
+ * are looked at much more often than changed.
+ *
+ * The lock is not recursive, in either mode. In particular a thread
+ * holding it for reading must not enter it again for reading, since
+ * a writer may have arrived in between.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+struct rwlock {
+        char *rw_name;
+        struct wchan *rw_readwchan;     /* Readers wait here. */
+        struct wchan *rw_writewchan;    /* Writers wait here. */
+        struct spinlock rw_lock;
+        volatile unsigned rw_readers;   /* Readers holding the lock. */
+        volatile unsigned rw_writewait; /* Writers waiting for it. */
+        struct thread *volatile rw_writer;  /* Writer holding it. */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rw_enter_read     - Get the lock for reading.
+ *    rw_enter_write    - Get the lock for writing.
+ *    rw_tryenter_read  - Get the lock for reading if that can be done
+ *                        without waiting; return true if so.
+ *    rw_tryenter_write - Likewise, for writing.
+ *    rw_exit_read      - Release the lock, held for reading.
+ *    rw_exit_write     - Release the lock, held for writing.
+ *    rw_downgrade      - Turn a write hold into a read hold, letting
+ *                        other readers in, without any moment where
+ *                        the lock is free.
+ *    rw_write_held     - Return true if the current thread holds the
+ *                        lock for writing. (There's no equivalent for
+ *                        readers, who aren't tracked individually.)
+ */
+void rw_enter_read(struct rwlock *);
+void rw_enter_write(struct rwlock *);
+bool rw_tryenter_read(struct rwlock *);
+bool rw_tryenter_write(struct rwlock *);
+void rw_exit_read(struct rwlock *);
+void rw_exit_write(struct rwlock *);
+void rw_downgrade(struct rwlock *);
+bool rw_write_held(struct rwlock *);
+
 
 #endif /* _SYNCH_H_ */
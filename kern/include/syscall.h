@@ -58,6 +58,7 @@ __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(userptr_t user_req, userptr_t user_rem);
 
 /* Open a file */
 int sys_open(userptr_t filename, int flags, mode_t mode, int32_t* retval);
@@ -77,4 +78,15 @@ int sys_close(int fd, int32_t* retval);
 /* Clone file handles */
 int sys_dup2(int oldfd, int newfd, int32_t* retval);
 
+/* Read filenames from a directory, one at a time or in batches */
+int sys_getdirentry(int fd, userptr_t buf, size_t buflen, int32_t* retval);
+int sys_getdirentries(int fd, userptr_t buf, size_t buflen, int32_t* retval);
+
+/* Flush all filesystem buffers to disk */
+int sys_sync(void);
+
+/* Set and get the cpus the calling thread may run on */
+int sys_setaffinity(uint32_t mask);
+int sys_getaffinity(userptr_t user_mask_ptr);
+
 #endif /* _SYSCALL_H_ */
@@ -54,6 +54,12 @@ int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
 int cvtest2(int, char **);
+int timedtest(int, char **);
+int lockbench(int, char **);
+int rwtest(int, char **);
+int spinbench(int, char **);
+int wqtest(int, char **);
+int schedtest(int, char **);
 
 /* semaphore unit tests */
 int semu1(int, char **);
@@ -79,10 +79,15 @@ struct thread {
 	 */
 	struct thread_machdep t_machdep; /* Any machine-dependent goo */
 	struct threadlistnode t_listnode; /* Link for run/sleep/zombie lists */
+	char t_namebuf[16];		/* Holds t_name if it fits */
 	void *t_stack;			/* Kernel-level stack */
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
+	unsigned t_prio;		/* Scheduler priority level */
+	unsigned t_ticks;		/* Hardclocks used of current slice */
+	unsigned t_slice;		/* Time slice at level 0, in hardclocks */
+	uint32_t t_affinity;		/* CPUs thread may run on */
 	HANGMAN_ACTOR(t_hangman);	/* Deadlock detector hook */
 
 	/*
@@ -145,6 +150,22 @@ int thread_fork(const char *name, struct proc *proc,
                 void (*func)(void *, unsigned long),
                 void *data1, unsigned long data2);
 
+/*
+ * CPU affinity. Bit N of a thread's affinity mask is set if the thread
+ * may run on cpu number N; THREAD_ANYCPU allows all of them. New
+ * threads inherit the mask of the thread that forked them.
+ *
+ * thread_setaffinity sets the mask of the current thread, and fails
+ * with EINVAL if it contains no cpu that exists. If the current cpu
+ * isn't in the new mask, the thread has moved to one that is by the
+ * time it returns. thread_getaffinity returns the current thread's
+ * mask.
+ */
+#define THREAD_ANYCPU 0xffffffff
+
+int thread_setaffinity(uint32_t mask);
+uint32_t thread_getaffinity(void);
+
 /*
  * Cause the current thread to exit.
  * Interrupts need not be disabled.
@@ -158,11 +179,45 @@ __DEAD void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Charge the current thread for TICKS clock ticks, and switch to
+ * another thread if its time slice is up or a higher-priority thread
+ * is waiting. Called from the timer interrupt.
+ */
+void thread_tick(unsigned ticks);
+
+/*
+ * Program the current cpu's timer for the next time hardclock has
+ * anything to do: never while idle, after one tick if other threads
+ * are waiting, or else when the current thread's slice runs out.
+ * Called from the timer interrupt.
+ */
+void thread_timer(void);
+
+/*
+ * Time slices. A thread at priority level L runs for up to
+ * (slice << L) hardclocks at a time. New threads inherit the slice of
+ * the thread that forked them. thread_setslice sets the current
+ * thread's slice and fails with EINVAL unless 1 <= SLICE <=
+ * THREAD_MAXSLICE; thread_getslice returns it.
+ */
+#define THREAD_MAXSLICE 100
+
+int thread_setslice(unsigned slice);
+unsigned thread_getslice(void);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
 void schedule(void);
 
+/*
+ * If false, threads never drop a level, so with the default one-tick
+ * slice the scheduler is plain round-robin, as it used to be. For
+ * comparing the two; see the scheduler latency test.
+ */
+extern bool sched_feedback;
+
 /*
  * Potentially migrate ready threads to other CPUs. Called from the
  * timer interrupt.
@@ -163,6 +163,15 @@ int vfs_getcwd(struct uio *buf);
  *                    previously returned by vfs_swapon should be
  *                    decref'd first. Similar to vfs_unmount.
  *
+ *    vfs_claimdev  - Look up DEVNAME and mark it as in use by another
+ *                    device, returning its raw vnode. It can't be
+ *                    mounted, swapped to, or claimed again until
+ *                    released. Similar to vfs_swapon.
+ *
+ *    vfs_releasedev - Release a device claimed with vfs_claimdev,
+ *                    given the vnode it returned, and drop that
+ *                    vnode's reference.
+ *
  *    vfs_unmountall - Unmount all mounted filesystems.
  */
 
@@ -181,6 +190,8 @@ int vfs_mount(const char *devname, void *data,
 int vfs_unmount(const char *devname);
 int vfs_swapon(const char *devname, struct vnode **result);
 int vfs_swapoff(const char *devname);
+int vfs_claimdev(const char *devname, struct vnode **result);
+void vfs_releasedev(struct vnode *vn);
 int vfs_unmountall(void);
 
 /*
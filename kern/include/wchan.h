@@ -66,6 +66,12 @@ bool wchan_isempty(struct wchan *wc, struct spinlock *lk);
  */
 void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * The same, but give up after TICKS hardclock ticks (see
+ * callout_schedule). Returns 0 if woken up, or ETIMEDOUT.
+ */
+int wchan_sleep_timed(struct wchan *wc, struct spinlock *lk, unsigned ticks);
+
 /*
  * Wake up one thread, or all threads, sleeping on a wait channel.
  * The associated spinlock should be locked.
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *        The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+/*
+ * Workqueues: deferred work run by kernel threads.
+ *
+ * A workqueue has a worker thread for each cpu. Queueing a work item
+ * hands it to the worker of the current cpu, which calls its function
+ * in thread context, where it may sleep and take locks. Work can be
+ * queued from anywhere, including interrupt handlers, so it's the way
+ * to get something done that can't or shouldn't be done on the spot.
+ *
+ * A work item is either idle, pending (queued and waiting to run), or
+ * running; it can be queued again while it runs, but is only ever
+ * pending once. The function may free the item.
+ *
+ * system_workqueue is for general use. Work on it shouldn't block for
+ * long, since other work on the same cpu waits behind it.
+ */
+
+#include <callout.h>
+
+struct workqueue;	/* private to workqueue.c */
+
+struct work {
+	struct work *wk_next;		/* Queue links */
+	struct work *wk_prev;
+	void (*wk_func)(void *);	/* Function to call */
+	void *wk_data;			/* Argument for wk_func */
+	struct workqueue *wk_wq;	/* Queue last put on, if any */
+	unsigned wk_cpu;		/* Which cpu's list it went on */
+	bool wk_pending;		/* On the queue, not yet run */
+};
+
+/* Work that's queued after a delay. */
+struct delayed_work {
+	struct work dw_work;
+	struct callout dw_callout;
+	struct workqueue *dw_wq;
+};
+
+extern struct workqueue *system_workqueue;
+
+/* Create system_workqueue, once all the cpus are running. */
+void workqueue_bootstrap(void);
+
+/*
+ * Create a workqueue, with worker threads named after NAME, or
+ * destroy one. Destroying runs whatever is still pending first.
+ */
+struct workqueue *workqueue_create(const char *name);
+void workqueue_destroy(struct workqueue *wq);
+
+/* Set up a work item to call FUNC(DATA). */
+void work_init(struct work *wk, void (*func)(void *), void *data);
+void delayed_work_init(struct delayed_work *dw,
+		       void (*func)(void *), void *data);
+
+/*
+ * Queue WK on WQ for the current cpu's worker. Returns false (and does
+ * nothing) if it's already pending. May be called from interrupts.
+ */
+bool workqueue_queue(struct workqueue *wq, struct work *wk);
+
+/*
+ * Queue DW on WQ after TICKS hardclock ticks (see callout_schedule).
+ * If it was already waiting, it waits from now instead. As with
+ * callouts, don't do this concurrently with cancelling the same item.
+ */
+void workqueue_queue_delayed(struct workqueue *wq, struct delayed_work *dw,
+			     unsigned ticks);
+
+/*
+ * Wait until all work queued on WQ before the call has run. (Delayed
+ * work that hasn't been queued yet isn't waited for.) Must not be
+ * called from WQ's own work.
+ */
+void workqueue_flush(struct workqueue *wq);
+
+/*
+ * Take WK off its queue if it's pending, and wait for it to finish if
+ * it's running. Returns true if it was pending. Afterwards WK is
+ * idle (unless someone queues it again) and may be freed. Must not be
+ * called from WK itself. May sleep.
+ */
+bool work_cancel(struct work *wk);
+bool delayed_work_cancel(struct delayed_work *dw);
+
+#endif /* _WORKQUEUE_H_ */
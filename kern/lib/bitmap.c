@@ -157,6 +157,36 @@ bitmap_unmark(struct bitmap *b, unsigned index)
         b->v[ix] &= ~mask;
 }
 
+void
+bitmap_unmark_range(struct bitmap *b, unsigned index, unsigned count)
+{
+        unsigned ix;
+
+        KASSERT(index + count <= b->nbits);
+
+        /* Odd bits up to the first word boundary */
+        while (count > 0 && index % BITS_PER_WORD != 0) {
+                bitmap_unmark(b, index);
+                index++;
+                count--;
+        }
+
+        /* Whole words at a time */
+        while (count >= BITS_PER_WORD) {
+                ix = index / BITS_PER_WORD;
+                KASSERT(b->v[ix] == WORD_ALLBITS);
+                b->v[ix] = 0;
+                index += BITS_PER_WORD;
+                count -= BITS_PER_WORD;
+        }
+
+        /* Whatever is left over */
+        while (count > 0) {
+                bitmap_unmark(b, index);
+                index++;
+                count--;
+        }
+}
 
 int
 bitmap_isset(struct bitmap *b, unsigned index)
@@ -41,6 +41,11 @@
 #include <proc.h>
 #include <vfs.h>
 #include <sfs.h>
+#include <emufs.h>
+#include <iosched.h>
+#include <iostat.h>
+#include <ramdisk.h>
+#include <stripe.h>
 #include <syscall.h>
 #include <test.h>
 #include "opt-sfs.h"
@@ -239,6 +244,290 @@ cmd_sync(int nargs, char **args)
 	return 0;
 }
 
+#if OPT_SFS
+/*
+ * Command for examining and setting the SFS syncer tunables.
+ */
+static
+int
+cmd_syncer(int nargs, char **args)
+{
+	if (nargs != 1 && nargs != 5) {
+		kprintf("Usage: syncer [interval age batch dirtymax]\n");
+		return EINVAL;
+	}
+
+	if (nargs == 5) {
+		if (atoi(args[1]) < 1 || atoi(args[3]) < 1 ||
+		    atoi(args[3]) > SFS_SYNCER_MAXBATCH ||
+		    atoi(args[2]) < 0 || atoi(args[4]) < 0) {
+			kprintf("syncer: need interval >= 1, age >= 0, "
+				"1 <= batch <= %d, dirtymax >= 0\n",
+				SFS_SYNCER_MAXBATCH);
+			return EINVAL;
+		}
+		sfs_syncer_interval = atoi(args[1]);
+		sfs_syncer_age = atoi(args[2]);
+		sfs_syncer_batch = atoi(args[3]);
+		sfs_syncer_dirtymax = atoi(args[4]);
+	}
+
+	kprintf("syncer: interval %us, age %us, batch %u, dirtymax %u\n",
+		sfs_syncer_interval, sfs_syncer_age, sfs_syncer_batch,
+		sfs_syncer_dirtymax);
+	return 0;
+}
+
+/*
+ * Command for turning deferred freeing of unlinked SFS files on/off.
+ */
+static
+int
+cmd_deferfree(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		sfs_deferfree = true;
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		sfs_deferfree = false;
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: deferfree [on|off]\n");
+		return EINVAL;
+	}
+
+	kprintf("deferfree: %s\n", sfs_deferfree ? "on" : "off");
+	return 0;
+}
+#endif
+
+/*
+ * Command for examining and setting the time slice. Programs run from
+ * the menu inherit the menu thread's slice.
+ */
+static
+int
+cmd_slice(int nargs, char **args)
+{
+	int result;
+
+	if (nargs == 2) {
+		result = thread_setslice(atoi(args[1]));
+		if (result) {
+			kprintf("slice: need 1 to %u hardclocks\n",
+				THREAD_MAXSLICE);
+			return result;
+		}
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: slice [hardclocks]\n");
+		return EINVAL;
+	}
+
+	kprintf("slice: %u hardclocks at top priority\n", thread_getslice());
+	return 0;
+}
+
+/*
+ * Command for examining and setting the emufs attribute cache timeout.
+ */
+static
+int
+cmd_emufsattr(int nargs, char **args)
+{
+	char *s;
+
+	if (nargs == 2) {
+		for (s = args[1]; *s >= '0' && *s <= '9'; s++) {
+			/* nothing */
+		}
+		if (s == args[1] || *s != 0) {
+			kprintf("Usage: emufsattr [milliseconds]\n");
+			return EINVAL;
+		}
+		emufs_attr_timeout = atoi(args[1]);
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: emufsattr [milliseconds]\n");
+		return EINVAL;
+	}
+
+	kprintf("emufsattr: sizes trusted for %u ms\n", emufs_attr_timeout);
+	return 0;
+}
+
+/*
+ * Command for examining and setting disk I/O scheduling policies.
+ */
+static
+int
+cmd_iosched(int nargs, char **args)
+{
+	int result;
+
+	if (nargs == 3) {
+		result = iosched_setpolicy(args[1], args[2]);
+		if (result) {
+			kprintf("iosched: %s %s: %s\n", args[1], args[2],
+				strerror(result));
+			return result;
+		}
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: iosched [device policy]\n");
+		return EINVAL;
+	}
+
+	iosched_print();
+	return 0;
+}
+
+/*
+ * Command for creating a RAM disk. The size is in bytes, or with a K
+ * or M suffix, kilobytes or megabytes.
+ */
+static
+int
+cmd_ramdisk(int nargs, char **args)
+{
+	char name[RAMDISK_NAMELEN];
+	size_t size, mult;
+	char *s;
+	int result;
+
+	if (nargs != 2) {
+		kprintf("Usage: ramdisk size[K|M]\n");
+		return EINVAL;
+	}
+
+	/* Not atoi, which would silently wrap a big number */
+	size = 0;
+	for (s = args[1]; *s >= '0' && *s <= '9'; s++) {
+		if (size > ((size_t)-1 - (*s - '0')) / 10) {
+			break;
+		}
+		size = size * 10 + (*s - '0');
+	}
+	if (!strcmp(s, "K") || !strcmp(s, "k")) {
+		mult = 1024;
+	}
+	else if (!strcmp(s, "M") || !strcmp(s, "m")) {
+		mult = 1024 * 1024;
+	}
+	else {
+		mult = 1;
+	}
+	if (s == args[1] || (mult == 1 && *s != 0) ||
+	    size > (size_t)-1 / mult) {
+		kprintf("ramdisk: Invalid size %s\n", args[1]);
+		return EINVAL;
+	}
+	size *= mult;
+
+	result = ramdisk_create(size, name);
+	if (result) {
+		kprintf("ramdisk: %s\n", strerror(result));
+		return result;
+	}
+	kprintf("ramdisk: %s: %u bytes\n", name,
+		ROUNDUP(size, RAMDISK_SECTSIZE));
+	return 0;
+}
+
+/*
+ * Command for creating a striped disk out of several disks.
+ */
+static
+int
+cmd_stripe(int nargs, char **args)
+{
+	char name[STRIPE_NAMELEN];
+	char *disk;
+	int i, result;
+
+	if (nargs < 3 || nargs > 2 + STRIPE_MAXDISKS || atoi(args[1]) < 1) {
+		kprintf("Usage: stripe chunk-sectors disk: disk: ...\n");
+		kprintf("       (up to %d disks)\n", STRIPE_MAXDISKS);
+		return EINVAL;
+	}
+
+	for (i=2; i<nargs; i++) {
+		/* Allow (but do not require) colon after device name */
+		disk = args[i];
+		if (disk[strlen(disk)-1]==':') {
+			disk[strlen(disk)-1] = 0;
+		}
+	}
+
+	result = stripe_create(atoi(args[1]), nargs-2, &args[2], name);
+	if (result) {
+		kprintf("stripe: %s\n", strerror(result));
+		return result;
+	}
+	kprintf("stripe: %s: %d disks\n", name, nargs-2);
+	return 0;
+}
+
+#if OPT_SFS
+/*
+ * Command for creating an SFS volume, like mksfs.
+ */
+static
+int
+cmd_mkfs(int nargs, char **args)
+{
+	char *device, *s;
+	int result;
+
+	if (nargs != 3 && nargs != 4) {
+		kprintf("Usage: mkfs device: volname [journal-blocks]\n");
+		return EINVAL;
+	}
+	if (nargs == 4) {
+		/*
+		 * atoi would turn anything else into 0 (no journal);
+		 * the length limit keeps it from overflowing.
+		 */
+		for (s = args[3]; *s >= '0' && *s <= '9'; s++) {
+			/* nothing */
+		}
+		if (s == args[3] || *s != 0 || s - args[3] > 9) {
+			kprintf("Usage: mkfs device: volname "
+				"[journal-blocks]\n");
+			return EINVAL;
+		}
+	}
+
+	device = args[1];
+
+	/* Allow (but do not require) colon after device name */
+	if (device[strlen(device)-1]==':') {
+		device[strlen(device)-1] = 0;
+	}
+
+	result = sfs_mkfs(device, args[2], nargs == 4 ? atoi(args[3]) : -1);
+	if (result) {
+		kprintf("mkfs: %s: %s\n", device, strerror(result));
+		return result;
+	}
+	return 0;
+}
+#endif
+
+/*
+ * Command for printing disk I/O statistics.
+ */
+static
+int
+cmd_iostat(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	iostat_print();
+	return 0;
+}
+
 /*
  * Command for dropping to the debugger.
  */
@@ -533,6 +822,19 @@ static const char *opsmenu[] = {
 	"[cd]      Change directory          ",
 	"[pwd]     Print current directory   ",
 	"[sync]    Sync filesystems          ",
+#if OPT_SFS
+	"[syncer]  SFS syncer tunables       ",
+	"[deferfree] SFS background frees    ",
+#endif
+	"[slice]   Scheduler time slice      ",
+	"[emufsattr] emufs attribute cache   ",
+	"[iosched] Disk I/O scheduling       ",
+	"[iostat]  Disk I/O statistics       ",
+	"[ramdisk] Create a RAM disk         ",
+	"[stripe]  Create a striped disk     ",
+#if OPT_SFS
+	"[mkfs]    Create an SFS volume      ",
+#endif
 	"[debug]   Drop to debugger          ",
 	"[panic]   Intentional panic         ",
 	"[deadlock] Intentional deadlock     ",
@@ -570,6 +872,12 @@ static const char *testmenu[] = {
 	"[sy2] Lock test                     ",
 	"[sy3] CV test                       ",
 	"[sy4] CV test #2                    ",
+	"[sy5] Timed wait test               ",
+	"[sy6] Lock benchmark                ",
+	"[sy7] Rwlock test                   ",
+	"[sy8] Spinlock benchmark            ",
+	"[wq]  Workqueue test                ",
+	"[sl]  Scheduler latency test        ",
 	"[semu1-22] Semaphore unit tests     ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress                ",
@@ -639,6 +947,19 @@ static struct {
 	{ "cd",		cmd_chdir },
 	{ "pwd",	cmd_pwd },
 	{ "sync",	cmd_sync },
+#if OPT_SFS
+	{ "syncer",	cmd_syncer },
+	{ "deferfree",	cmd_deferfree },
+#endif
+	{ "slice",	cmd_slice },
+	{ "emufsattr",	cmd_emufsattr },
+	{ "iosched",	cmd_iosched },
+	{ "iostat",	cmd_iostat },
+	{ "ramdisk",	cmd_ramdisk },
+	{ "stripe",	cmd_stripe },
+#if OPT_SFS
+	{ "mkfs",	cmd_mkfs },
+#endif
 	{ "debug",	cmd_debug },
 	{ "panic",	cmd_panic },
 	{ "deadlock",	cmd_deadlock },
@@ -672,6 +993,12 @@ static struct {
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
 	{ "sy4",	cvtest2 },
+	{ "sy5",	timedtest },
+	{ "sy6",	lockbench },
+	{ "sy7",	rwtest },
+	{ "sy8",	spinbench },
+	{ "wq",		wqtest },
+	{ "sl",		schedtest },
 
 	/* semaphore unit tests */
 	{ "semu1",	semu1 },
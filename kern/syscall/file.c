@@ -532,3 +532,165 @@ int sys_dup2(int oldfd, int newfd, int32_t* retval) {
 
 }
 
+/* Read one filename from a directory */
+int sys_getdirentry(int fd, userptr_t buf, size_t buflen, int32_t* retval) {
+
+    /* First we need to check that the fd is a valid file handle */
+    if (fd < 0 || fd >= OPEN_MAX) {
+        return EBADF;
+    }
+
+    /* Then we need to match it to an entry in the open file table, and check that the entry has been opened */
+    int oftIndex = curproc->p_fdt[fd];
+    if (oftIndex == -1) {
+        return EBADF;
+    }
+
+    /* Names are never longer than NAME_MAX */
+    if (buflen > NAME_MAX) {
+        buflen = NAME_MAX;
+    }
+
+    /* Set up the kernel buffer */
+    char *name = kmalloc(NAME_MAX + 1);
+    if (name == NULL) {
+        return ENOMEM;
+    }
+
+    /* Next we acquire the lock for the open file table, as we are about to modify the file pointer */
+    lock_acquire(oft->oftLock);
+
+    /* We also need to make sure the directory can be read */
+    if ((oft->oftArray[oftIndex]->flags & O_ACCMODE) == O_WRONLY) {
+        lock_release(oft->oftLock);
+        kfree(name);
+        return EBADF;
+    }
+
+    /* The file pointer is the position in the directory */
+    struct iovec iov;
+    struct uio u;
+    uio_kinit(&iov, &u, name, buflen, oft->oftArray[oftIndex]->fp, UIO_READ);
+
+    int result = VOP_GETDIRENTRY(oft->oftArray[oftIndex]->vnode, &u);
+    if (result) {
+        lock_release(oft->oftLock);
+        kfree(name);
+        return result;
+    }
+
+    /* Remember where the next name is */
+    oft->oftArray[oftIndex]->fp = u.uio_offset;
+
+    lock_release(oft->oftLock);
+
+    /* Copy the name to the user's pointer */
+    size_t len = buflen - u.uio_resid;
+    result = copyout(name, buf, len);
+    kfree(name);
+    if (result) {
+        return result;
+    }
+
+    /* We return the length of the name */
+    *retval = len;
+    return 0;
+}
+
+/* Read as many filenames from a directory as will fit in buf, each
+followed by a null byte. This saves a system call per name. */
+int sys_getdirentries(int fd, userptr_t buf, size_t buflen, int32_t* retval) {
+
+    /* First we need to check that the fd is a valid file handle */
+    if (fd < 0 || fd >= OPEN_MAX) {
+        return EBADF;
+    }
+
+    /* Then we need to match it to an entry in the open file table, and check that the entry has been opened */
+    int oftIndex = curproc->p_fdt[fd];
+    if (oftIndex == -1) {
+        return EBADF;
+    }
+
+    /* Don't hand back more than the biggest batch */
+    if (buflen > GETDIRENTRIES_MAX) {
+        buflen = GETDIRENTRIES_MAX;
+    }
+
+    /* Set up a kernel buffer for one name; each name is copied out to
+    the user's buffer as soon as it's read, so the batch needs no kernel
+    buffer of its own */
+    char *name = kmalloc(NAME_MAX + 1);
+    if (name == NULL) {
+        return ENOMEM;
+    }
+
+    /* Next we acquire the lock for the open file table, as we are about to modify the file pointer */
+    lock_acquire(oft->oftLock);
+
+    /* We also need to make sure the directory can be read */
+    if ((oft->oftArray[oftIndex]->flags & O_ACCMODE) == O_WRONLY) {
+        lock_release(oft->oftLock);
+        kfree(name);
+        return EBADF;
+    }
+
+    size_t used = 0;
+    int result = 0;
+    struct iovec iov;
+    struct uio u;
+
+    while (1) {
+
+        /* Read the next name at the current file pointer */
+        uio_kinit(&iov, &u, name, NAME_MAX, oft->oftArray[oftIndex]->fp, UIO_READ);
+        result = VOP_GETDIRENTRY(oft->oftArray[oftIndex]->vnode, &u);
+        if (result) {
+            break;
+        }
+
+        /* Nothing read means the end of the directory */
+        size_t len = NAME_MAX - u.uio_resid;
+        if (len == 0) {
+            break;
+        }
+
+        /* If it doesn't fit, leave the file pointer alone so the
+        next call gets it; if not even one fits, the buffer is too small */
+        if (used + len + 1 > buflen) {
+            if (used == 0) {
+                result = EINVAL;
+            }
+            break;
+        }
+
+        /* Copy the name out after the previous ones, and only then move
+        on to the next one, so a bad buffer doesn't lose a name */
+        name[len] = 0;
+        result = copyout(name, (userptr_t)((char *)buf + used), len + 1);
+        if (result) {
+            break;
+        }
+        used += len + 1;
+        oft->oftArray[oftIndex]->fp = u.uio_offset;
+    }
+
+    lock_release(oft->oftLock);
+    kfree(name);
+
+    /* Report an error only if we got nothing; otherwise hand over what we have */
+    if (result && used == 0) {
+        return result;
+    }
+
+    /* We return the number of bytes in the batch */
+    *retval = used;
+    return 0;
+}
+
+/* Flush all filesystem buffers to disk */
+int sys_sync(void) {
+
+    /* vfs_sync syncs every mounted volume and reports the first error */
+    return vfs_sync();
+}
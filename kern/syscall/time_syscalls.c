@@ -28,6 +28,8 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
@@ -56,3 +58,49 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/*
+ * Longest sleep: keep the tick count where clock_ticks() comparisons
+ * work (a bit over 124 days at HZ=100).
+ */
+#define NANOSLEEP_MAXTICKS 0x3fffffff
+
+/*
+ * Sleep for the time in *REQ, rounded up to whole hardclock ticks.
+ * Nothing can interrupt the sleep early, so if REM is given, the
+ * time remaining stored there is always zero.
+ */
+int
+sys_nanosleep(userptr_t user_req, userptr_t user_rem)
+{
+	struct timespec req;
+	uint64_t ticks;
+	int result;
+
+	result = copyin(user_req, &req, sizeof(req));
+	if (result) {
+		return result;
+	}
+	if (req.tv_sec < 0 || req.tv_nsec < 0 || req.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	ticks = (uint64_t)req.tv_sec * HZ +
+		DIVROUNDUP((unsigned)req.tv_nsec, 1000000000 / HZ);
+	if (ticks > NANOSLEEP_MAXTICKS) {
+		ticks = NANOSLEEP_MAXTICKS;
+	}
+	if (ticks > 0) {
+		clocksleep_ticks(ticks);
+	}
+
+	if (user_rem != NULL) {
+		req.tv_sec = 0;
+		req.tv_nsec = 0;
+		result = copyout(&req, user_rem, sizeof(req));
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
@@ -40,6 +40,7 @@ bitmaptest(int nargs, char **args)
 	struct bitmap *b;
 	char data[TESTSIZE];
 	uint32_t x;
+	unsigned start, len, j;
 	int i;
 
 	(void)nargs;
@@ -101,6 +102,22 @@ bitmaptest(int nargs, char **args)
 		KASSERT(data[i]==0);
 	}
 
+	/* Everything is set now; clear some ranges and put them back. */
+	for (i=0; i<16; i++) {
+		start = random() % TESTSIZE;
+		len = random() % (TESTSIZE - start + 1);
+		bitmap_unmark_range(b, start, len);
+		for (j=0; j<TESTSIZE; j++) {
+			if (j >= start && j < start+len) {
+				KASSERT(bitmap_isset(b, j)==0);
+				bitmap_mark(b, j);
+			}
+			else {
+				KASSERT(bitmap_isset(b, j));
+			}
+		}
+	}
+
 	kprintf("Bitmap test complete\n");
 	return 0;
 }
@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Scheduler latency test.
+ *
+ * Runs some compute-bound threads alongside one that keeps sleeping
+ * for a tick at a time, and measures how long each of those sleeps
+ * takes, which is a tick plus however long the sleeper waits for the
+ * cpu once it wakes up. Everything is pinned to one cpu. This is done
+ * with no hogs for a baseline, then with the hogs under plain
+ * round-robin (sched_feedback off), then with the feedback scheduler.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <synch.h>
+#include <thread.h>
+#include <current.h>
+#include <test.h>
+
+#define SL_HOGS		4
+#define SL_MAXHOGS	32
+#define SL_ROUNDS	50
+
+static volatile bool sl_stop;
+static struct semaphore *sl_donesem;
+
+/*
+ * A compute-bound thread, pinned to cpu NUM, that runs until sl_stop
+ * is set.
+ */
+static
+void
+hogthread(void *junk, unsigned long num)
+{
+	volatile unsigned spins = 0;
+
+	(void)junk;
+
+	if (num < 32) {
+		thread_setaffinity((uint32_t)1 << num);
+	}
+	while (!sl_stop) {
+		spins++;
+	}
+	V(sl_donesem);
+}
+
+/*
+ * Start NHOGS hogs on this cpu, sleep for a tick NROUNDS times, and
+ * print how long the sleeps took.
+ */
+static
+void
+sl_run(const char *what, unsigned nhogs, unsigned nrounds)
+{
+	struct timespec ts0, ts1, diff;
+	unsigned i, us, total, max;
+	int result;
+
+	sl_stop = false;
+	for (i=0; i<nhogs; i++) {
+		result = thread_fork("hog", NULL, hogthread, NULL,
+				     curcpu->c_number);
+		if (result) {
+			panic("schedtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	/* Let the hogs use up their slices and settle */
+	clocksleep_ticks(10);
+
+	total = max = 0;
+	for (i=0; i<nrounds; i++) {
+		gettime(&ts0);
+		clocksleep_ticks(1);
+		gettime(&ts1);
+		timespec_sub(&ts1, &ts0, &diff);
+		us = diff.tv_sec * 1000000 + diff.tv_nsec / 1000;
+		total += us;
+		if (us > max) {
+			max = us;
+		}
+	}
+
+	sl_stop = true;
+	for (i=0; i<nhogs; i++) {
+		P(sl_donesem);
+	}
+
+	kprintf("schedtest: %s, %u hogs: one-tick sleep took %u us "
+		"on average, %u us at most\n",
+		what, nhogs, total / nrounds, max);
+}
+
+/*
+ * Usage: sl [nhogs [nrounds]]
+ */
+int
+schedtest(int nargs, char **args)
+{
+	unsigned nhogs = SL_HOGS, nrounds = SL_ROUNDS;
+	uint32_t affinity;
+	bool feedback;
+
+	if (nargs > 1) {
+		nhogs = atoi(args[1]);
+	}
+	if (nargs > 2) {
+		nrounds = atoi(args[2]);
+	}
+	if (nhogs > SL_MAXHOGS || nrounds == 0) {
+		kprintf("Usage: sl [nhogs (0-%u) [nrounds]]\n", SL_MAXHOGS);
+		return EINVAL;
+	}
+
+	sl_donesem = sem_create("schedtest", 0);
+	if (sl_donesem == NULL) {
+		panic("schedtest: sem_create failed\n");
+	}
+
+	kprintf("Starting scheduler latency test...\n");
+	kprintf("schedtest: a tick is %u us\n", 1000000 / HZ);
+
+	/* Stay on this cpu, with the hogs */
+	affinity = thread_getaffinity();
+	if (curcpu->c_number < 32) {
+		thread_setaffinity((uint32_t)1 << curcpu->c_number);
+	}
+
+	feedback = sched_feedback;
+	sl_run("baseline", 0, nrounds);
+	sched_feedback = false;
+	sl_run("round-robin", nhogs, nrounds);
+	sched_feedback = true;
+	sl_run("feedback", nhogs, nrounds);
+	sched_feedback = feedback;
+
+	thread_setaffinity(affinity);
+	sem_destroy(sl_donesem);
+	sl_donesem = NULL;
+
+	kprintf("Scheduler latency test done.\n");
+	return 0;
+}
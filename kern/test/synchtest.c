@@ -32,8 +32,11 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <clock.h>
+#include <cpu.h>
+#include <spinlock.h>
 #include <thread.h>
 #include <synch.h>
 #include <test.h>
@@ -399,3 +402,665 @@ cvtest2(int nargs, char **args)
 	kprintf("cvtest2 done\n");
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+// Timed waits
+
+#define TIMEOUT_MS 50
+#define TIMEOUT_STEP_MS 37	/* per thread; the last goes past 64 ticks */
+
+static struct semaphore *timedsem;
+static struct semaphore *timedgate;
+
+/*
+ * Milliseconds since TS0.
+ */
+static
+unsigned
+elapsed_ms(const struct timespec *ts0)
+{
+	struct timespec now, diff;
+
+	gettime(&now);
+	timespec_sub(&now, ts0, &diff);
+	return diff.tv_sec * 1000 + diff.tv_nsec / 1000000;
+}
+
+/*
+ * Check that a wait started at TS0 timed out, and not too early.
+ */
+static
+void
+checktimeout(const char *what, int result, unsigned ms,
+	     const struct timespec *ts0)
+{
+	unsigned took;
+
+	took = elapsed_ms(ts0);
+	if (result != ETIMEDOUT) {
+		panic("%s: got %d, expected ETIMEDOUT\n", what, result);
+	}
+	if (took < ms) {
+		panic("%s: timed out after %u ms, expected %u\n",
+		      what, took, ms);
+	}
+}
+
+/* Holds testlock until timedgate is raised. */
+static
+void
+lockholderthread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	lock_acquire(testlock);
+	V(donesem);
+	P(timedgate);
+	clocksleep_ticks(1);
+	lock_release(testlock);
+	V(donesem);
+}
+
+/* Signals testcv after a moment. */
+static
+void
+signalerthread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	clocksleep_ticks(2);
+	lock_acquire(testlock);
+	testval1 = 1;
+	cv_signal(testcv, testlock);
+	lock_release(testlock);
+	V(donesem);
+}
+
+/* Times out on timedsem, each thread after a different time. */
+static
+void
+timeoutthread(void *junk, unsigned long num)
+{
+	struct timespec ts0;
+	unsigned ms = (num + 1) * TIMEOUT_STEP_MS;
+
+	(void)junk;
+
+	gettime(&ts0);
+	checktimeout("P_timed (many)", P_timed(timedsem, ms), ms, &ts0);
+	V(donesem);
+}
+
+int
+timedtest(int nargs, char **args)
+{
+	struct timespec ts0;
+	unsigned i;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	timedsem = sem_create("timedsem", 0);
+	timedgate = sem_create("timedgate", 0);
+	if (timedsem == NULL || timedgate == NULL) {
+		panic("timedtest: sem_create failed\n");
+	}
+
+	kprintf("Starting timed wait test...\n");
+
+	gettime(&ts0);
+	clocksleep_ticks(clock_mstoticks(TIMEOUT_MS));
+	if (elapsed_ms(&ts0) < TIMEOUT_MS) {
+		panic("clocksleep_ticks: woke up too soon\n");
+	}
+
+	gettime(&ts0);
+	checktimeout("P_timed", P_timed(timedsem, TIMEOUT_MS),
+		     TIMEOUT_MS, &ts0);
+	V(timedsem);
+	if (P_timed(timedsem, TIMEOUT_MS) != 0) {
+		panic("P_timed: timed out with a count of 1\n");
+	}
+
+	result = thread_fork("timedtest", NULL, lockholderthread, NULL, 0);
+	if (result) {
+		panic("timedtest: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+	P(donesem);
+	gettime(&ts0);
+	checktimeout("lock_acquire_timed",
+		     lock_acquire_timed(testlock, TIMEOUT_MS),
+		     TIMEOUT_MS, &ts0);
+	V(timedgate);
+	if (lock_acquire_timed(testlock, 10000) != 0) {
+		panic("lock_acquire_timed: timed out on a released lock\n");
+	}
+	lock_release(testlock);
+	P(donesem);
+
+	lock_acquire(testlock);
+	gettime(&ts0);
+	checktimeout("cv_timedwait",
+		     cv_timedwait(testcv, testlock, TIMEOUT_MS),
+		     TIMEOUT_MS, &ts0);
+	testval1 = 0;
+	result = thread_fork("timedtest", NULL, signalerthread, NULL, 0);
+	if (result) {
+		panic("timedtest: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+	while (testval1 == 0) {
+		if (cv_timedwait(testcv, testlock, 10000) != 0) {
+			panic("cv_timedwait: missed the signal\n");
+		}
+	}
+	lock_release(testlock);
+	P(donesem);
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("timedtest", NULL, timeoutthread,
+				     NULL, i);
+		if (result) {
+			panic("timedtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+
+	sem_destroy(timedgate);
+	sem_destroy(timedsem);
+	timedgate = timedsem = NULL;
+
+	kprintf("Timed wait test done.\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Lock benchmark
+
+#define BENCH_THREADS	4
+#define BENCH_LOOPS	20000
+
+static struct lock *benchlock;
+static struct semaphore *benchgate;
+static volatile unsigned benchcount;
+
+/* Takes and drops benchlock NUM times. */
+static
+void
+benchthread(void *junk, unsigned long num)
+{
+	unsigned long i;
+
+	(void)junk;
+
+	P(benchgate);
+	for (i=0; i<num; i++) {
+		lock_acquire(benchlock);
+		benchcount++;
+		lock_release(benchlock);
+	}
+	V(donesem);
+}
+
+/*
+ * Run NTHREADS threads doing NLOOPS acquire/release pairs each, and
+ * print how long it took.
+ */
+static
+void
+benchrun(const char *what, unsigned nthreads, unsigned nloops)
+{
+	struct timespec ts0;
+	unsigned i, ms, total;
+	int result;
+
+	benchcount = 0;
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("lockbench", NULL, benchthread,
+				     NULL, nloops);
+		if (result) {
+			panic("lockbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	gettime(&ts0);
+	for (i=0; i<nthreads; i++) {
+		V(benchgate);
+	}
+	for (i=0; i<nthreads; i++) {
+		P(donesem);
+	}
+	ms = elapsed_ms(&ts0);
+
+	total = nthreads * nloops;
+	if (benchcount != total) {
+		panic("lockbench: count is %u, expected %u\n",
+		      benchcount, total);
+	}
+	kprintf("lockbench: %s: %u threads, %u pairs in %u ms",
+		what, nthreads, total, ms);
+	if (ms > 0) {
+		kprintf(" (%u per ms)", total / ms);
+	}
+	kprintf("\n");
+}
+
+/*
+ * Usage: sy6 [nthreads [nloops]]
+ *
+ * Measures lock_acquire/lock_release throughput with one thread (the
+ * fast path only) and with NTHREADS threads fighting over the lock,
+ * first sleeping as soon as the lock is held and then spinning while
+ * the holder runs. Run with more than one cpu to see the difference.
+ */
+int
+lockbench(int nargs, char **args)
+{
+	unsigned nthreads = BENCH_THREADS, nloops = BENCH_LOOPS;
+	unsigned spinmax;
+
+	if (nargs > 1) {
+		nthreads = atoi(args[1]);
+	}
+	if (nargs > 2) {
+		nloops = atoi(args[2]);
+	}
+	if (nthreads == 0 || nloops == 0) {
+		kprintf("Usage: sy6 [nthreads [nloops]]\n");
+		return EINVAL;
+	}
+
+	inititems();
+	benchlock = lock_create("benchlock");
+	benchgate = sem_create("benchgate", 0);
+	if (benchlock == NULL || benchgate == NULL) {
+		panic("lockbench: out of memory\n");
+	}
+
+	kprintf("Starting lock benchmark...\n");
+
+	spinmax = lock_spinmax;
+	benchrun("uncontended", 1, nloops);
+	lock_spinmax = 0;
+	benchrun("sleeping", nthreads, nloops);
+	lock_spinmax = spinmax;
+	benchrun("spinning", nthreads, nloops);
+
+	sem_destroy(benchgate);
+	lock_destroy(benchlock);
+	benchgate = NULL;
+	benchlock = NULL;
+
+	kprintf("Lock benchmark done.\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Reader-writer lock test
+
+#define RW_NVALS	16
+#define RW_READERS	24
+#define RW_WRITERS	8
+#define RW_LOOPS	60
+
+static struct rwlock *testrw;
+static struct spinlock rwcount_lock = SPINLOCK_INITIALIZER;
+static unsigned rwvals[RW_NVALS];
+static unsigned rwreaders_in, rwwriters_in, rwreaders_max;
+
+/*
+ * Note a thread going into (DELTA 1) or out of (DELTA -1) the lock,
+ * and check nobody else is in there who shouldn't be.
+ */
+static
+void
+rwcount(bool writer, int delta)
+{
+	spinlock_acquire(&rwcount_lock);
+	if (writer) {
+		rwwriters_in += delta;
+	}
+	else {
+		rwreaders_in += delta;
+		if (rwreaders_in > rwreaders_max) {
+			rwreaders_max = rwreaders_in;
+		}
+	}
+	if (rwwriters_in > 1 || (rwwriters_in > 0 && rwreaders_in > 0)) {
+		panic("rwtest: %u readers and %u writers in at once\n",
+		      rwreaders_in, rwwriters_in);
+	}
+	spinlock_release(&rwcount_lock);
+}
+
+/* Checks that rwvals are all the same; they're only ever changed whole. */
+static
+void
+rwcheck(void)
+{
+	unsigned i;
+
+	for (i=1; i<RW_NVALS; i++) {
+		if (rwvals[i] != rwvals[0]) {
+			panic("rwtest: value %u is %u, value 0 is %u\n",
+			      i, rwvals[i], rwvals[0]);
+		}
+	}
+}
+
+static
+void
+rwreaderthread(void *junk, unsigned long num)
+{
+	unsigned i;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<RW_LOOPS; i++) {
+		rw_enter_read(testrw);
+		rwcount(false, 1);
+		rwcheck();
+		/* Give other readers a chance to come in too */
+		thread_yield();
+		rwcheck();
+		rwcount(false, -1);
+		rw_exit_read(testrw);
+		thread_yield();
+	}
+	V(donesem);
+}
+
+static
+void
+rwwriterthread(void *junk, unsigned long num)
+{
+	unsigned i, j;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<RW_LOOPS; i++) {
+		rw_enter_write(testrw);
+		rwcount(true, 1);
+		rwcheck();
+		for (j=0; j<RW_NVALS; j++) {
+			rwvals[j]++;
+			if (j % 4 == 0) {
+				thread_yield();
+			}
+		}
+		if (i % 2 == 0) {
+			/* Readers may come in now, but not writers */
+			rwcount(true, -1);
+			rwcount(false, 1);
+			rw_downgrade(testrw);
+			thread_yield();
+			rwcheck();
+			rwcount(false, -1);
+			rw_exit_read(testrw);
+		}
+		else {
+			rwcount(true, -1);
+			rw_exit_write(testrw);
+		}
+		thread_yield();
+	}
+	V(donesem);
+}
+
+/* Waits to write; holds the lock until timedgate is raised. */
+static
+void
+rwblockedwriter(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	rw_enter_write(testrw);
+	P(timedgate);
+	rw_exit_write(testrw);
+	V(donesem);
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	unsigned i;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	testrw = rwlock_create("testrw");
+	timedgate = sem_create("timedgate", 0);
+	if (testrw == NULL || timedgate == NULL) {
+		panic("rwtest: out of memory\n");
+	}
+
+	kprintf("Starting rwlock test...\n");
+
+	/* The try variants, and downgrade, from one thread */
+	rw_enter_read(testrw);
+	if (!rw_tryenter_read(testrw)) {
+		panic("rwtest: second reader refused\n");
+	}
+	rw_exit_read(testrw);
+	if (rw_tryenter_write(testrw)) {
+		panic("rwtest: writer let in with a reader\n");
+	}
+	rw_exit_read(testrw);
+	if (!rw_tryenter_write(testrw)) {
+		panic("rwtest: writer refused an idle lock\n");
+	}
+	if (!rw_write_held(testrw)) {
+		panic("rwtest: rw_write_held false for the writer\n");
+	}
+	if (rw_tryenter_read(testrw)) {
+		panic("rwtest: reader let in with a writer\n");
+	}
+	rw_downgrade(testrw);
+	if (rw_write_held(testrw)) {
+		panic("rwtest: rw_write_held true after downgrade\n");
+	}
+	if (!rw_tryenter_read(testrw)) {
+		panic("rwtest: reader refused after downgrade\n");
+	}
+	rw_exit_read(testrw);
+	rw_exit_read(testrw);
+	kprintf("rwtest: try and downgrade ok\n");
+
+	/* A waiting writer keeps new readers out */
+	rw_enter_read(testrw);
+	result = thread_fork("rwtest", NULL, rwblockedwriter, NULL, 0);
+	if (result) {
+		panic("rwtest: thread_fork failed: %s\n", strerror(result));
+	}
+	while (testrw->rw_writewait == 0) {
+		thread_yield();
+	}
+	if (rw_tryenter_read(testrw)) {
+		panic("rwtest: reader let in ahead of a waiting writer\n");
+	}
+	rw_exit_read(testrw);
+	V(timedgate);
+	P(donesem);
+	if (!rw_tryenter_read(testrw)) {
+		panic("rwtest: reader refused after the writer left\n");
+	}
+	rw_exit_read(testrw);
+	kprintf("rwtest: writer preference ok\n");
+
+	/* Many readers and writers */
+	bzero(rwvals, sizeof(rwvals));
+	rwreaders_max = 0;
+	for (i=0; i<RW_READERS + RW_WRITERS; i++) {
+		result = thread_fork("rwtest", NULL,
+				     i < RW_READERS ?
+				     rwreaderthread : rwwriterthread,
+				     NULL, i);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<RW_READERS + RW_WRITERS; i++) {
+		P(donesem);
+	}
+	rwcheck();
+	if (rwvals[0] != RW_WRITERS * RW_LOOPS) {
+		panic("rwtest: %u writes, expected %u\n",
+		      rwvals[0], RW_WRITERS * RW_LOOPS);
+	}
+	kprintf("rwtest: up to %u readers at once\n", rwreaders_max);
+
+	sem_destroy(timedgate);
+	rwlock_destroy(testrw);
+	timedgate = NULL;
+	testrw = NULL;
+
+	kprintf("Rwlock test done.\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Spinlock benchmark
+
+#define SPINBENCH_TOTAL		100000
+#define SPINBENCH_MAXCPUS	32	/* as far as affinity masks go */
+
+static struct spinlock spinbench_lock;
+static volatile unsigned spinbench_count;
+static unsigned spinbench_total;
+static unsigned spinbench_got[SPINBENCH_MAXCPUS];
+
+/*
+ * Runs on cpu NUM, taking spinbench_lock over and over until all the
+ * cpus between them have taken it spinbench_total times. Counts how
+ * many of those it got.
+ */
+static
+void
+spinbenchthread(void *junk, unsigned long num)
+{
+	unsigned mine = 0;
+	bool done = false;
+
+	(void)junk;
+
+	thread_setaffinity((uint32_t)1 << num);
+	P(benchgate);
+	while (!done) {
+		spinlock_acquire(&spinbench_lock);
+		if (spinbench_count < spinbench_total) {
+			spinbench_count++;
+			mine++;
+		}
+		else {
+			done = true;
+		}
+		spinlock_release(&spinbench_lock);
+	}
+	spinbench_got[num] = mine;
+	V(donesem);
+}
+
+/*
+ * Run one spinbenchthread per cpu against spinbench_lock, which the
+ * caller has set up, and print how long it took and how evenly the
+ * lock was shared.
+ */
+static
+void
+spinbenchrun(const char *what, unsigned ncpus)
+{
+	struct timespec ts0;
+	unsigned i, ms, min, max;
+	int result;
+
+	spinbench_count = 0;
+	for (i=0; i<ncpus; i++) {
+		result = thread_fork("spinbench", NULL, spinbenchthread,
+				     NULL, i);
+		if (result) {
+			panic("spinbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	gettime(&ts0);
+	for (i=0; i<ncpus; i++) {
+		V(benchgate);
+	}
+	for (i=0; i<ncpus; i++) {
+		P(donesem);
+	}
+	ms = elapsed_ms(&ts0);
+	spinlock_cleanup(&spinbench_lock);
+
+	min = max = spinbench_got[0];
+	for (i=1; i<ncpus; i++) {
+		if (spinbench_got[i] < min) {
+			min = spinbench_got[i];
+		}
+		if (spinbench_got[i] > max) {
+			max = spinbench_got[i];
+		}
+	}
+	kprintf("spinbench: %s: %u acquires on %u cpus in %u ms; "
+		"per cpu, fewest %u, most %u\n",
+		what, spinbench_total, ncpus, ms, min, max);
+}
+
+/*
+ * Usage: sy8 [total]
+ *
+ * Has every cpu (up to 32) fight over one spinlock until it has been
+ * taken TOTAL times, first as a test-and-set lock and then as a
+ * ticket lock. Interesting with 4 or 8 cpus configured in sys161.conf.
+ */
+int
+spinbench(int nargs, char **args)
+{
+	unsigned ncpus;
+
+	spinbench_total = SPINBENCH_TOTAL;
+	if (nargs > 1) {
+		spinbench_total = atoi(args[1]);
+	}
+	if (spinbench_total == 0) {
+		kprintf("Usage: sy8 [total]\n");
+		return EINVAL;
+	}
+	ncpus = cpu_count();
+	if (ncpus > SPINBENCH_MAXCPUS) {
+		ncpus = SPINBENCH_MAXCPUS;
+	}
+
+	inititems();
+	benchgate = sem_create("benchgate", 0);
+	if (benchgate == NULL) {
+		panic("spinbench: sem_create failed\n");
+	}
+
+	kprintf("Starting spinlock benchmark...\n");
+
+	spinlock_init_tas(&spinbench_lock);
+	spinbenchrun("test-and-set", ncpus);
+	spinlock_init_ticket(&spinbench_lock);
+	spinbenchrun("ticket", ncpus);
+
+	sem_destroy(benchgate);
+	benchgate = NULL;
+
+	kprintf("Spinlock benchmark done.\n");
+	return 0;
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *        The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Workqueue test.
+ *
+ * Checks that queued work runs (once, however many times it's queued
+ * while pending), that flush waits for it, that cancel keeps pending
+ * work from running, and that delayed work waits.
+ */
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <thread.h>
+#include <current.h>
+#include <workqueue.h>
+#include <test.h>
+
+#define NITEMS 64
+#define DELAY_TICKS 5
+
+static struct work items[NITEMS];
+static unsigned runs[NITEMS];
+static struct spinlock runs_lock = SPINLOCK_INITIALIZER;
+static struct semaphore *blocksem;
+
+static
+void
+countwork(void *data)
+{
+	unsigned *counter = data;
+
+	spinlock_acquire(&runs_lock);
+	(*counter)++;
+	spinlock_release(&runs_lock);
+}
+
+/* Holds up its worker until blocksem is raised. */
+static
+void
+blockwork(void *data)
+{
+	(void)data;
+	P(blocksem);
+}
+
+static
+void
+checkruns(const char *what, unsigned expected)
+{
+	unsigned i;
+
+	for (i=0; i<NITEMS; i++) {
+		if (runs[i] != expected) {
+			panic("wqtest: %s: item %u ran %u times, expected %u\n",
+			      what, i, runs[i], expected);
+		}
+	}
+}
+
+int
+wqtest(int nargs, char **args)
+{
+	struct workqueue *wq;
+	struct work block;
+	struct delayed_work dw;
+	unsigned i, dwruns, start;
+	uint32_t affinity;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting workqueue test...\n");
+
+	wq = workqueue_create("wqtest");
+	if (wq == NULL) {
+		panic("wqtest: workqueue_create failed\n");
+	}
+	blocksem = sem_create("wqtest", 0);
+	if (blocksem == NULL) {
+		panic("wqtest: sem_create failed\n");
+	}
+
+	/*
+	 * Stay on one cpu, so everything goes to the worker that
+	 * blockwork holds up.
+	 */
+	affinity = thread_getaffinity();
+	if (curcpu->c_number < 32) {
+		thread_setaffinity((uint32_t)1 << curcpu->c_number);
+	}
+
+	/* Queue everything twice; the second time should be refused */
+	bzero(runs, sizeof(runs));
+	for (i=0; i<NITEMS; i++) {
+		work_init(&items[i], countwork, &runs[i]);
+	}
+	work_init(&block, blockwork, NULL);
+	workqueue_queue(wq, &block);
+	for (i=0; i<NITEMS; i++) {
+		if (!workqueue_queue(wq, &items[i])) {
+			panic("wqtest: idle item %u not queued\n", i);
+		}
+		if (workqueue_queue(wq, &items[i])) {
+			panic("wqtest: pending item %u queued twice\n", i);
+		}
+	}
+
+	/* Cancel the odd ones while the worker is held up */
+	for (i=1; i<NITEMS; i+=2) {
+		if (!work_cancel(&items[i])) {
+			panic("wqtest: pending item %u not cancelled\n", i);
+		}
+	}
+	V(blocksem);
+	workqueue_flush(wq);
+	for (i=0; i<NITEMS; i++) {
+		if (runs[i] != (i % 2 == 0 ? 1U : 0U)) {
+			panic("wqtest: item %u ran %u times after cancel\n",
+			      i, runs[i]);
+		}
+	}
+	kprintf("wqtest: queue, cancel and flush ok\n");
+	thread_setaffinity(affinity);
+
+	/* Again, with the worker running */
+	bzero(runs, sizeof(runs));
+	for (i=0; i<NITEMS; i++) {
+		workqueue_queue(wq, &items[i]);
+		if (i % 8 == 0) {
+			thread_yield();
+		}
+	}
+	workqueue_flush(wq);
+	checkruns("second round", 1);
+	kprintf("wqtest: second round ok\n");
+
+	/* Delayed work */
+	dwruns = 0;
+	delayed_work_init(&dw, countwork, &dwruns);
+	start = clock_ticks();
+	workqueue_queue_delayed(wq, &dw, DELAY_TICKS);
+	workqueue_flush(wq);
+	if (dwruns != 0 && (int)(clock_ticks() - start) < DELAY_TICKS) {
+		panic("wqtest: delayed work ran early\n");
+	}
+	clocksleep_ticks(DELAY_TICKS + 1);
+	workqueue_flush(wq);
+	if (dwruns != 1) {
+		panic("wqtest: delayed work ran %u times\n", dwruns);
+	}
+	workqueue_queue_delayed(wq, &dw, DELAY_TICKS);
+	if (!delayed_work_cancel(&dw)) {
+		panic("wqtest: waiting delayed work not cancelled\n");
+	}
+	clocksleep_ticks(DELAY_TICKS + 1);
+	workqueue_flush(wq);
+	if (dwruns != 1) {
+		panic("wqtest: cancelled delayed work ran\n");
+	}
+	kprintf("wqtest: delayed work ok\n");
+
+	sem_destroy(blocksem);
+	blocksem = NULL;
+	workqueue_destroy(wq);
+
+	kprintf("Workqueue test done.\n");
+	return 0;
+}
@@ -0,0 +1,355 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *        The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Callouts, kept in a hierarchical timer wheel on each cpu. See
+ * callout.h.
+ *
+ * The wheel has CALLOUT_LEVELS levels of CALLOUT_SLOTS slots. Level
+ * 0 has one slot for each of the next CALLOUT_SLOTS ticks; a slot at
+ * level n covers CALLOUT_SLOTS times as many ticks as one at level
+ * n-1. A callout goes in the lowest level that reaches as far as its
+ * expiry time. Each time level n-1 wraps around, the next slot of
+ * level n is emptied and its callouts put back in lower down
+ * ("cascaded"). So adding and removing a callout is constant time,
+ * and hardclock only looks at one slot per tick plus the occasional
+ * cascade.
+ *
+ * Time comes from clock_ticks() rather than c_hardclocks, because an
+ * idle cpu's timer may be stopped or stretched. hardclock catches up
+ * on every tick that has passed, and thread_timer uses
+ * callout_nextticks to make sure the timer goes off in time for the
+ * next callout (or cascade).
+ *
+ * callout_nextticks is called on every context switch, with the
+ * runqueue lock held, so it must not read the clock (which is a bus
+ * access). It measures from w_now instead, the tick as of the last
+ * time the wheel looked at the clock. While anything is pending
+ * hardclock updates that on every interrupt, so it is behind by no
+ * more than the current timer period, the same as the time slice
+ * accounting in thread_tick.
+ */
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <clock.h>
+#include <thread.h>
+#include <current.h>
+#include <callout.h>
+
+#define CALLOUT_BITS	6
+#define CALLOUT_SLOTS	(1U << CALLOUT_BITS)
+#define CALLOUT_MASK	(CALLOUT_SLOTS - 1)
+#define CALLOUT_LEVELS	4
+
+/* Keep expiry times where (int)(a - b) still works */
+#define CALLOUT_MAXTICKS 0x3fffffff
+
+struct callwheel {
+	struct spinlock w_lock;
+	unsigned w_next;		/* Next tick to process */
+	unsigned w_now;			/* clock_ticks() when last read */
+	unsigned w_count;		/* Number of pending callouts */
+	struct callout *w_running;	/* Callout being run, if any */
+	struct callout *w_slots[CALLOUT_LEVELS][CALLOUT_SLOTS];
+};
+
+void
+callout_init(struct callout *co, void (*func)(void *), void *arg)
+{
+	co->co_next = NULL;
+	co->co_prevp = NULL;
+	co->co_expire = 0;
+	co->co_func = func;
+	co->co_arg = arg;
+	co->co_cpu = NULL;
+}
+
+struct callwheel *
+callwheel_create(void)
+{
+	struct callwheel *w;
+
+	w = kmalloc(sizeof(*w));
+	if (w == NULL) {
+		return NULL;
+	}
+	bzero(w, sizeof(*w));
+	spinlock_init(&w->w_lock);
+	return w;
+}
+
+/*
+ * Put CO in the right slot of W for its expiry time. If it is
+ * already due (which happens when cascading) it goes in the slot
+ * about to be run.
+ */
+static
+void
+callout_insert(struct callwheel *w, struct callout *co)
+{
+	struct callout **head;
+	unsigned delta, level, slot;
+
+	KASSERT(spinlock_do_i_hold(&w->w_lock));
+
+	delta = co->co_expire - w->w_next;
+	if ((int)delta < 0) {
+		level = 0;
+		slot = w->w_next & CALLOUT_MASK;
+	}
+	else {
+		/* Anything beyond the top level goes around again */
+		for (level = 0; level < CALLOUT_LEVELS - 1; level++) {
+			if (delta < (1U << (CALLOUT_BITS * (level + 1)))) {
+				break;
+			}
+		}
+		slot = (co->co_expire >> (CALLOUT_BITS * level)) &
+			CALLOUT_MASK;
+	}
+
+	head = &w->w_slots[level][slot];
+	co->co_next = *head;
+	if (*head != NULL) {
+		(*head)->co_prevp = &co->co_next;
+	}
+	co->co_prevp = head;
+	*head = co;
+}
+
+/*
+ * Take CO, which is pending, out of W.
+ */
+static
+void
+callout_unlink(struct callwheel *w, struct callout *co)
+{
+	KASSERT(spinlock_do_i_hold(&w->w_lock));
+	KASSERT(co->co_prevp != NULL);
+
+	*co->co_prevp = co->co_next;
+	if (co->co_next != NULL) {
+		co->co_next->co_prevp = co->co_prevp;
+	}
+	co->co_next = NULL;
+	co->co_prevp = NULL;
+	KASSERT(w->w_count > 0);
+	w->w_count--;
+}
+
+/*
+ * If CO is pending, take it off whatever wheel it's on. Returns true
+ * if it was pending. If WAIT is set, also wait for its function to
+ * finish if it's running.
+ */
+static
+bool
+callout_remove(struct callout *co, bool wait)
+{
+	struct cpu *c;
+	struct callwheel *w;
+	bool ret = false;
+
+	c = co->co_cpu;
+	if (c == NULL) {
+		/* Never scheduled */
+		return false;
+	}
+	w = c->c_callwheel;
+
+	spinlock_acquire(&w->w_lock);
+	if (co->co_prevp != NULL) {
+		callout_unlink(w, co);
+		ret = true;
+	}
+	if (wait) {
+		/*
+		 * Callouts run with interrupts off, so if it's
+		 * running on this cpu we must be inside it.
+		 */
+		KASSERT(w->w_running != co || c != curcpu->c_self);
+		while (w->w_running == co) {
+			spinlock_release(&w->w_lock);
+			spinlock_acquire(&w->w_lock);
+		}
+	}
+	spinlock_release(&w->w_lock);
+	return ret;
+}
+
+void
+callout_schedule(struct callout *co, unsigned ticks)
+{
+	struct callwheel *w;
+	unsigned now;
+	int spl;
+
+	callout_remove(co, false);
+
+	if (ticks > CALLOUT_MAXTICKS) {
+		ticks = CALLOUT_MAXTICKS;
+	}
+
+	/* Stay on this cpu so its timer is the one we fix up below */
+	spl = splhigh();
+	w = curcpu->c_callwheel;
+
+	spinlock_acquire(&w->w_lock);
+	now = clock_ticks();
+	w->w_now = now;
+	if (w->w_count == 0) {
+		/* hardclock stops keeping track when there's nothing */
+		w->w_next = now;
+	}
+	co->co_expire = now + ticks + 1;
+	co->co_cpu = curcpu->c_self;
+	callout_insert(w, co);
+	w->w_count++;
+	spinlock_release(&w->w_lock);
+
+	/* The timer might be stretched or stopped; bring it in */
+	thread_timer();
+	splx(spl);
+}
+
+bool
+callout_stop(struct callout *co)
+{
+	return callout_remove(co, true);
+}
+
+/*
+ * Empty the slot of level LEVEL that comes due at w_next into the
+ * lower levels.
+ */
+static
+void
+callout_cascade(struct callwheel *w, unsigned level)
+{
+	struct callout *co, *next;
+	unsigned slot;
+
+	slot = (w->w_next >> (CALLOUT_BITS * level)) & CALLOUT_MASK;
+	co = w->w_slots[level][slot];
+	w->w_slots[level][slot] = NULL;
+	for (; co != NULL; co = next) {
+		next = co->co_next;
+		callout_insert(w, co);
+	}
+}
+
+/*
+ * Run everything in the level 0 slot for w_next. The wheel is
+ * unlocked while each function runs, so callouts can schedule and
+ * stop callouts (including themselves, for periodic ones).
+ */
+static
+void
+callout_runslot(struct callwheel *w)
+{
+	struct callout **head, *co;
+
+	head = &w->w_slots[0][w->w_next & CALLOUT_MASK];
+	while ((co = *head) != NULL) {
+		callout_unlink(w, co);
+		w->w_running = co;
+		spinlock_release(&w->w_lock);
+
+		co->co_func(co->co_arg);
+
+		spinlock_acquire(&w->w_lock);
+		w->w_running = NULL;
+	}
+}
+
+void
+callout_hardclock(void)
+{
+	struct callwheel *w = curcpu->c_callwheel;
+	unsigned now, level;
+
+	spinlock_acquire(&w->w_lock);
+	if (w->w_count == 0) {
+		/* Don't even look at the clock */
+		spinlock_release(&w->w_lock);
+		return;
+	}
+
+	now = clock_ticks();
+	w->w_now = now;
+	while (w->w_count > 0 && (int)(now - w->w_next) >= 0) {
+		/* Cascade each level that the one below just wrapped into */
+		for (level = 1; level < CALLOUT_LEVELS; level++) {
+			if (((w->w_next >> (CALLOUT_BITS * (level - 1))) &
+			     CALLOUT_MASK) != 0) {
+				break;
+			}
+			callout_cascade(w, level);
+		}
+		callout_runslot(w);
+		w->w_next++;
+	}
+	spinlock_release(&w->w_lock);
+}
+
+unsigned
+callout_nextticks(void)
+{
+	struct callwheel *w = curcpu->c_callwheel;
+	unsigned i, next;
+	int ticks;
+
+	spinlock_acquire(&w->w_lock);
+	if (w->w_count == 0) {
+		spinlock_release(&w->w_lock);
+		return 0;
+	}
+
+	/*
+	 * The first nonempty level 0 slot, unless the next cascade
+	 * (which might bring in something sooner) comes first.
+	 */
+	next = (w->w_next + CALLOUT_MASK) & ~CALLOUT_MASK;
+	for (i=0; i<CALLOUT_SLOTS; i++) {
+		if ((int)(w->w_next + i - next) >= 0) {
+			break;
+		}
+		if (w->w_slots[0][(w->w_next + i) & CALLOUT_MASK] != NULL) {
+			next = w->w_next + i;
+			break;
+		}
+	}
+	ticks = next - w->w_now;
+	spinlock_release(&w->w_lock);
+
+	return ticks > 0 ? ticks : 1;
+}
@@ -34,13 +34,15 @@
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
+#include <callout.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution than one second.
+ * Besides the once-a-second lbolt, callouts (callout.c) can be used
+ * to have things happen at specific points in the future, to the
+ * nearest hardclock tick; wchan_sleep_timed and the timed
+ * synchronization calls are built on them.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -59,6 +61,13 @@
 static struct wchan *lbolt;
 static struct spinlock lbolt_lock;
 
+/*
+ * Threads in clocksleep_ticks sleep here. Only their own timeouts
+ * wake them.
+ */
+static struct wchan *ticksleep;
+static struct spinlock ticksleep_lock;
+
 /*
  * Setup.
  */
@@ -70,6 +79,11 @@ hardclock_bootstrap(void)
 	if (lbolt == NULL) {
 		panic("Couldn't create lbolt\n");
 	}
+	spinlock_init(&ticksleep_lock);
+	ticksleep = wchan_create("ticksleep");
+	if (ticksleep == NULL) {
+		panic("Couldn't create ticksleep\n");
+	}
 }
 
 /*
@@ -86,24 +100,49 @@ timerclock(void)
 }
 
 /*
- * This is called HZ times a second (on each processor) by the timer
- * code.
+ * This is called by the timer code on each processor, HZ times a
+ * second while there's work to share out. If the timer was stretched
+ * (see thread_timer) this call stands for that many ticks. Idle
+ * processors skip everything, and thread_timer stops their timers.
  */
 void
 hardclock(void)
 {
+	unsigned then, ticks;
+
 	/*
 	 * Collect statistics here as desired.
 	 */
 
-	curcpu->c_hardclocks++;
-	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
-		thread_consider_migration();
+	/*
+	 * This undercounts if the timer was stretched and then
+	 * restarted early, but only by part of one time slice.
+	 */
+	ticks = curcpu->c_timerticks;
+	if (ticks == 0) {
+		ticks = 1;
 	}
-	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
-		schedule();
+	then = curcpu->c_hardclocks;
+	curcpu->c_hardclocks += ticks;
+
+	/* The timer code has restarted the timer for one period. */
+	curcpu->c_timerticks = 1;
+
+	/* Callouts run even on idle cpus */
+	callout_hardclock();
+
+	if (!curcpu->c_isidle) {
+		if (then / MIGRATE_HARDCLOCKS !=
+		    curcpu->c_hardclocks / MIGRATE_HARDCLOCKS) {
+			thread_consider_migration();
+		}
+		if (then / SCHEDULE_HARDCLOCKS !=
+		    curcpu->c_hardclocks / SCHEDULE_HARDCLOCKS) {
+			schedule();
+		}
+		thread_tick(ticks);
 	}
-	thread_yield();
+	thread_timer();
 }
 
 /*
@@ -119,3 +158,42 @@ clocksleep(int num_secs)
 	}
 	spinlock_release(&lbolt_lock);
 }
+
+/*
+ * Current time in ticks.
+ */
+unsigned
+clock_ticks(void)
+{
+	struct timespec ts;
+
+	gettime(&ts);
+	return (unsigned)ts.tv_sec * HZ + ts.tv_nsec / (1000000000 / HZ);
+}
+
+/*
+ * Convert milliseconds to ticks, rounding up.
+ */
+unsigned
+clock_mstoticks(unsigned ms)
+{
+	return ms / 1000 * HZ + DIVROUNDUP(ms % 1000 * HZ, 1000);
+}
+
+/*
+ * Suspend execution for at least NUM_TICKS ticks. The timed sleep
+ * already waits out the partial tick we start in, so reaching the
+ * deadline tick is enough; don't go around again for one more.
+ */
+void
+clocksleep_ticks(unsigned num_ticks)
+{
+	unsigned deadline, now;
+
+	deadline = clock_ticks() + num_ticks;
+	spinlock_acquire(&ticksleep_lock);
+	while ((int)(deadline - (now = clock_ticks())) > 0) {
+		wchan_sleep_timed(ticksleep, &ticksleep_lock, deadline - now);
+	}
+	spinlock_release(&ticksleep_lock);
+}
@@ -36,6 +36,7 @@
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <atomic.h>
 #include <membar.h>
 #include <current.h>	/* for curcpu */
 
@@ -51,10 +52,30 @@ void
 spinlock_init(struct spinlock *splk)
 {
 	spinlock_data_set(&splk->splk_lock, 0);
+	splk->splk_next = 0;
+	splk->splk_serving = 0;
 	splk->splk_holder = NULL;
+	splk->splk_ticket = SPINLOCK_TICKET_DEFAULT;
 	HANGMAN_LOCKABLEINIT(&splk->splk_hangman, "spinlock");
 }
 
+/*
+ * Initialize a spinlock of a particular kind.
+ */
+void
+spinlock_init_ticket(struct spinlock *splk)
+{
+	spinlock_init(splk);
+	splk->splk_ticket = true;
+}
+
+void
+spinlock_init_tas(struct spinlock *splk)
+{
+	spinlock_init(splk);
+	splk->splk_ticket = false;
+}
+
 /*
  * Clean up spinlock.
  */
@@ -63,6 +84,7 @@ spinlock_cleanup(struct spinlock *splk)
 {
 	KASSERT(splk->splk_holder == NULL);
 	KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
+	KASSERT(splk->splk_next == splk->splk_serving);
 }
 
 /*
@@ -76,6 +98,7 @@ void
 spinlock_acquire(struct spinlock *splk)
 {
 	struct cpu *mycpu;
+	unsigned ticket;
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -93,24 +116,40 @@ spinlock_acquire(struct spinlock *splk)
 		mycpu = NULL;
 	}
 
-	while (1) {
+	if (splk->splk_ticket) {
 		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
+		 * Ticket lock: take the next number, and wait for it
+		 * to come up. Only the holder changes splk_serving, so
+		 * waiters just read it, and the one atomic operation
+		 * per acquire is on splk_next.
 		 */
-		if (spinlock_data_get(&splk->splk_lock) != 0) {
-			continue;
+		ticket = atomic_fetchadd(&splk->splk_next, 1);
+		while (splk->splk_serving != ticket) {
+			/* spin */
 		}
-		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
-			continue;
+	}
+	else {
+		while (1) {
+			/*
+			 * Do test-test-and-set, that is, read first
+			 * before doing test-and-set, to reduce bus
+			 * contention.
+			 *
+			 * Test-and-set is a machine-level atomic
+			 * operation that writes 1 into the lock word and
+			 * returns the previous value. If that value was
+			 * 0, the lock was previously unheld and we now
+			 * own it. If it was 1, we don't.
+			 */
+			if (spinlock_data_get(&splk->splk_lock) != 0) {
+				continue;
+			}
+			if (spinlock_data_testandset(&splk->splk_lock)
+			    != 0) {
+				continue;
+			}
+			break;
 		}
-		break;
 	}
 
 	membar_store_any();
@@ -137,7 +176,13 @@ spinlock_release(struct spinlock *splk)
 
 	splk->splk_holder = NULL;
 	membar_any_store();
-	spinlock_data_set(&splk->splk_lock, 0);
+	if (splk->splk_ticket) {
+		/* Next! */
+		splk->splk_serving = splk->splk_serving + 1;
+	}
+	else {
+		spinlock_data_set(&splk->splk_lock, 0);
+	}
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
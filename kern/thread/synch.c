@@ -32,8 +32,15 @@
  * The specifications of the functions are in synch.h.
  */
 
+#define ATOMIC_INLINE	/* empty; build the out-of-line copy here */
+
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <atomic.h>
+#include <membar.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
@@ -120,6 +127,37 @@ P(struct semaphore *sem)
 	spinlock_release(&sem->sem_lock);
 }
 
+int
+P_timed(struct semaphore *sem, unsigned timeout_ms)
+{
+	unsigned deadline, now;
+	int result = 0;
+
+	KASSERT(sem != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	deadline = clock_ticks() + clock_mstoticks(timeout_ms);
+
+	spinlock_acquire(&sem->sem_lock);
+	while (sem->sem_count == 0) {
+		/* Sleep again after spurious wakeups, for the rest */
+		now = clock_ticks();
+		if ((int)(deadline - now) < 0) {
+			result = ETIMEDOUT;
+			break;
+		}
+		wchan_sleep_timed(sem->sem_wchan, &sem->sem_lock,
+				  deadline - now);
+	}
+	if (result == 0) {
+		KASSERT(sem->sem_count > 0);
+		sem->sem_count--;
+	}
+	spinlock_release(&sem->sem_lock);
+
+	return result;
+}
+
 void
 V(struct semaphore *sem)
 {
@@ -137,6 +175,57 @@ V(struct semaphore *sem)
 ////////////////////////////////////////////////////////////
 //
 // Lock.
+//
+// lk_owner holds the thread that has the lock, or 0 if it's free,
+// plus LOCK_WAITERS if anyone may be asleep on lk_wchan. Getting or
+// releasing a lock nobody else wants is one atomic_cas. A thread that
+// finds the lock held spins for a while if the holder is running on
+// another cpu, since it will likely let go sooner than it takes to
+// sleep and wake up; otherwise it sets LOCK_WAITERS and sleeps. It
+// does that holding lk_lock, and releasing a lock with LOCK_WAITERS
+// set takes lk_lock too, so no wakeup is lost.
+//
+// A thread that has slept sets LOCK_WAITERS again when it gets the
+// lock, in case others are still asleep. If they aren't, the next
+// release takes the slow path once for nothing.
+
+/* Set in lk_owner if threads may be asleep on the lock */
+#define LOCK_WAITERS	0x1U
+
+/* Tunable; see synch.h. */
+unsigned lock_spinmax = 1000;
+
+/* The lock word for the current thread, without LOCK_WAITERS. */
+static
+unsigned
+lock_self(void)
+{
+	return (unsigned)(uintptr_t)curthread;
+}
+
+/* The thread in lock word WORD. */
+static
+struct thread *
+lock_owner(unsigned word)
+{
+	return (struct thread *)(uintptr_t)(word & ~LOCK_WAITERS);
+}
+
+/*
+ * Is the holder in lock word WORD running right now? lk_cpu is where
+ * it was when it got the lock; if it isn't running there, it has
+ * slept or been preempted since, and waiters should sleep too. (Look
+ * at the cpu, which is never freed, and not at the thread, which
+ * might have exited.)
+ */
+static
+bool
+lock_owner_running(struct lock *lock, unsigned word)
+{
+	struct cpu *c = lock->lk_cpu;
+
+	return c != NULL && c->c_curthread == lock_owner(word);
+}
 
 struct lock *
 lock_create(const char *name)
@@ -163,7 +252,8 @@ lock_create(const char *name)
 		return NULL;
 	}
 	spinlock_init(&lock->lk_lock);
-	lock->lk_holder = NULL;
+	lock->lk_owner = 0;
+	lock->lk_cpu = NULL;
 
 	return lock;
 }
@@ -173,7 +263,7 @@ lock_destroy(struct lock *lock)
 {
 	KASSERT(lock != NULL);
 
-	KASSERT(lock->lk_holder == NULL);
+	KASSERT(lock->lk_owner == 0);
 	spinlock_cleanup(&lock->lk_lock);
 	wchan_destroy(lock->lk_wchan);
 
@@ -181,59 +271,139 @@ lock_destroy(struct lock *lock)
 	kfree(lock);
 }
 
+/*
+ * Slow path of lock_acquire: wait until the lock can be had, and take
+ * it. If TIMED, give up at DEADLINE (a clock_ticks() value) and
+ * return ETIMEDOUT.
+ */
+static
+int
+lock_wait(struct lock *lock, bool timed, unsigned deadline)
+{
+	unsigned word, extra, spins, now;
+
+	extra = 0;
+	spins = 0;
+	while (1) {
+		word = lock->lk_owner;
+		if (word == 0) {
+			if (atomic_cas(&lock->lk_owner, 0,
+				       lock_self() | extra) == 0) {
+				return 0;
+			}
+			continue;
+		}
+		if (spins < lock_spinmax && lock_owner_running(lock, word)) {
+			spins++;
+			continue;
+		}
+
+		spinlock_acquire(&lock->lk_lock);
+		word = lock->lk_owner;
+		if (word == 0 ||
+		    ((word & LOCK_WAITERS) == 0 &&
+		     atomic_cas(&lock->lk_owner, word,
+				word | LOCK_WAITERS) != word)) {
+			/* It changed; look again */
+			spinlock_release(&lock->lk_lock);
+			continue;
+		}
+		if (timed) {
+			now = clock_ticks();
+			if ((int)(deadline - now) < 0) {
+				spinlock_release(&lock->lk_lock);
+				return ETIMEDOUT;
+			}
+			wchan_sleep_timed(lock->lk_wchan, &lock->lk_lock,
+					  deadline - now);
+		}
+		else {
+			wchan_sleep(lock->lk_wchan, &lock->lk_lock);
+		}
+		spinlock_release(&lock->lk_lock);
+
+		extra = LOCK_WAITERS;
+		spins = 0;
+	}
+}
+
 void
 lock_acquire(struct lock *lock)
 {
 	DEBUGASSERT(lock != NULL);
 	KASSERT(curthread->t_in_interrupt == false);
 
-	spinlock_acquire(&lock->lk_lock);
-
-	/* Call this (atomically) before waiting for a lock */
+	/* Call this before waiting for a lock */
 	HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
 
-	KASSERT(lock->lk_holder != curthread);
-	while (lock->lk_holder != NULL) {
-		/* As in the semaphore. */
-		wchan_sleep(lock->lk_wchan, &lock->lk_lock);
+	KASSERT(lock_owner(lock->lk_owner) != curthread);
+	if (atomic_cas(&lock->lk_owner, 0, lock_self()) != 0) {
+		lock_wait(lock, false, 0);
 	}
-	lock->lk_holder = curthread;
+	membar_store_any();
+	lock->lk_cpu = curcpu->c_self;
 
-	/* Call this (atomically) once the lock is acquired */
+	/* Call this once the lock is acquired */
 	HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
+}
 
-	spinlock_release(&lock->lk_lock);
+int
+lock_acquire_timed(struct lock *lock, unsigned timeout_ms)
+{
+	int result;
+
+	DEBUGASSERT(lock != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
+
+	KASSERT(lock_owner(lock->lk_owner) != curthread);
+	if (atomic_cas(&lock->lk_owner, 0, lock_self()) != 0) {
+		result = lock_wait(lock, true,
+				   clock_ticks() + clock_mstoticks(timeout_ms));
+		if (result) {
+			HANGMAN_GIVEUP(&curthread->t_hangman,
+				       &lock->lk_hangman);
+			return result;
+		}
+	}
+	membar_store_any();
+	lock->lk_cpu = curcpu->c_self;
+
+	HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
+	return 0;
 }
 
 void
 lock_release(struct lock *lock)
 {
-	DEBUGASSERT(lock != NULL);
+	unsigned self = lock_self();
 
-	spinlock_acquire(&lock->lk_lock);
-
-	KASSERT(lock->lk_holder == curthread);
-	lock->lk_holder = NULL;
-	wchan_wakeone(lock->lk_wchan, &lock->lk_lock);
+	DEBUGASSERT(lock != NULL);
+	KASSERT(lock_owner(lock->lk_owner) == curthread);
 
-	/* Call this (atomically) when the lock is released */
+	/* Call this before the next holder can get the lock */
 	HANGMAN_RELEASE(&curthread->t_hangman, &lock->lk_hangman);
 
+	membar_any_store();
+	if (atomic_cas(&lock->lk_owner, self, 0) == self) {
+		return;
+	}
+
+	/* Someone may be asleep */
+	spinlock_acquire(&lock->lk_lock);
+	KASSERT(lock->lk_owner == (self | LOCK_WAITERS));
+	lock->lk_owner = 0;
+	wchan_wakeone(lock->lk_wchan, &lock->lk_lock);
 	spinlock_release(&lock->lk_lock);
 }
 
 bool
 lock_do_i_hold(struct lock *lock)
 {
-	bool ret;
-
 	DEBUGASSERT(lock != NULL);
 
-	spinlock_acquire(&lock->lk_lock);
-	ret = (lock->lk_holder == curthread);
-	spinlock_release(&lock->lk_lock);
-
-	return ret;
+	return lock_owner(lock->lk_owner) == curthread;
 }
 
 ////////////////////////////////////////////////////////////
@@ -298,6 +468,21 @@ cv_wait(struct cv *cv, struct lock *lock)
 	lock_acquire(lock);
 }
 
+int
+cv_timedwait(struct cv *cv, struct lock *lock, unsigned timeout_ms)
+{
+	int result;
+
+	spinlock_acquire(&cv->cv_wchanlock);
+	lock_release(lock);
+	result = wchan_sleep_timed(cv->cv_wchan, &cv->cv_wchanlock,
+				   clock_mstoticks(timeout_ms));
+	spinlock_release(&cv->cv_wchanlock);
+	lock_acquire(lock);
+
+	return result;
+}
+
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
@@ -315,3 +500,206 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 	wchan_wakeall(cv->cv_wchan, &cv->cv_wchanlock);
 	spinlock_release(&cv->cv_wchanlock);
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+//
+// Writers get preference: once a writer is waiting, new readers wait
+// behind it, so a steady stream of readers can't keep writers out.
+// When the last writer leaves, all the waiting readers go in at once.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+
+	rw = kmalloc(sizeof(*rw));
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->rw_name = kstrdup(name);
+	if (rw->rw_name == NULL) {
+		kfree(rw);
+		return NULL;
+	}
+
+	rw->rw_readwchan = wchan_create(rw->rw_name);
+	if (rw->rw_readwchan == NULL) {
+		kfree(rw->rw_name);
+		kfree(rw);
+		return NULL;
+	}
+	rw->rw_writewchan = wchan_create(rw->rw_name);
+	if (rw->rw_writewchan == NULL) {
+		wchan_destroy(rw->rw_readwchan);
+		kfree(rw->rw_name);
+		kfree(rw);
+		return NULL;
+	}
+
+	spinlock_init(&rw->rw_lock);
+	rw->rw_readers = 0;
+	rw->rw_writewait = 0;
+	rw->rw_writer = NULL;
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	KASSERT(rw->rw_readers == 0);
+	KASSERT(rw->rw_writewait == 0);
+	KASSERT(rw->rw_writer == NULL);
+	spinlock_cleanup(&rw->rw_lock);
+	wchan_destroy(rw->rw_writewchan);
+	wchan_destroy(rw->rw_readwchan);
+
+	kfree(rw->rw_name);
+	kfree(rw);
+}
+
+/*
+ * Can a reader get in right now? Not if there's a writer, or one
+ * waiting.
+ */
+static
+bool
+rw_canread(struct rwlock *rw)
+{
+	return rw->rw_writer == NULL && rw->rw_writewait == 0;
+}
+
+void
+rw_enter_read(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer != curthread);
+	while (!rw_canread(rw)) {
+		wchan_sleep(rw->rw_readwchan, &rw->rw_lock);
+	}
+	rw->rw_readers++;
+	spinlock_release(&rw->rw_lock);
+}
+
+bool
+rw_tryenter_read(struct rwlock *rw)
+{
+	bool ret = false;
+
+	DEBUGASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	if (rw_canread(rw)) {
+		rw->rw_readers++;
+		ret = true;
+	}
+	spinlock_release(&rw->rw_lock);
+	return ret;
+}
+
+void
+rw_exit_read(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_readers > 0);
+	rw->rw_readers--;
+	if (rw->rw_readers == 0 && rw->rw_writewait > 0) {
+		wchan_wakeone(rw->rw_writewchan, &rw->rw_lock);
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rw_enter_write(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer != curthread);
+	rw->rw_writewait++;
+	while (rw->rw_writer != NULL || rw->rw_readers > 0) {
+		wchan_sleep(rw->rw_writewchan, &rw->rw_lock);
+	}
+	rw->rw_writewait--;
+	rw->rw_writer = curthread;
+	spinlock_release(&rw->rw_lock);
+}
+
+bool
+rw_tryenter_write(struct rwlock *rw)
+{
+	bool ret = false;
+
+	DEBUGASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	if (rw->rw_writer == NULL && rw->rw_readers == 0) {
+		rw->rw_writer = curthread;
+		ret = true;
+	}
+	spinlock_release(&rw->rw_lock);
+	return ret;
+}
+
+/*
+ * Let the next lot in after a writer is done: another writer if one
+ * is waiting, and otherwise all the readers.
+ */
+static
+void
+rw_wakeup(struct rwlock *rw)
+{
+	KASSERT(spinlock_do_i_hold(&rw->rw_lock));
+
+	if (rw->rw_writewait > 0) {
+		if (rw->rw_readers == 0) {
+			wchan_wakeone(rw->rw_writewchan, &rw->rw_lock);
+		}
+	}
+	else {
+		wchan_wakeall(rw->rw_readwchan, &rw->rw_lock);
+	}
+}
+
+void
+rw_exit_write(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer == curthread);
+	rw->rw_writer = NULL;
+	rw_wakeup(rw);
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rw_downgrade(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer == curthread);
+	rw->rw_writer = NULL;
+	rw->rw_readers = 1;
+	rw_wakeup(rw);
+	spinlock_release(&rw->rw_lock);
+}
+
+bool
+rw_write_held(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+
+	return rw->rw_writer == curthread;
+}
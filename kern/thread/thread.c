@@ -50,11 +50,31 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <callout.h>
+#include <workqueue.h>
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
+/*
+ * Scheduler tuning. A thread at priority level L gets a time slice of
+ * t_slice << L hardclocks; t_slice starts out as SCHED_SLICE. Every
+ * SCHED_BOOST_HARDCLOCKS, each cpu moves all its ready threads back
+ * to level 0.
+ */
+#define SCHED_SLICE		1U
+#define SCHED_BOOST_HARDCLOCKS	100
+
+/* Tunable; see thread.h. */
+bool sched_feedback = true;
+
+/* Most threads an idle cpu takes from another cpu at once. */
+#define STEAL_MAX		4
+
+/* Most spare thread structures (with stacks) each cpu keeps. */
+#define THREAD_CACHE_MAX	8
+
 /* Wait channel. A wchan is protected by an associated, passed-in spinlock. */
 struct wchan {
 	const char *wc_name;		/* name for this channel */
@@ -69,6 +89,9 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/* Set up by cpu_create, for each cpu's c_exorcism. */
+static void exorcise_work(void *vc);
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -109,37 +132,48 @@ thread_checkstack(struct thread *thread)
 }
 
 /*
- * Create a thread. This is used both to create a first thread
- * for each CPU and to create subsequent forked threads.
+ * Set a thread's name. Names that fit go in t_namebuf, so reusing a
+ * cached thread usually doesn't need to allocate anything.
  */
 static
-struct thread *
-thread_create(const char *name)
+int
+thread_setname(struct thread *thread, const char *name)
 {
-	struct thread *thread;
-
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
-	if (thread == NULL) {
-		return NULL;
+	if (strlen(name) < sizeof(thread->t_namebuf)) {
+		strcpy(thread->t_namebuf, name);
+		thread->t_name = thread->t_namebuf;
 	}
-
-	thread->t_name = kstrdup(name);
-	if (thread->t_name == NULL) {
-		kfree(thread);
-		return NULL;
+	else {
+		thread->t_name = kstrdup(name);
+		if (thread->t_name == NULL) {
+			return ENOMEM;
+		}
 	}
+	return 0;
+}
+
+/*
+ * Initialize a thread's fields, other than its name and stack.
+ */
+static
+void
+thread_init(struct thread *thread)
+{
 	thread->t_wchan_name = "NEW";
 	thread->t_state = S_READY;
 
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
+	thread->t_prio = 0;
+	thread->t_ticks = 0;
+	thread->t_slice = SCHED_SLICE;
+	thread->t_affinity = THREAD_ANYCPU;
 	HANGMAN_ACTORINIT(&thread->t_hangman, thread->t_name);
 
 	/* Interrupt state fields */
@@ -148,10 +182,79 @@ thread_create(const char *name)
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
 	/* If you add to struct thread, be sure to initialize here */
+}
+
+/*
+ * Create a thread. This is used both to create a first thread
+ * for each CPU and to create subsequent forked threads that can't
+ * get one from the cache.
+ */
+static
+struct thread *
+thread_create(const char *name)
+{
+	struct thread *thread;
+
+	thread = kmalloc(sizeof(*thread));
+	if (thread == NULL) {
+		return NULL;
+	}
+
+	if (thread_setname(thread, name)) {
+		kfree(thread);
+		return NULL;
+	}
+	thread->t_stack = NULL;
+	thread_init(thread);
+
+	return thread;
+}
+
+/*
+ * The thread cache. Each cpu keeps up to THREAD_CACHE_MAX destroyed
+ * threads, stack included, for thread_fork to reuse, so that steady
+ * thread_fork/thread_exit traffic doesn't allocate. The stacks keep
+ * the guard band thread_checkstack_init put on them. Only the owning
+ * cpu touches its cache, so turning off interrupts is enough.
+ */
+
+/* Get a thread from the cache, or NULL if it's empty. */
+static
+struct thread *
+thread_cache_get(void)
+{
+	struct thread *thread;
+	int spl;
+
+	spl = splhigh();
+	thread = threadlist_remhead(&curcpu->c_threadcache);
+	splx(spl);
 
 	return thread;
 }
 
+/* Put a thread in the cache. Returns false if it's full. */
+static
+bool
+thread_cache_put(struct thread *thread)
+{
+	bool ok;
+	int spl;
+
+	KASSERT(thread->t_stack != NULL);
+	thread_checkstack(thread);
+
+	spl = splhigh();
+	ok = curcpu->c_threadcache.tl_count < THREAD_CACHE_MAX;
+	if (ok) {
+		threadlistnode_init(&thread->t_listnode, thread);
+		threadlist_addhead(&curcpu->c_threadcache, thread);
+	}
+	splx(spl);
+
+	return ok;
+}
+
 /*
  * Create a CPU structure. This is used for the bootup CPU and
  * also for secondary CPUs.
@@ -165,6 +268,7 @@ cpu_create(unsigned hardware_number)
 {
 	struct cpu *c;
 	int result;
+	unsigned i;
 	char namebuf[16];
 
 	c = kmalloc(sizeof(*c));
@@ -177,16 +281,28 @@ cpu_create(unsigned hardware_number)
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
+	work_init(&c->c_exorcism, exorcise_work, c);
+	threadlist_init(&c->c_threadcache);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	c->c_lastboost = 0;
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
-	spinlock_init(&c->c_runqueue_lock);
+	c->c_evict = false;
+	c->c_timerticks = 1;
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
+	/* Other cpus take these too (stealing, IPIs); keep it fair */
+	spinlock_init_ticket(&c->c_runqueue_lock);
+	c->c_callwheel = callwheel_create();
+	if (c->c_callwheel == NULL) {
+		panic("cpu_create: Out of memory\n");
+	}
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
-	spinlock_init(&c->c_ipi_lock);
+	spinlock_init_ticket(&c->c_ipi_lock);
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
 	if (result != 0) {
@@ -274,16 +390,25 @@ thread_destroy(struct thread *thread)
 
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
-	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
-	}
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
 
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
-	kfree(thread->t_name);
+	if (thread->t_name != thread->t_namebuf) {
+		kfree(thread->t_name);
+	}
+	thread->t_name = NULL;
+
+	/* Keep it around for thread_fork if there's room */
+	if (thread->t_stack != NULL && thread_cache_put(thread)) {
+		return;
+	}
+
+	if (thread->t_stack != NULL) {
+		kfree(thread->t_stack);
+	}
 	kfree(thread);
 }
 
@@ -306,6 +431,56 @@ exorcise(void)
 	}
 }
 
+/*
+ * Work function for cleaning up the zombies of cpu VC. It's queued
+ * from that cpu, but the worker that runs it may have moved, so it
+ * takes VC's list under VC's runqueue lock (which thread_switch holds
+ * when adding to it). Destroying them means freeing memory, so do
+ * it with interrupts on.
+ */
+static
+void
+exorcise_work(void *vc)
+{
+	struct cpu *c = vc;
+	struct threadlist zombies;
+	struct thread *z;
+
+	threadlist_init(&zombies);
+	spinlock_acquire(&c->c_runqueue_lock);
+	while ((z = threadlist_remhead(&c->c_zombies)) != NULL) {
+		threadlist_addtail(&zombies, z);
+	}
+	spinlock_release(&c->c_runqueue_lock);
+
+	while ((z = threadlist_remhead(&zombies)) != NULL) {
+		KASSERT(z != curthread);
+		KASSERT(z->t_state == S_ZOMBIE);
+		thread_destroy(z);
+	}
+	threadlist_cleanup(&zombies);
+}
+
+/*
+ * Called after each context switch, with interrupts off, to see that
+ * zombies get cleaned up: by the workqueue worker, so the switch
+ * doesn't have to pay for it, or right away if there are no workers
+ * yet.
+ */
+static
+void
+thread_reap(void)
+{
+	if (threadlist_isempty(&curcpu->c_zombies)) {
+		return;
+	}
+	if (system_workqueue == NULL) {
+		exorcise();
+		return;
+	}
+	workqueue_queue(system_workqueue, &curcpu->c_exorcism);
+}
+
 /*
  * On panic, stop the thread system (as much as is reasonably
  * possible) to make sure we don't end up letting any other threads
@@ -314,6 +489,9 @@ exorcise(void)
 void
 thread_panic(void)
 {
+	struct threadlist *tl;
+	unsigned i;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -328,9 +506,12 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = &curcpu->c_runqueue.tl_tail;
-	curcpu->c_runqueue.tl_tail.tln_prev = &curcpu->c_runqueue.tl_head;
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		tl = &curcpu->c_runqueue[i];
+		tl->tl_count = 0;
+		tl->tl_head.tln_next = &tl->tl_tail;
+		tl->tl_tail.tln_prev = &tl->tl_head;
+	}
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -420,6 +601,12 @@ cpu_hatch(unsigned software_number)
 	thread_exit();
 }
 
+unsigned
+cpu_count(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
 /*
  * Start up secondary cpus. Called from boot().
  */
@@ -442,6 +629,310 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Run queue operations. The caller must hold the cpu's runqueue lock.
+ */
+
+/* Number of threads ready to run on C. */
+static
+unsigned
+runqueue_count(struct cpu *c)
+{
+	unsigned i, count;
+
+	count = 0;
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		count += c->c_runqueue[i].tl_count;
+	}
+	return count;
+}
+
+/* Is any thread ready on C at priority level PRIO or better? */
+static
+bool
+runqueue_waiting(struct cpu *c, unsigned prio)
+{
+	unsigned i;
+
+	for (i=0; i<=prio && i<SCHED_NLEVELS; i++) {
+		if (!threadlist_isempty(&c->c_runqueue[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* May thread T run on cpu C? */
+static
+bool
+thread_allowed(struct thread *t, struct cpu *c)
+{
+	return c->c_number < 32 &&
+		(t->t_affinity & ((uint32_t)1 << c->c_number)) != 0;
+}
+
+/* Queue T on C, behind the other threads at its priority. */
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+	KASSERT(t->t_prio < SCHED_NLEVELS);
+	threadlist_addtail(&c->c_runqueue[t->t_prio], t);
+	if (!thread_allowed(t, c)) {
+		/* Have thread_evict move it once it's safe to */
+		c->c_evict = true;
+	}
+	if (c->c_timerticks > 1) {
+		/*
+		 * The cpu's timer is stretched because it had nothing
+		 * else to run. Get it ticking again. (For another cpu,
+		 * the IPI handler calls thread_timer.)
+		 */
+		if (c == curcpu->c_self) {
+			c->c_timerticks = 1;
+			mainbus_timer_set(1);
+		}
+		else {
+			ipi_send(c, IPI_UNIDLE);
+		}
+	}
+}
+
+/* Take the next thread to run off C, or NULL if there are none. */
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+	struct thread *t;
+	unsigned i;
+
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		t = threadlist_remhead(&c->c_runqueue[i]);
+		if (t != NULL) {
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Take the next thread to run on C off it, passing over threads whose
+ * affinity doesn't allow C (thread_evict will move them). If those
+ * are all there is, take the first of them anyway rather than idle:
+ * it may be the thread whose stack we're on.
+ */
+static
+struct thread *
+runqueue_remnext(struct cpu *c)
+{
+	struct threadlist *tl;
+	struct threadlistnode *tln;
+	unsigned i;
+
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		tl = &c->c_runqueue[i];
+		for (tln = tl->tl_head.tln_next; tln->tln_self != NULL;
+		     tln = tln->tln_next) {
+			if (thread_allowed(tln->tln_self, c)) {
+				threadlist_remove(tl, tln->tln_self);
+				return tln->tln_self;
+			}
+		}
+	}
+	return runqueue_remhead(c);
+}
+
+/* Take the last thread that would run off C, or NULL if there are none. */
+static
+struct thread *
+runqueue_remtail(struct cpu *c)
+{
+	struct thread *t;
+	unsigned i;
+
+	for (i=SCHED_NLEVELS; i-- > 0; ) {
+		t = threadlist_remtail(&c->c_runqueue[i]);
+		if (t != NULL) {
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Program the current cpu's timer; see thread_timer. The caller must
+ * hold the runqueue lock, so that runqueue_add sees whether the timer
+ * is stretched.
+ */
+static
+void
+thread_timer_locked(void)
+{
+	struct thread *cur = curthread;
+	unsigned ticks, slice, next;
+
+	KASSERT(spinlock_do_i_hold(&curcpu->c_runqueue_lock));
+
+	if (curcpu->c_isidle) {
+		/* Nothing to do until a thread arrives, with an IPI */
+		ticks = 0;
+	}
+	else if (runqueue_count(curcpu) > 0) {
+		ticks = 1;
+	}
+	else {
+		/* Nobody to preempt for; wait out the slice */
+		slice = cur->t_slice << cur->t_prio;
+		ticks = cur->t_ticks < slice ? slice - cur->t_ticks : 1;
+	}
+
+	/* Don't sleep through the next callout */
+	next = callout_nextticks();
+	if (next > 0 && (ticks == 0 || next < ticks)) {
+		ticks = next;
+	}
+
+	/*
+	 * Only reprogram if it changes; otherwise frequent context
+	 * switches could keep pushing the next tick back.
+	 */
+	if (ticks != curcpu->c_timerticks) {
+		curcpu->c_timerticks = ticks;
+		mainbus_timer_set(ticks);
+	}
+}
+
+/*
+ * Choose a cpu for thread T that its affinity allows: the one with the
+ * fewest ready threads. The counts are peeked at without locking, so
+ * this is only a good guess.
+ */
+static
+struct cpu *
+thread_pickcpu(struct thread *t)
+{
+	struct cpu *c, *best;
+	unsigned i, count, bestcount, numcpus;
+
+	best = NULL;
+	bestcount = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (!thread_allowed(t, c)) {
+			continue;
+		}
+		count = runqueue_count(c);
+		if (best == NULL || count < bestcount) {
+			best = c;
+			bestcount = count;
+		}
+	}
+	KASSERT(best != NULL);
+	return best;
+}
+
+/*
+ * Work stealing. Called by an idle cpu, from the idle loop in
+ * thread_switch, with interrupts off and no runqueue locks held.
+ *
+ * Picks the cpu with the most ready threads and moves up to half of
+ * them (but no more than STEAL_MAX) from the tail of its run queue,
+ * which is the work it would get to last, onto ours. Threads whose
+ * affinity doesn't allow this cpu are skipped. Returns the number of
+ * threads taken.
+ *
+ * To avoid deadlock between two cpus stealing from each other, when
+ * two runqueue locks are held the lower-numbered cpu's is taken
+ * first.
+ */
+static
+unsigned
+thread_steal(void)
+{
+	struct cpu *c, *victim, *first, *second;
+	struct thread *t, *prev;
+	struct threadlist *tl;
+	unsigned i, count, best, numcpus, want, level;
+
+	/*
+	 * Find the busiest other cpu. Peek at the counts without
+	 * locking; this is only a hint and is rechecked below.
+	 */
+	victim = NULL;
+	best = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self) {
+			continue;
+		}
+		count = runqueue_count(c);
+		if (count > best) {
+			best = count;
+			victim = c;
+		}
+	}
+	if (victim == NULL) {
+		return 0;
+	}
+
+	if (victim->c_number < curcpu->c_number) {
+		first = victim;
+		second = curcpu->c_self;
+	}
+	else {
+		first = curcpu->c_self;
+		second = victim;
+	}
+	spinlock_acquire(&first->c_runqueue_lock);
+	spinlock_acquire(&second->c_runqueue_lock);
+
+	/*
+	 * An idle cpu is about to run what it has; leave it alone.
+	 * Also, if we got work of our own meanwhile, go run it.
+	 */
+	count = runqueue_count(victim);
+	if (victim->c_isidle || runqueue_count(curcpu) > 0) {
+		count = 0;
+	}
+	want = DIVROUNDUP(count, 2);
+	if (want > STEAL_MAX) {
+		want = STEAL_MAX;
+	}
+
+	count = 0;
+	for (level = SCHED_NLEVELS; level-- > 0 && count < want; ) {
+		tl = &victim->c_runqueue[level];
+		t = tl->tl_tail.tln_prev->tln_self;
+		while (t != NULL && count < want) {
+			prev = t->t_listnode.tln_prev->tln_self;
+			/*
+			 * The victim's curthread can be on its run
+			 * queue; see thread_consider_migration. Never
+			 * take it. Also leave threads that aren't
+			 * allowed to run here.
+			 */
+			if (t != victim->c_curthread &&
+			    thread_allowed(t, curcpu)) {
+				threadlist_remove(tl, t);
+				t->t_cpu = curcpu->c_self;
+				runqueue_add(curcpu, t);
+				DEBUG(DB_THREADS,
+				      "Stole thread %s: cpu %u -> %u",
+				      t->t_name, victim->c_number,
+				      curcpu->c_number);
+				count++;
+			}
+			t = prev;
+		}
+	}
+
+	spinlock_release(&second->c_runqueue_lock);
+	spinlock_release(&first->c_runqueue_lock);
+	return count;
+}
+
 /*
  * Make a thread runnable.
  *
@@ -462,11 +953,24 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 	else {
 		spinlock_acquire(&targetcpu->c_runqueue_lock);
+		/*
+		 * If the thread may not run on its cpu, send it to one
+		 * where it may -- unless that cpu is still idling on
+		 * the thread's stack, in which case thread_evict will
+		 * move it later.
+		 */
+		if (!thread_allowed(target, targetcpu) &&
+		    targetcpu->c_curthread != target) {
+			spinlock_release(&targetcpu->c_runqueue_lock);
+			targetcpu = thread_pickcpu(target);
+			target->t_cpu = targetcpu;
+			spinlock_acquire(&targetcpu->c_runqueue_lock);
+		}
 	}
 
 	/* Target thread is now ready to run; put it on the run queue. */
 	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	runqueue_add(targetcpu, target);
 
 	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
 		/*
@@ -481,6 +985,49 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 }
 
+/*
+ * Move ready threads whose affinity doesn't allow the current cpu to
+ * cpus where they may run. Threads get onto the wrong run queue when
+ * they change affinity while running, and they can't be moved until
+ * they've been switched out, so this is called from the tail of
+ * thread_switch (and thread_startup) when c_evict is set.
+ */
+static
+void
+thread_evict(void)
+{
+	struct threadlist evicted;
+	struct threadlist *tl;
+	struct thread *t;
+	unsigned i, n;
+
+	threadlist_init(&evicted);
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	curcpu->c_evict = false;
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		tl = &curcpu->c_runqueue[i];
+		for (n = tl->tl_count; n > 0; n--) {
+			t = threadlist_remhead(tl);
+			if (t == curthread || thread_allowed(t, curcpu)) {
+				threadlist_addtail(tl, t);
+			}
+			else {
+				threadlist_addtail(&evicted, t);
+			}
+		}
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	while ((t = threadlist_remhead(&evicted)) != NULL) {
+		t->t_cpu = thread_pickcpu(t);
+		DEBUG(DB_THREADS, "Evicted thread %s: cpu %u -> %u",
+		      t->t_name, curcpu->c_number, t->t_cpu->c_number);
+		thread_make_runnable(t, false);
+	}
+	threadlist_cleanup(&evicted);
+}
+
 /*
  * Create a new thread based on an existing one.
  *
@@ -500,25 +1047,42 @@ thread_fork(const char *name,
 	struct thread *newthread;
 	int result;
 
-	newthread = thread_create(name);
-	if (newthread == NULL) {
-		return ENOMEM;
+	newthread = thread_cache_get();
+	if (newthread != NULL) {
+		/* Comes with a stack, guard band and all */
+		if (thread_setname(newthread, name)) {
+			kfree(newthread->t_stack);
+			kfree(newthread);
+			return ENOMEM;
+		}
+		thread_init(newthread);
 	}
+	else {
+		newthread = thread_create(name);
+		if (newthread == NULL) {
+			return ENOMEM;
+		}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+		/* Allocate a stack */
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
+		thread_checkstack_init(newthread);
 	}
-	thread_checkstack_init(newthread);
 
 	/*
 	 * Now we clone various fields from the parent thread.
 	 */
 
 	/* Thread subsystem fields */
+	newthread->t_slice = curthread->t_slice;
+	newthread->t_affinity = curthread->t_affinity;
 	newthread->t_cpu = curthread->t_cpu;
+	if (!thread_allowed(newthread, newthread->t_cpu)) {
+		newthread->t_cpu = thread_pickcpu(newthread);
+	}
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -587,8 +1151,14 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	/*
+	 * Micro-optimization: if nothing to do, just return. A
+	 * yielding thread only gives way to threads at its own
+	 * priority or better. One that may not run here anymore has
+	 * to be queued, so thread_evict can move it.
+	 */
+	if (newstate == S_READY && thread_allowed(cur, curcpu->c_self) &&
+	    !runqueue_waiting(curcpu, cur->t_prio)) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -603,6 +1173,14 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		break;
 	    case S_SLEEP:
 		cur->t_wchan_name = wc->wc_name;
+		/*
+		 * Blocking before the time slice is up is what
+		 * I/O-bound threads do; move up a level.
+		 */
+		if (cur->t_prio > 0) {
+			cur->t_prio--;
+		}
+		cur->t_ticks = 0;
 		/*
 		 * Add the thread to the list in the wait channel, and
 		 * unlock same. To avoid a race with someone else
@@ -641,10 +1219,14 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = runqueue_remnext(curcpu);
 		if (next == NULL) {
+			/* Turn the timer off while we have nothing to do */
+			thread_timer_locked();
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			if (thread_steal() == 0) {
+				cpu_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -714,6 +1296,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	cur->t_wchan_name = NULL;
 	cur->t_state = S_RUN;
 
+	/* Set the timer for the thread now running. */
+	thread_timer_locked();
+
 	/* Unlock the run queue. */
 	spinlock_release(&curcpu->c_runqueue_lock);
 
@@ -721,7 +1306,12 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	as_activate();
 
 	/* Clean up dead threads. */
-	exorcise();
+	thread_reap();
+
+	/* Move threads that may not run here. */
+	if (curcpu->c_evict) {
+		thread_evict();
+	}
 
 	/* Turn interrupts back on. */
 	splx(spl);
@@ -747,6 +1337,9 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	cur->t_wchan_name = NULL;
 	cur->t_state = S_RUN;
 
+	/* Set the timer for the new thread. */
+	thread_timer_locked();
+
 	/* Release the runqueue lock acquired in thread_switch. */
 	spinlock_release(&curcpu->c_runqueue_lock);
 
@@ -754,7 +1347,12 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	as_activate();
 
 	/* Clean up dead threads. */
-	exorcise();
+	thread_reap();
+
+	/* Move threads that may not run here. */
+	if (curcpu->c_evict) {
+		thread_evict();
+	}
 
 	/* Enable interrupts. */
 	spl0();
@@ -771,7 +1369,7 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
  *
  * The parts of the thread structure we don't actually need to run
  * should be cleaned up right away. The rest has to wait until
- * thread_destroy is called from exorcise().
+ * thread_destroy is called from exorcise() or exorcise_work().
  *
  * Does not return.
  */
@@ -809,22 +1407,202 @@ thread_yield(void)
 	thread_switch(S_READY, NULL, NULL);
 }
 
+/*
+ * Entry point for the thread thread_setaffinity leaves behind: there
+ * is nothing for it to do but exist long enough to be switched to.
+ */
+static
+void
+thread_affinity_standin(void *junk1, unsigned long junk2)
+{
+	(void)junk1;
+	(void)junk2;
+}
+
+/*
+ * Set the current thread's cpu affinity. If we may no longer run on
+ * this cpu, yield so that thread_evict can move us. That needs the
+ * cpu to switch to some other thread first (we can't be moved while
+ * it's on our stack), so fork one here, under the old mask, to make
+ * sure there is one. Someone else could take it first, so repeat
+ * until we've moved.
+ */
+int
+thread_setaffinity(uint32_t mask)
+{
+	unsigned i, numcpus;
+	uint32_t present, oldmask;
+	int result;
+
+	present = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus && i<32; i++) {
+		present |= (uint32_t)1 << i;
+	}
+	if ((mask & present) == 0) {
+		return EINVAL;
+	}
+
+	oldmask = curthread->t_affinity;
+	curthread->t_affinity = mask;
+	while (!thread_allowed(curthread, curcpu->c_self)) {
+		curthread->t_affinity = oldmask;
+		result = thread_fork("affinity", kproc,
+				     thread_affinity_standin, NULL, 0);
+		if (result) {
+			return result;
+		}
+		curthread->t_affinity = mask;
+		thread_yield();
+	}
+	return 0;
+}
+
+uint32_t
+thread_getaffinity(void)
+{
+	return curthread->t_affinity;
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * This is a multi-level feedback queue. Each cpu has one run queue
+ * per priority level (c_runqueue[]), and always runs the first thread
+ * of the best nonempty level. Threads within a level go round-robin.
+ *
+ *    - New threads start at level 0, the best.
+ *    - A thread that uses up its whole time slice drops one level;
+ *      slices get longer as the level gets worse, so compute-bound
+ *      threads switch less often.
+ *    - A thread that blocks (which is what I/O-bound and interactive
+ *      threads do) moves up one level.
+ *    - A thread is preempted as soon as a better-level thread is
+ *      ready, at the next tick.
+ *    - Periodically schedule() moves everything back to level 0, so
+ *      compute-bound threads can't be starved forever and threads
+ *      that change behavior get reclassified.
+ *
+ * Note that thread_yield() only gives way to threads at the same or a
+ * better level.
+ *
+ * The timer only ticks when there's something to decide. An idle cpu
+ * turns it off, and a cpu with only one thread to run sets it for the
+ * end of that thread's slice; queueing another thread on the cpu
+ * (runqueue_add) gets it ticking every hardclock again. See
+ * thread_timer_locked.
  */
 
+/*
+ * Called from hardclock() on every tick.
+ */
 void
-schedule(void)
+thread_tick(unsigned ticks)
 {
+	struct thread *cur;
+	bool expired, preempt;
+
 	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
+	 * If we're idle, curthread is whatever last ran; don't charge
+	 * it for anything.
 	 */
+	if (curcpu->c_isidle) {
+		return;
+	}
+
+	cur = curthread;
+	cur->t_ticks += ticks;
+	expired = cur->t_ticks >= (cur->t_slice << cur->t_prio);
+	if (expired) {
+		cur->t_ticks = 0;
+		if (sched_feedback && cur->t_prio < SCHED_NLEVELS - 1) {
+			cur->t_prio++;
+		}
+		/* Let the others at this level (if any) have a turn. */
+		preempt = true;
+	}
+	else if (cur->t_prio == 0) {
+		preempt = false;
+	}
+	else {
+		spinlock_acquire(&curcpu->c_runqueue_lock);
+		preempt = runqueue_waiting(curcpu, cur->t_prio - 1);
+		spinlock_release(&curcpu->c_runqueue_lock);
+	}
+
+	if (preempt) {
+		thread_switch(S_READY, NULL, NULL);
+	}
+}
+
+/*
+ * Called from hardclock() after its other work, and when another cpu
+ * asks with IPI_UNIDLE, to set when the next tick comes.
+ */
+void
+thread_timer(void)
+{
+	int spl;
+
+	spl = splhigh();
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	thread_timer_locked();
+	spinlock_release(&curcpu->c_runqueue_lock);
+	splx(spl);
+}
+
+/*
+ * Set the current thread's base time slice.
+ */
+int
+thread_setslice(unsigned slice)
+{
+	if (slice < 1 || slice > THREAD_MAXSLICE) {
+		return EINVAL;
+	}
+	curthread->t_slice = slice;
+	return 0;
+}
+
+unsigned
+thread_getslice(void)
+{
+	return curthread->t_slice;
+}
+
+/*
+ * This is called periodically from hardclock(). It does the priority
+ * boost once every SCHED_BOOST_HARDCLOCKS.
+ */
+void
+schedule(void)
+{
+	struct thread *t;
+	unsigned i;
+
+	if (curcpu->c_hardclocks - curcpu->c_lastboost <
+	    SCHED_BOOST_HARDCLOCKS) {
+		return;
+	}
+	curcpu->c_lastboost = curcpu->c_hardclocks;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (i=1; i<SCHED_NLEVELS; i++) {
+		while ((t = threadlist_remhead(&curcpu->c_runqueue[i]))
+		       != NULL) {
+			t->t_prio = 0;
+			t->t_ticks = 0;
+			threadlist_addtail(&curcpu->c_runqueue[0], t);
+		}
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	if (!curcpu->c_isidle) {
+		curthread->t_prio = 0;
+		curthread->t_ticks = 0;
+	}
 }
 
 /*
@@ -843,12 +1621,15 @@ schedule(void)
  * For here and now, because we know we're running on System/161 and
  * System/161 does not (yet) model such cache effects, we'll be very
  * aggressive.
+ *
+ * This only pushes work outward; CPUs that go idle in between also
+ * pull work for themselves with thread_steal().
  */
 void
 thread_consider_migration(void)
 {
 	unsigned my_count, total_count, one_share, to_send;
-	unsigned i, numcpus;
+	unsigned i, n, numcpus;
 	struct cpu *c;
 	struct threadlist victims;
 	struct thread *t;
@@ -858,9 +1639,9 @@ thread_consider_migration(void)
 	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
 		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
+		total_count += runqueue_count(c);
 		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+			my_count = runqueue_count(c);
 		}
 		spinlock_release(&c->c_runqueue_lock);
 	}
@@ -874,7 +1655,12 @@ thread_consider_migration(void)
 	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
+		/* Send the threads that would otherwise run last */
+		t = runqueue_remtail(curcpu);
+		if (t == NULL) {
+			to_send = i;
+			break;
+		}
 		threadlist_addhead(&victims, t);
 	}
 	spinlock_release(&curcpu->c_runqueue_lock);
@@ -885,7 +1671,9 @@ thread_consider_migration(void)
 			continue;
 		}
 		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
+		n = victims.tl_count;
+		while (n-- > 0 && runqueue_count(c) < one_share &&
+		       to_send > 0) {
 			t = threadlist_remhead(&victims);
 			/*
 			 * Ordinarily, curthread will not appear on
@@ -914,9 +1702,14 @@ thread_consider_migration(void)
 				to_send--;
 				continue;
 			}
+			/* Don't send threads where they may not run */
+			if (!thread_allowed(t, c)) {
+				threadlist_addtail(&victims, t);
+				continue;
+			}
 
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			runqueue_add(c, t);
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -940,7 +1733,7 @@ thread_consider_migration(void)
 	if (!threadlist_isempty(&victims)) {
 		spinlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+			runqueue_add(curcpu, t);
 		}
 		spinlock_release(&curcpu->c_runqueue_lock);
 	}
@@ -1012,6 +1805,69 @@ wchan_sleep(struct wchan *wc, struct spinlock *lk)
 	spinlock_acquire(lk);
 }
 
+/*
+ * State for a timed sleep, shared with the callout that ends it.
+ */
+struct wchan_timeout {
+	struct callout wt_callout;
+	struct wchan *wt_wchan;
+	struct spinlock *wt_lock;
+	struct thread *wt_thread;
+	bool wt_timedout;
+};
+
+/*
+ * Callout for wchan_sleep_timed: if the thread is still asleep, wake
+ * it up and say so.
+ */
+static
+void
+wchan_timeout(void *data)
+{
+	struct wchan_timeout *wt = data;
+	struct thread *t;
+
+	spinlock_acquire(wt->wt_lock);
+	THREADLIST_FORALL(t, wt->wt_wchan->wc_threads) {
+		if (t == wt->wt_thread) {
+			threadlist_remove(&wt->wt_wchan->wc_threads, t);
+			wt->wt_timedout = true;
+			thread_make_runnable(t, false);
+			break;
+		}
+	}
+	spinlock_release(wt->wt_lock);
+}
+
+/*
+ * Like wchan_sleep, but also wake up once TICKS ticks have passed
+ * (see callout_schedule). Returns ETIMEDOUT if that's what happened
+ * and 0 otherwise.
+ */
+int
+wchan_sleep_timed(struct wchan *wc, struct spinlock *lk, unsigned ticks)
+{
+	struct wchan_timeout wt;
+
+	KASSERT(!curthread->t_in_interrupt);
+	KASSERT(spinlock_do_i_hold(lk));
+	KASSERT(curcpu->c_spinlocks == 1);
+
+	callout_init(&wt.wt_callout, wchan_timeout, &wt);
+	wt.wt_wchan = wc;
+	wt.wt_lock = lk;
+	wt.wt_thread = curthread;
+	wt.wt_timedout = false;
+	callout_schedule(&wt.wt_callout, ticks);
+
+	thread_switch(S_SLEEP, wc, lk);
+
+	/* Without LK, since the callout takes it */
+	callout_stop(&wt.wt_callout);
+	spinlock_acquire(lk);
+	return wt.wt_timedout ? ETIMEDOUT : 0;
+}
+
 /*
  * Wake up one thread sleeping on a wait channel.
  */
@@ -1192,7 +2048,8 @@ interprocessor_interrupt(void)
 	if (bits & (1U << IPI_UNIDLE)) {
 		/*
 		 * The cpu has already unidled itself to take the
-		 * interrupt; don't need to do anything else.
+		 * interrupt. If it's running a thread with its timer
+		 * stretched, the timer is reset below.
 		 */
 	}
 	if (bits & (1U << IPI_TLBSHOOTDOWN)) {
@@ -1209,4 +2066,9 @@ interprocessor_interrupt(void)
 
 	curcpu->c_ipi_pending = 0;
 	spinlock_release(&curcpu->c_ipi_lock);
+
+	/* The runqueue lock comes before the IPI lock; do this after. */
+	if (bits & (1U << IPI_UNIDLE)) {
+		thread_timer();
+	}
 }
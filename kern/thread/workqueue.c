@@ -0,0 +1,411 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *        The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Workqueues. See workqueue.h.
+ *
+ * Each cpu has its own list of pending work and its own worker
+ * thread, which is pinned to that cpu with its affinity mask, so work
+ * runs where it was queued. (Cpus past the 32 an affinity mask can
+ * name get a worker that runs anywhere.)
+ *
+ * One spinlock per workqueue covers all the lists and the state of
+ * the items on them. An item can be queued from any cpu, so its
+ * pending flag needs a lock that doesn't depend on which list it's
+ * on; the critical sections are only a few pointer updates.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <synch.h>
+#include <thread.h>
+#include <current.h>
+#include <workqueue.h>
+
+/*
+ * One cpu's part of a workqueue.
+ */
+struct workcpu {
+	struct work *wc_head;		/* Pending work, oldest first */
+	struct work *wc_tail;
+	struct work *wc_running;	/* Work being run, if any */
+	unsigned wc_queued;		/* Items ever queued here */
+	unsigned wc_done;		/* ...and run or cancelled */
+	struct wchan *wc_wchan;		/* Worker waits here for work */
+	struct wchan *wc_donewchan;	/* Flush and cancel wait here */
+	struct thread *wc_worker;
+};
+
+struct workqueue {
+	char *wq_name;
+	struct spinlock wq_lock;
+	bool wq_exit;			/* Workers should exit */
+	unsigned wq_ncpus;
+	struct workcpu *wq_cpus;	/* One per cpu */
+	struct semaphore *wq_exitsem;	/* Workers V when exiting */
+};
+
+struct workqueue *system_workqueue;
+
+void
+work_init(struct work *wk, void (*func)(void *), void *data)
+{
+	wk->wk_next = NULL;
+	wk->wk_prev = NULL;
+	wk->wk_func = func;
+	wk->wk_data = data;
+	wk->wk_wq = NULL;
+	wk->wk_cpu = 0;
+	wk->wk_pending = false;
+}
+
+/*
+ * Add WK at the end of WC's list.
+ */
+static
+void
+workcpu_add(struct workcpu *wc, struct work *wk)
+{
+	wk->wk_next = NULL;
+	wk->wk_prev = wc->wc_tail;
+	if (wc->wc_tail != NULL) {
+		wc->wc_tail->wk_next = wk;
+	}
+	else {
+		wc->wc_head = wk;
+	}
+	wc->wc_tail = wk;
+	wc->wc_queued++;
+}
+
+/*
+ * Take WK off WC's list.
+ */
+static
+void
+workcpu_remove(struct workcpu *wc, struct work *wk)
+{
+	if (wk->wk_prev != NULL) {
+		wk->wk_prev->wk_next = wk->wk_next;
+	}
+	else {
+		KASSERT(wc->wc_head == wk);
+		wc->wc_head = wk->wk_next;
+	}
+	if (wk->wk_next != NULL) {
+		wk->wk_next->wk_prev = wk->wk_prev;
+	}
+	else {
+		KASSERT(wc->wc_tail == wk);
+		wc->wc_tail = wk->wk_prev;
+	}
+	wk->wk_next = NULL;
+	wk->wk_prev = NULL;
+}
+
+/*
+ * A worker thread. DATA2 is the cpu number.
+ */
+static
+void
+workqueue_worker(void *data1, unsigned long data2)
+{
+	struct workqueue *wq = data1;
+	struct workcpu *wc = &wq->wq_cpus[data2];
+	struct work *wk;
+
+	if (data2 < 32) {
+		thread_setaffinity((uint32_t)1 << data2);
+	}
+
+	spinlock_acquire(&wq->wq_lock);
+	wc->wc_worker = curthread;
+	while (1) {
+		wk = wc->wc_head;
+		if (wk == NULL) {
+			if (wq->wq_exit) {
+				break;
+			}
+			wchan_sleep(wc->wc_wchan, &wq->wq_lock);
+			continue;
+		}
+		workcpu_remove(wc, wk);
+		wk->wk_pending = false;
+		wc->wc_running = wk;
+		spinlock_release(&wq->wq_lock);
+
+		wk->wk_func(wk->wk_data);
+		/* WK may be gone now; only compare against it */
+
+		spinlock_acquire(&wq->wq_lock);
+		wc->wc_running = NULL;
+		wc->wc_done++;
+		wchan_wakeall(wc->wc_donewchan, &wq->wq_lock);
+	}
+	wc->wc_worker = NULL;
+	spinlock_release(&wq->wq_lock);
+
+	V(wq->wq_exitsem);
+}
+
+/*
+ * Tell the workers to finish up and wait for NWORKERS of them to
+ * exit, then free WQ.
+ */
+static
+void
+workqueue_teardown(struct workqueue *wq, unsigned nworkers)
+{
+	unsigned i;
+
+	spinlock_acquire(&wq->wq_lock);
+	wq->wq_exit = true;
+	for (i=0; i<wq->wq_ncpus; i++) {
+		if (wq->wq_cpus[i].wc_wchan != NULL) {
+			wchan_wakeall(wq->wq_cpus[i].wc_wchan, &wq->wq_lock);
+		}
+	}
+	spinlock_release(&wq->wq_lock);
+
+	for (i=0; i<nworkers; i++) {
+		P(wq->wq_exitsem);
+	}
+
+	for (i=0; i<wq->wq_ncpus; i++) {
+		KASSERT(wq->wq_cpus[i].wc_head == NULL);
+		if (wq->wq_cpus[i].wc_wchan != NULL) {
+			wchan_destroy(wq->wq_cpus[i].wc_wchan);
+		}
+		if (wq->wq_cpus[i].wc_donewchan != NULL) {
+			wchan_destroy(wq->wq_cpus[i].wc_donewchan);
+		}
+	}
+	sem_destroy(wq->wq_exitsem);
+	spinlock_cleanup(&wq->wq_lock);
+	kfree(wq->wq_cpus);
+	kfree(wq->wq_name);
+	kfree(wq);
+}
+
+struct workqueue *
+workqueue_create(const char *name)
+{
+	struct workqueue *wq;
+	struct workcpu *wc;
+	char namebuf[32];
+	unsigned i;
+	int result;
+
+	wq = kmalloc(sizeof(*wq));
+	if (wq == NULL) {
+		return NULL;
+	}
+	wq->wq_name = kstrdup(name);
+	if (wq->wq_name == NULL) {
+		kfree(wq);
+		return NULL;
+	}
+	wq->wq_ncpus = cpu_count();
+	wq->wq_cpus = kmalloc(wq->wq_ncpus * sizeof(*wq->wq_cpus));
+	if (wq->wq_cpus == NULL) {
+		kfree(wq->wq_name);
+		kfree(wq);
+		return NULL;
+	}
+	bzero(wq->wq_cpus, wq->wq_ncpus * sizeof(*wq->wq_cpus));
+	wq->wq_exitsem = sem_create(name, 0);
+	if (wq->wq_exitsem == NULL) {
+		kfree(wq->wq_cpus);
+		kfree(wq->wq_name);
+		kfree(wq);
+		return NULL;
+	}
+	spinlock_init(&wq->wq_lock);
+	wq->wq_exit = false;
+
+	for (i=0; i<wq->wq_ncpus; i++) {
+		wc = &wq->wq_cpus[i];
+		wc->wc_wchan = wchan_create(wq->wq_name);
+		wc->wc_donewchan = wchan_create(wq->wq_name);
+		if (wc->wc_wchan == NULL || wc->wc_donewchan == NULL) {
+			workqueue_teardown(wq, i);
+			return NULL;
+		}
+		snprintf(namebuf, sizeof(namebuf), "%s/%u", name, i);
+		result = thread_fork(namebuf, NULL, workqueue_worker, wq, i);
+		if (result) {
+			workqueue_teardown(wq, i);
+			return NULL;
+		}
+	}
+	return wq;
+}
+
+void
+workqueue_destroy(struct workqueue *wq)
+{
+	/* Workers run what's left before they notice wq_exit */
+	workqueue_teardown(wq, wq->wq_ncpus);
+}
+
+bool
+workqueue_queue(struct workqueue *wq, struct work *wk)
+{
+	struct workcpu *wc;
+	unsigned cpu;
+	bool ret = false;
+	int spl;
+
+	/* Stay put while choosing the list */
+	spl = splhigh();
+	cpu = curcpu->c_number % wq->wq_ncpus;
+	wc = &wq->wq_cpus[cpu];
+
+	spinlock_acquire(&wq->wq_lock);
+	KASSERT(!wq->wq_exit);
+	if (!wk->wk_pending) {
+		KASSERT(wk->wk_wq == NULL || wk->wk_wq == wq);
+		wk->wk_wq = wq;
+		wk->wk_cpu = cpu;
+		wk->wk_pending = true;
+		workcpu_add(wc, wk);
+		wchan_wakeone(wc->wc_wchan, &wq->wq_lock);
+		ret = true;
+	}
+	spinlock_release(&wq->wq_lock);
+
+	splx(spl);
+	return ret;
+}
+
+/*
+ * Callout for delayed work: queue it on this cpu.
+ */
+static
+void
+delayed_work_timeout(void *data)
+{
+	struct delayed_work *dw = data;
+
+	workqueue_queue(dw->dw_wq, &dw->dw_work);
+}
+
+void
+delayed_work_init(struct delayed_work *dw, void (*func)(void *), void *data)
+{
+	work_init(&dw->dw_work, func, data);
+	callout_init(&dw->dw_callout, delayed_work_timeout, dw);
+	dw->dw_wq = NULL;
+}
+
+void
+workqueue_queue_delayed(struct workqueue *wq, struct delayed_work *dw,
+			unsigned ticks)
+{
+	dw->dw_wq = wq;
+	callout_schedule(&dw->dw_callout, ticks);
+}
+
+void
+workqueue_flush(struct workqueue *wq)
+{
+	struct workcpu *wc;
+	unsigned i, target;
+
+	spinlock_acquire(&wq->wq_lock);
+	for (i=0; i<wq->wq_ncpus; i++) {
+		wc = &wq->wq_cpus[i];
+		KASSERT(wc->wc_worker != curthread);
+		target = wc->wc_queued;
+		while ((int)(wc->wc_done - target) < 0) {
+			wchan_sleep(wc->wc_donewchan, &wq->wq_lock);
+		}
+	}
+	spinlock_release(&wq->wq_lock);
+}
+
+bool
+work_cancel(struct work *wk)
+{
+	struct workqueue *wq = wk->wk_wq;
+	struct workcpu *wc;
+	bool ret = false;
+	unsigned i;
+
+	if (wq == NULL) {
+		/* Never queued */
+		return false;
+	}
+
+	spinlock_acquire(&wq->wq_lock);
+	if (wk->wk_pending) {
+		wc = &wq->wq_cpus[wk->wk_cpu];
+		workcpu_remove(wc, wk);
+		wk->wk_pending = false;
+		/* Count it as done, for anyone flushing */
+		wc->wc_done++;
+		wchan_wakeall(wc->wc_donewchan, &wq->wq_lock);
+		ret = true;
+	}
+	for (i=0; i<wq->wq_ncpus; i++) {
+		wc = &wq->wq_cpus[i];
+		while (wc->wc_running == wk) {
+			KASSERT(wc->wc_worker != curthread);
+			wchan_sleep(wc->wc_donewchan, &wq->wq_lock);
+		}
+	}
+	spinlock_release(&wq->wq_lock);
+	return ret;
+}
+
+bool
+delayed_work_cancel(struct delayed_work *dw)
+{
+	bool ret;
+
+	/* Stop the callout first, since it queues the work */
+	ret = callout_stop(&dw->dw_callout);
+	if (work_cancel(&dw->dw_work)) {
+		ret = true;
+	}
+	return ret;
+}
+
+void
+workqueue_bootstrap(void)
+{
+	system_workqueue = workqueue_create("kworker");
+	if (system_workqueue == NULL) {
+		panic("Could not create system workqueue\n");
+	}
+}
@@ -38,10 +38,12 @@
 #include <kern/fcntl.h>
 #include <stat.h>
 #include <lib.h>
+#include <clock.h>
 #include <uio.h>
 #include <synch.h>
 #include <vnode.h>
 #include <device.h>
+#include <iostat.h>
 
 /*
  * Called for each open().
@@ -101,6 +103,23 @@ dev_tryseek(struct device *d, off_t pos)
 	return 0;
 }
 
+/*
+ * Do I/O, keeping statistics. Also used by filesystems; see device.h.
+ */
+int
+dev_io(struct device *d, struct uio *uio)
+{
+	struct timespec start;
+	size_t resid = uio->uio_resid;
+	int result;
+
+	iostat_begin(d, &start);
+	result = DEVOP_IO(d, uio);
+	iostat_end(d, &start, uio->uio_rw == UIO_WRITE,
+		   resid - uio->uio_resid, result);
+	return result;
+}
+
 /*
  * Called for read. Hand off to DEVOP_IO.
  */
@@ -117,7 +136,7 @@ dev_read(struct vnode *v, struct uio *uio)
 	}
 
 	KASSERT(uio->uio_rw == UIO_READ);
-	return DEVOP_IO(d, uio);
+	return dev_io(d, uio);
 }
 
 /*
@@ -136,7 +155,7 @@ dev_write(struct vnode *v, struct uio *uio)
 	}
 
 	KASSERT(uio->uio_rw == UIO_WRITE);
-	return DEVOP_IO(d, uio);
+	return dev_io(d, uio);
 }
 
 /*
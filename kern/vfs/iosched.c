@@ -0,0 +1,348 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *        The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * I/O scheduler for block device drivers. See iosched.h.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <iosched.h>
+
+/* Tunables; see iosched.h. */
+unsigned iosched_read_expire = 500;
+unsigned iosched_write_expire = 5000;
+
+/*
+ * A policy is just a way of picking a request out of the queue.
+ */
+struct iosched_policy {
+	const char *ip_name;
+	struct iosched_req *(*ip_choose)(struct iosched *is);
+};
+
+/*
+ * Registry of devices, so their policies can be found by name. Only
+ * a handful of disks ever exist, so a small table does.
+ */
+#define IOSCHED_MAXDEVS 16
+static struct iosched *iosched_devs[IOSCHED_MAXDEVS];
+static struct spinlock iosched_devlock = SPINLOCK_INITIALIZER;
+
+////////////////////////////////////////////////////////////
+// Policies
+
+/*
+ * FIFO: the oldest request.
+ */
+static
+struct iosched_req *
+iosched_fifo_choose(struct iosched *is)
+{
+	return is->is_head;
+}
+
+/*
+ * C-LOOK: the lowest-numbered request at or after the head position;
+ * if there isn't one, the lowest-numbered request. Among requests
+ * for the same sector, the oldest.
+ */
+static
+struct iosched_req *
+iosched_clook_choose(struct iosched *is)
+{
+	struct iosched_req *ir, *ahead = NULL, *lowest = NULL;
+
+	for (ir = is->is_head; ir != NULL; ir = ir->ir_next) {
+		if (ir->ir_sector >= is->is_pos &&
+		    (ahead == NULL || ir->ir_sector < ahead->ir_sector)) {
+			ahead = ir;
+		}
+		if (lowest == NULL || ir->ir_sector < lowest->ir_sector) {
+			lowest = ir;
+		}
+	}
+	return ahead != NULL ? ahead : lowest;
+}
+
+/*
+ * Deadline: the request whose deadline is earliest, if that has
+ * passed; otherwise the C-LOOK choice. (Reads and writes have
+ * different deadlines, so the oldest request isn't necessarily the
+ * most overdue.)
+ */
+static
+struct iosched_req *
+iosched_deadline_choose(struct iosched *is)
+{
+	struct iosched_req *ir, *first = NULL;
+	struct timespec now;
+
+	for (ir = is->is_head; ir != NULL; ir = ir->ir_next) {
+		if (first == NULL ||
+		    ir->ir_deadline.tv_sec < first->ir_deadline.tv_sec ||
+		    (ir->ir_deadline.tv_sec == first->ir_deadline.tv_sec &&
+		     ir->ir_deadline.tv_nsec < first->ir_deadline.tv_nsec)) {
+			first = ir;
+		}
+	}
+	if (first == NULL) {
+		return NULL;
+	}
+
+	gettime(&now);
+	if (first->ir_deadline.tv_sec < now.tv_sec ||
+	    (first->ir_deadline.tv_sec == now.tv_sec &&
+	     first->ir_deadline.tv_nsec <= now.tv_nsec)) {
+		return first;
+	}
+	return iosched_clook_choose(is);
+}
+
+static const struct iosched_policy iosched_policies[] = {
+	{ "fifo",	iosched_fifo_choose },
+	{ "clook",	iosched_clook_choose },
+	{ "deadline",	iosched_deadline_choose },
+	{ NULL, NULL },
+};
+
+/* Policy for new devices */
+#define IOSCHED_DEFAULT (&iosched_policies[2])
+
+////////////////////////////////////////////////////////////
+// Queue operations
+
+struct iosched *
+iosched_create(const char *devname, struct spinlock *lock)
+{
+	struct iosched *is;
+	unsigned i;
+
+	is = kmalloc(sizeof(*is));
+	if (is == NULL) {
+		return NULL;
+	}
+	is->is_name = kstrdup(devname);
+	if (is->is_name == NULL) {
+		kfree(is);
+		return NULL;
+	}
+	is->is_policy = IOSCHED_DEFAULT;
+	is->is_lock = lock;
+	is->is_head = is->is_tail = NULL;
+	is->is_count = 0;
+	is->is_pos = 0;
+
+	spinlock_acquire(&iosched_devlock);
+	for (i=0; i<IOSCHED_MAXDEVS; i++) {
+		if (iosched_devs[i] == NULL) {
+			iosched_devs[i] = is;
+			break;
+		}
+	}
+	spinlock_release(&iosched_devlock);
+	if (i == IOSCHED_MAXDEVS) {
+		/* Still works; the policy just can't be changed */
+		kprintf("iosched: %s: too many devices\n", devname);
+	}
+
+	return is;
+}
+
+void
+iosched_destroy(struct iosched *is)
+{
+	unsigned i;
+
+	KASSERT(is->is_count == 0);
+
+	spinlock_acquire(&iosched_devlock);
+	for (i=0; i<IOSCHED_MAXDEVS; i++) {
+		if (iosched_devs[i] == is) {
+			iosched_devs[i] = NULL;
+			break;
+		}
+	}
+	spinlock_release(&iosched_devlock);
+
+	kfree(is->is_name);
+	kfree(is);
+}
+
+void
+iosched_add(struct iosched *is, struct iosched_req *ir)
+{
+	struct timespec expire;
+	unsigned ms;
+
+	KASSERT(spinlock_do_i_hold(is->is_lock));
+
+	ms = ir->ir_write ? iosched_write_expire : iosched_read_expire;
+	expire.tv_sec = ms / 1000;
+	expire.tv_nsec = (ms % 1000) * 1000000;
+	gettime(&ir->ir_deadline);
+	timespec_add(&ir->ir_deadline, &expire, &ir->ir_deadline);
+
+	ir->ir_next = NULL;
+	ir->ir_prev = is->is_tail;
+	if (is->is_tail == NULL) {
+		is->is_head = ir;
+	}
+	else {
+		is->is_tail->ir_next = ir;
+	}
+	is->is_tail = ir;
+	is->is_count++;
+}
+
+struct iosched_req *
+iosched_next(struct iosched *is)
+{
+	struct iosched_req *ir;
+
+	KASSERT(spinlock_do_i_hold(is->is_lock));
+
+	ir = is->is_policy->ip_choose(is);
+	if (ir == NULL) {
+		return NULL;
+	}
+
+	/* Unlink it */
+	if (ir->ir_prev == NULL) {
+		is->is_head = ir->ir_next;
+	}
+	else {
+		ir->ir_prev->ir_next = ir->ir_next;
+	}
+	if (ir->ir_next == NULL) {
+		is->is_tail = ir->ir_prev;
+	}
+	else {
+		ir->ir_next->ir_prev = ir->ir_prev;
+	}
+	ir->ir_next = ir->ir_prev = NULL;
+	KASSERT(is->is_count > 0);
+	is->is_count--;
+
+	/* This is where the head will be when it's done */
+	is->is_pos = ir->ir_sector + ir->ir_nsect;
+	return ir;
+}
+
+void
+iosched_requeue(struct iosched *is, struct iosched_req *ir)
+{
+	KASSERT(spinlock_do_i_hold(is->is_lock));
+	KASSERT(ir->ir_nsect > 0);
+
+	/* At the head, so under fifo it's still next. */
+	ir->ir_prev = NULL;
+	ir->ir_next = is->is_head;
+	if (is->is_head == NULL) {
+		is->is_tail = ir;
+	}
+	else {
+		is->is_head->ir_prev = ir;
+	}
+	is->is_head = ir;
+	is->is_count++;
+
+	is->is_pos = ir->ir_sector;
+}
+
+bool
+iosched_isempty(struct iosched *is)
+{
+	KASSERT(spinlock_do_i_hold(is->is_lock));
+	return is->is_head == NULL;
+}
+
+////////////////////////////////////////////////////////////
+// Policy selection
+
+int
+iosched_setpolicy(const char *devname, const char *policy)
+{
+	const struct iosched_policy *ip;
+	struct iosched *is;
+	unsigned i;
+
+	for (ip = iosched_policies; ip->ip_name != NULL; ip++) {
+		if (!strcmp(ip->ip_name, policy)) {
+			break;
+		}
+	}
+	if (ip->ip_name == NULL) {
+		return EINVAL;
+	}
+
+	spinlock_acquire(&iosched_devlock);
+	for (i=0; i<IOSCHED_MAXDEVS; i++) {
+		is = iosched_devs[i];
+		if (is != NULL && !strcmp(is->is_name, devname)) {
+			spinlock_acquire(is->is_lock);
+			is->is_policy = ip;
+			spinlock_release(is->is_lock);
+			break;
+		}
+	}
+	spinlock_release(&iosched_devlock);
+
+	return i < IOSCHED_MAXDEVS ? 0 : ENODEV;
+}
+
+void
+iosched_print(void)
+{
+	const struct iosched_policy *ip;
+	unsigned i;
+
+	kprintf("policies:");
+	for (ip = iosched_policies; ip->ip_name != NULL; ip++) {
+		kprintf(" %s", ip->ip_name);
+	}
+	kprintf("\n");
+
+	/*
+	 * Don't hold iosched_devlock across kprintf. Disk drivers
+	 * register at boot and never go away, so this is safe enough
+	 * for a diagnostic printout.
+	 */
+	for (i=0; i<IOSCHED_MAXDEVS; i++) {
+		struct iosched *is = iosched_devs[i];
+		if (is != NULL) {
+			kprintf("%s: %s, %u queued\n", is->is_name,
+				is->is_policy->ip_name, is->is_count);
+		}
+	}
+	kprintf("deadlines: read %u ms, write %u ms\n",
+		iosched_read_expire, iosched_write_expire);
+}
@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *        The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Per-device I/O statistics, and the iostat: device. See iostat.h.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <uio.h>
+#include <vfs.h>
+#include <device.h>
+#include <iostat.h>
+
+/*
+ * Counters for one device. ds_lock protects everything, since
+ * requests may finish concurrently on different CPUs.
+ */
+struct devstats {
+	struct spinlock ds_lock;
+	struct timespec ds_busysince;	/* start of current busy period */
+	struct iostat ds_stats;
+};
+
+/*
+ * Table of all devices with counters, for the menu and iostat:.
+ * Devices are only ever added.
+ */
+#define IOSTAT_MAXDEVS 16
+static struct devstats *iostat_devs[IOSTAT_MAXDEVS];
+static unsigned iostat_ndevs;
+static struct spinlock iostat_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Convert a time interval to microseconds.
+ */
+static
+uint64_t
+iostat_usec(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000 + ts->tv_nsec / 1000;
+}
+
+/*
+ * Choose the histogram bucket for a latency of USEC microseconds.
+ */
+static
+unsigned
+iostat_bucket(uint64_t usec)
+{
+	uint64_t ms = usec / 1000;
+	unsigned b;
+
+	for (b = 0; b < IOSTAT_NBUCKETS - 1 && ms > 0; b++) {
+		ms >>= 1;
+	}
+	return b;
+}
+
+void
+iostat_attach(struct device *dev, const char *name)
+{
+	struct devstats *ds;
+
+	dev->d_stats = NULL;
+
+	ds = kmalloc(sizeof(*ds));
+	if (ds == NULL) {
+		/* Not worth failing over; just don't count this one */
+		kprintf("iostat: %s: Out of memory\n", name);
+		return;
+	}
+	bzero(ds, sizeof(*ds));
+	spinlock_init(&ds->ds_lock);
+	snprintf(ds->ds_stats.ios_name, IOSTAT_NAMELEN, "%s", name);
+	ds->ds_stats.ios_blocksize = dev->d_blocksize;
+
+	spinlock_acquire(&iostat_lock);
+	if (iostat_ndevs == IOSTAT_MAXDEVS) {
+		spinlock_release(&iostat_lock);
+		spinlock_cleanup(&ds->ds_lock);
+		kfree(ds);
+		kprintf("iostat: %s: too many devices\n", name);
+		return;
+	}
+	iostat_devs[iostat_ndevs++] = ds;
+	spinlock_release(&iostat_lock);
+
+	dev->d_stats = ds;
+}
+
+void
+iostat_begin(struct device *dev, struct timespec *start)
+{
+	struct devstats *ds = dev->d_stats;
+
+	if (ds == NULL) {
+		return;
+	}
+
+	gettime(start);
+
+	spinlock_acquire(&ds->ds_lock);
+	if (ds->ds_stats.ios_inflight == 0) {
+		ds->ds_busysince = *start;
+	}
+	ds->ds_stats.ios_inflight++;
+	if (ds->ds_stats.ios_inflight > ds->ds_stats.ios_maxinflight) {
+		ds->ds_stats.ios_maxinflight = ds->ds_stats.ios_inflight;
+	}
+	spinlock_release(&ds->ds_lock);
+}
+
+void
+iostat_end(struct device *dev, const struct timespec *start,
+	   bool write, size_t bytes, int result)
+{
+	struct devstats *ds = dev->d_stats;
+	struct iostat *ios;
+	struct timespec now, diff;
+	uint64_t lat;
+	unsigned dir = write ? IOSTAT_WRITE : IOSTAT_READ;
+
+	if (ds == NULL) {
+		return;
+	}
+	ios = &ds->ds_stats;
+
+	gettime(&now);
+	timespec_sub(&now, start, &diff);
+	lat = iostat_usec(&diff);
+
+	spinlock_acquire(&ds->ds_lock);
+	KASSERT(ios->ios_inflight > 0);
+	ios->ios_inflight--;
+	if (ios->ios_inflight == 0) {
+		timespec_sub(&now, &ds->ds_busysince, &diff);
+		ios->ios_busyusec += iostat_usec(&diff);
+	}
+	if (result) {
+		ios->ios_errors++;
+	}
+	else {
+		ios->ios_ops[dir]++;
+		ios->ios_bytes[dir] += bytes;
+		ios->ios_sectors[dir] += bytes / ios->ios_blocksize;
+		ios->ios_latusec[dir] += lat;
+		ios->ios_hist[dir][iostat_bucket(lat)]++;
+	}
+	spinlock_release(&ds->ds_lock);
+}
+
+/*
+ * Return the number of devices with counters.
+ */
+static
+unsigned
+iostat_count(void)
+{
+	unsigned n;
+
+	spinlock_acquire(&iostat_lock);
+	n = iostat_ndevs;
+	spinlock_release(&iostat_lock);
+	return n;
+}
+
+/*
+ * Copy the counters of device number I, which must exist, into IOS.
+ * Busy time includes the current busy period, if any. This is done
+ * one device at a time so the caller can keep IOS on the stack.
+ */
+static
+void
+iostat_snapshot(unsigned i, struct iostat *ios)
+{
+	struct devstats *ds;
+	struct timespec now, diff;
+
+	KASSERT(i < iostat_count());
+	ds = iostat_devs[i];
+
+	gettime(&now);
+	spinlock_acquire(&ds->ds_lock);
+	*ios = ds->ds_stats;
+	if (ios->ios_inflight > 0) {
+		timespec_sub(&now, &ds->ds_busysince, &diff);
+		ios->ios_busyusec += iostat_usec(&diff);
+	}
+	spinlock_release(&ds->ds_lock);
+}
+
+void
+iostat_print(void)
+{
+	struct iostat stats, *ios = &stats;
+	unsigned i, j, n, dir;
+
+	n = iostat_count();
+
+	kprintf("%-8s %8s %8s %10s %10s %10s %6s %6s %10s %10s\n",
+		"device", "reads", "writes", "rsectors", "wsectors",
+		"busy(ms)", "queue", "max", "rlat(us)", "wlat(us)");
+	for (i=0; i<n; i++) {
+		iostat_snapshot(i, ios);
+		kprintf("%-8s %8llu %8llu %10llu %10llu %10llu %6u %6u "
+			"%10llu %10llu\n",
+			ios->ios_name,
+			ios->ios_ops[IOSTAT_READ],
+			ios->ios_ops[IOSTAT_WRITE],
+			ios->ios_sectors[IOSTAT_READ],
+			ios->ios_sectors[IOSTAT_WRITE],
+			ios->ios_busyusec / 1000,
+			ios->ios_inflight,
+			ios->ios_maxinflight,
+			ios->ios_ops[IOSTAT_READ] == 0 ? 0 :
+			ios->ios_latusec[IOSTAT_READ] /
+			ios->ios_ops[IOSTAT_READ],
+			ios->ios_ops[IOSTAT_WRITE] == 0 ? 0 :
+			ios->ios_latusec[IOSTAT_WRITE] /
+			ios->ios_ops[IOSTAT_WRITE]);
+		if (ios->ios_errors > 0) {
+			kprintf("         %u errors\n", ios->ios_errors);
+		}
+		for (dir=0; dir<2; dir++) {
+			kprintf("         %s ms <1:%u", dir ? "write" : "read ",
+				ios->ios_hist[dir][0]);
+			for (j=1; j<IOSTAT_NBUCKETS-1; j++) {
+				kprintf(" <%u:%u", 1U << j, ios->ios_hist[dir][j]);
+			}
+			kprintf(" more:%u\n", ios->ios_hist[dir][j]);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// The iostat: device
+
+/* For open() */
+static
+int
+iostat_eachopen(struct device *dev, int openflags)
+{
+	(void)dev;
+
+	if ((openflags & O_ACCMODE) != O_RDONLY) {
+		return EINVAL;
+	}
+	return 0;
+}
+
+/*
+ * For d_io(). The device reads as an array of struct iostat taken at
+ * the time of the read; the uio offset is a byte offset into it. Each
+ * entry is snapshotted and copied out in turn.
+ */
+static
+int
+iostat_io(struct device *dev, struct uio *uio)
+{
+	struct iostat ios;
+	unsigned i, n;
+	size_t skip;
+	int result;
+
+	(void)dev;
+
+	if (uio->uio_rw != UIO_READ) {
+		return EINVAL;
+	}
+	if (uio->uio_offset < 0) {
+		return 0;
+	}
+
+	n = iostat_count();
+	i = uio->uio_offset / sizeof(ios);
+	while (i < n && uio->uio_resid > 0) {
+		skip = uio->uio_offset - (off_t)i * sizeof(ios);
+		iostat_snapshot(i, &ios);
+		result = uiomove((char *)&ios + skip, sizeof(ios) - skip,
+				 uio);
+		if (result) {
+			return result;
+		}
+		i++;
+	}
+	return 0;
+}
+
+/* For ioctl() */
+static
+int
+iostat_ioctl(struct device *dev, int op, userptr_t data)
+{
+	(void)dev;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+static const struct device_ops iostat_devops = {
+	.devop_eachopen = iostat_eachopen,
+	.devop_io = iostat_io,
+	.devop_ioctl = iostat_ioctl,
+};
+
+/*
+ * Create and attach iostat:
+ */
+void
+iostat_bootstrap(void)
+{
+	struct device *dev;
+	int result;
+
+	dev = kmalloc(sizeof(*dev));
+	if (dev == NULL) {
+		panic("Could not add iostat device: out of memory\n");
+	}
+
+	dev->d_ops = &iostat_devops;
+	dev->d_blocks = 0;
+	dev->d_blocksize = 1;
+	dev->d_devnumber = 0; /* assigned by vfs_adddev */
+	dev->d_data = NULL;
+	dev->d_stats = NULL;
+
+	result = vfs_adddev("iostat", dev, 0);
+	if (result) {
+		panic("Could not add iostat device: %s\n", strerror(result));
+	}
+}
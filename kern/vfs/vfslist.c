@@ -43,6 +43,7 @@
 #include <fs.h>
 #include <vnode.h>
 #include <device.h>
+#include <iostat.h>
 
 /*
  * Structure for a single named device.
@@ -60,6 +61,10 @@
  * kd_fs      - Filesystem object mounted on, or associated with, this
  *              device. NULL if there is no filesystem.
  *
+ * kd_claimed - Set while a mountable device is in use by another
+ *              device built on top of it (see vfs_claimdev); it
+ *              can't be mounted or used for swap meanwhile.
+ *
  * A filesystem can be associated with a device without having been
  * mounted if the device was created that way. In this case,
  * kd_rawname is NULL (prohibiting mount/unmount), and, as there is
@@ -80,6 +85,7 @@ struct knowndev {
 	struct device *kd_device;
 	struct vnode *kd_vnode;
 	struct fs *kd_fs;
+	bool kd_claimed;
 };
 
 /* A placeholder for kd_fs for devices used as swap */
@@ -90,6 +96,14 @@ DEFARRAY(knowndev, static __UNUSED inline);
 
 static struct knowndevarray *knowndevs;
 
+/*
+ * Protects knowndevs: the array and each entry's kd_fs. Changes are
+ * made holding both this (for writing) and vfs_biglock, so a lookup
+ * needs only one or the other; lookups that don't otherwise need the
+ * big lock take this for reading. Ordered after vfs_biglock.
+ */
+static struct rwlock *knowndevs_lock;
+
 /* The big lock for all FS ops. Remove for filesystem assignment. */
 static struct lock *vfs_biglock;
 static unsigned vfs_biglock_depth;
@@ -105,6 +119,10 @@ vfs_bootstrap(void)
 	if (knowndevs==NULL) {
 		panic("vfs: Could not create knowndevs array\n");
 	}
+	knowndevs_lock = rwlock_create("knowndevs");
+	if (knowndevs_lock==NULL) {
+		panic("vfs: Could not create knowndevs lock\n");
+	}
 
 	vfs_biglock = lock_create("vfs_biglock");
 	if (vfs_biglock==NULL) {
@@ -113,6 +131,7 @@ vfs_bootstrap(void)
 	vfs_biglock_depth = 0;
 
 	devnull_create();
+	iostat_bootstrap();
 	semfs_bootstrap();
 }
 
@@ -198,10 +217,19 @@ int
 vfs_getroot(const char *devname, struct vnode **ret)
 {
 	struct knowndev *kd;
+	struct fs *fs = NULL;
 	unsigned i, num;
+	int result;
 
+	/*
+	 * FSOP_GETROOT needs the big lock. Holding it also keeps the
+	 * filesystem we find mounted after knowndevs_lock is dropped,
+	 * since unmounting needs it too.
+	 */
 	KASSERT(vfs_biglock_do_i_hold());
 
+	rw_enter_read(knowndevs_lock);
+	result = ENODEV;
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
 		kd = knowndevarray_get(knowndevs, i);
@@ -221,13 +249,16 @@ vfs_getroot(const char *devname, struct vnode **ret)
 
 			if (!strcmp(kd->kd_name, devname) ||
 			    (volname!=NULL && !strcmp(volname, devname))) {
-				return FSOP_GETROOT(kd->kd_fs, ret);
+				/* Get the root below, without the lock */
+				fs = kd->kd_fs;
+				break;
 			}
 		}
 		else {
 			if (kd->kd_rawname!=NULL &&
 			    !strcmp(kd->kd_name, devname)) {
-				return ENXIO;
+				result = ENXIO;
+				break;
 			}
 		}
 
@@ -242,7 +273,8 @@ vfs_getroot(const char *devname, struct vnode **ret)
 			KASSERT(kd->kd_device != NULL);
 			VOP_INCREF(kd->kd_vnode);
 			*ret = kd->kd_vnode;
-			return 0;
+			result = 0;
+			break;
 		}
 
 		/*
@@ -253,7 +285,8 @@ vfs_getroot(const char *devname, struct vnode **ret)
 			KASSERT(kd->kd_device != NULL);
 			VOP_INCREF(kd->kd_vnode);
 			*ret = kd->kd_vnode;
-			return 0;
+			result = 0;
+			break;
 		}
 
 		/*
@@ -264,10 +297,16 @@ vfs_getroot(const char *devname, struct vnode **ret)
 	}
 
 	/*
-	 * If we got here, the device specified by devname doesn't exist.
+	 * If we got to the end, the device specified by devname
+	 * doesn't exist, and result is still ENODEV.
 	 */
 
-	return ENODEV;
+	rw_exit_read(knowndevs_lock);
+
+	if (fs != NULL) {
+		result = FSOP_GETROOT(fs, ret);
+	}
+	return result;
 }
 
 /*
@@ -277,12 +316,12 @@ const char *
 vfs_getdevname(struct fs *fs)
 {
 	struct knowndev *kd;
+	const char *name = NULL;
 	unsigned i, num;
 
 	KASSERT(fs != NULL);
 
-	KASSERT(vfs_biglock_do_i_hold());
-
+	rw_enter_read(knowndevs_lock);
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
 		kd = knowndevarray_get(knowndevs, i);
@@ -294,11 +333,13 @@ vfs_getdevname(struct fs *fs)
 			 * the fs cannot go away, and the device can't
 			 * go away until the fs goes away.
 			 */
-			return kd->kd_name;
+			name = kd->kd_name;
+			break;
 		}
 	}
+	rw_exit_read(knowndevs_lock);
 
-	return NULL;
+	return name;
 }
 
 /*
@@ -358,7 +399,7 @@ badnames(const char *n1, const char *n2, const char *n3)
 	unsigned i, num;
 	struct knowndev *kd;
 
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(rw_write_held(knowndevs_lock));
 
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
@@ -433,17 +474,22 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 	kd->kd_device = dev;
 	kd->kd_vnode = vnode;
 	kd->kd_fs = fs;
+	kd->kd_claimed = false;
 
 	if (fs!=NULL) {
 		volname = FSOP_GETVOLNAME(fs);
 	}
 
+	/* Check and add in one go, so nobody else takes the names */
+	rw_enter_write(knowndevs_lock);
 	if (badnames(name, rawname, volname)) {
+		rw_exit_write(knowndevs_lock);
 		result = EEXIST;
 		goto fail;
 	}
 
 	result = knowndevarray_add(knowndevs, kd, &index);
+	rw_exit_write(knowndevs_lock);
 	if (result) {
 		goto fail;
 	}
@@ -451,6 +497,12 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 	if (dev != NULL) {
 		/* use index+1 as the device number, so 0 is reserved */
 		dev->d_devnumber = index+1;
+
+		/* keep I/O statistics for block devices */
+		dev->d_stats = NULL;
+		if (dev->d_blocks > 0) {
+			iostat_attach(dev, name);
+		}
 	}
 
 	vfs_biglock_release();
@@ -497,9 +549,24 @@ vfs_addfs(const char *devname, struct fs *fs)
 
 //////////////////////////////////////////////////
 
+/*
+ * Change what's mounted on KD. Should already hold vfs_biglock.
+ */
+static
+void
+knowndev_setfs(struct knowndev *kd, struct fs *fs)
+{
+	KASSERT(vfs_biglock_do_i_hold());
+
+	rw_enter_write(knowndevs_lock);
+	kd->kd_fs = fs;
+	rw_exit_write(knowndevs_lock);
+}
+
 /*
  * Look for a mountable device named DEVNAME.
- * Should already hold knowndevs_lock.
+ * Should already hold vfs_biglock, which keeps the entry's kd_fs from
+ * changing until released.
  */
 static
 int
@@ -551,7 +618,7 @@ vfs_mount(const char *devname, void *data,
 		return result;
 	}
 
-	if (kd->kd_fs != NULL) {
+	if (kd->kd_fs != NULL || kd->kd_claimed) {
 		vfs_biglock_release();
 		return EBUSY;
 	}
@@ -567,7 +634,7 @@ vfs_mount(const char *devname, void *data,
 	KASSERT(fs != NULL);
 	KASSERT(fs != SWAP_FS); 
 
-	kd->kd_fs = fs;
+	knowndev_setfs(kd, fs);
 
 	volname = FSOP_GETVOLNAME(fs);
 	kprintf("vfs: Mounted %s: on %s\n",
@@ -608,7 +675,7 @@ vfs_swapon(const char *devname, struct vnode **ret)
 		goto out;
 	}
 
-	if (kd->kd_fs != NULL) {
+	if (kd->kd_fs != NULL || kd->kd_claimed) {
 		result = EBUSY;
 		goto out;
 	}
@@ -617,7 +684,7 @@ vfs_swapon(const char *devname, struct vnode **ret)
 
 	kprintf("vfs: Swap attached to %s\n", kd->kd_name);
 
-	kd->kd_fs = SWAP_FS;
+	knowndev_setfs(kd, SWAP_FS);
 	VOP_INCREF(kd->kd_vnode);
 	*ret = kd->kd_vnode;
 
@@ -668,7 +735,7 @@ vfs_unmount(const char *devname)
 	kprintf("vfs: Unmounted %s:\n", kd->kd_name);
 
 	/* now drop the filesystem */
-	kd->kd_fs = NULL;
+	knowndev_setfs(kd, NULL);
 
 	KASSERT(result==0);
 
@@ -705,7 +772,7 @@ vfs_swapoff(const char *devname)
 	kprintf("vfs: Swap detached from %s:\n", kd->kd_name);
 
 	/* drop it */
-	kd->kd_fs = NULL;
+	knowndev_setfs(kd, NULL);
 
 	KASSERT(result==0);
 
@@ -714,6 +781,72 @@ vfs_swapoff(const char *devname)
 	return result;
 }
 
+/*
+ * Claim a mountable device for use underneath another device (such
+ * as a stripe) and hand back its raw vnode. Like swapon, except that
+ * the device stays unmounted; fails with EBUSY if it's mounted, used
+ * for swap, or already claimed.
+ */
+int
+vfs_claimdev(const char *devname, struct vnode **ret)
+{
+	struct knowndev *kd;
+	int result;
+
+	vfs_biglock_acquire();
+
+	result = findmount(devname, &kd);
+	if (result) {
+		goto out;
+	}
+
+	if (kd->kd_fs != NULL || kd->kd_claimed) {
+		result = EBUSY;
+		goto out;
+	}
+	KASSERT(kd->kd_rawname != NULL);
+	KASSERT(kd->kd_device != NULL);
+
+	rw_enter_write(knowndevs_lock);
+	kd->kd_claimed = true;
+	rw_exit_write(knowndevs_lock);
+	VOP_INCREF(kd->kd_vnode);
+	*ret = kd->kd_vnode;
+
+ out:
+	vfs_biglock_release();
+	return result;
+}
+
+/*
+ * Give back a device claimed with vfs_claimdev, and the reference to
+ * its raw vnode.
+ */
+void
+vfs_releasedev(struct vnode *vn)
+{
+	struct knowndev *kd;
+	unsigned i, num;
+
+	vfs_biglock_acquire();
+
+	num = knowndevarray_num(knowndevs);
+	for (i=0; i<num; i++) {
+		kd = knowndevarray_get(knowndevs, i);
+		if (kd->kd_vnode == vn) {
+			KASSERT(kd->kd_claimed);
+			rw_enter_write(knowndevs_lock);
+			kd->kd_claimed = false;
+			rw_exit_write(knowndevs_lock);
+			break;
+		}
+	}
+	KASSERT(i < num);
+	VOP_DECREF(vn);
+
+	vfs_biglock_release();
+}
+
 /*
  * Global unmount function.
  */
@@ -739,7 +872,7 @@ vfs_unmountall(void)
 		}
 		if (dev->kd_fs == SWAP_FS) {
 			/* just drop it */
-			dev->kd_fs = NULL;
+			knowndev_setfs(dev, NULL);
 			continue;
 		}
 
@@ -777,7 +910,7 @@ vfs_unmountall(void)
 		}
 
 		/* now drop the filesystem */
-		dev->kd_fs = NULL;
+		knowndev_setfs(dev, NULL);
 	}
 
 	vfs_biglock_release();
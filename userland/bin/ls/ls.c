@@ -185,6 +185,47 @@ print(const char *path)
 	printf("%s\n", file);
 }
 
+/*
+ * Directory reading. Names come from the kernel in batches, each
+ * followed by a null byte, using getdirentries; nextname hands them
+ * out one at a time. This makes one system call per batch instead of
+ * one per name.
+ */
+struct dirbuf {
+	int fd;
+	char buf[1024];
+	ssize_t len;		/* bytes in buf */
+	ssize_t pos;		/* where the next name is */
+};
+
+static
+void
+startdir(struct dirbuf *db, int fd)
+{
+	db->fd = fd;
+	db->len = 0;
+	db->pos = 0;
+}
+
+/*
+ * Get the next name; returns its length, 0 at the end, or -1 on error.
+ */
+static
+ssize_t
+nextname(struct dirbuf *db, const char **name)
+{
+	if (db->pos >= db->len) {
+		db->len = getdirentries(db->fd, db->buf, sizeof(db->buf));
+		db->pos = 0;
+		if (db->len <= 0) {
+			return db->len;
+		}
+	}
+	*name = db->buf + db->pos;
+	db->pos += strlen(*name) + 1;
+	return strlen(*name);
+}
+
 /*
  * List a directory.
  */
@@ -193,7 +234,8 @@ void
 listdir(const char *path, int showheader)
 {
 	int fd;
-	char buf[1024];
+	struct dirbuf db;
+	const char *name;
 	char newpath[1024];
 	ssize_t len;
 
@@ -212,19 +254,18 @@ listdir(const char *path, int showheader)
 	/*
 	 * List the directory.
 	 */
-	while ((len = getdirentry(fd, buf, sizeof(buf)-1)) > 0) {
-		buf[len] = 0;
-
+	startdir(&db, fd);
+	while ((len = nextname(&db, &name)) > 0) {
 		/* Assemble the full name of the new item */
-		snprintf(newpath, sizeof(newpath), "%s/%s", path, buf);
+		snprintf(newpath, sizeof(newpath), "%s/%s", path, name);
 
-		if (aopt || buf[0]!='.') {
+		if (aopt || name[0]!='.') {
 			/* Print it */
 			print(newpath);
 		}
 	}
 	if (len<0) {
-		err(1, "%s: getdirentry", path);
+		err(1, "%s: getdirentries", path);
 	}
 
 	/* Done */
@@ -236,9 +277,10 @@ void
 recursedir(const char *path)
 {
 	int fd;
-	char buf[1024];
+	struct dirbuf db;
+	const char *name;
 	char newpath[1024];
-	int len;
+	ssize_t len;
 
 	/*
 	 * Open it.
@@ -251,18 +293,17 @@ recursedir(const char *path)
 	/*
 	 * List the directory.
 	 */
-	while ((len = getdirentry(fd, buf, sizeof(buf)-1)) > 0) {
-		buf[len] = 0;
-
+	startdir(&db, fd);
+	while ((len = nextname(&db, &name)) > 0) {
 		/* Assemble the full name of the new item */
-		snprintf(newpath, sizeof(newpath), "%s/%s", path, buf);
+		snprintf(newpath, sizeof(newpath), "%s/%s", path, name);
 
-		if (!aopt && buf[0]=='.') {
+		if (!aopt && name[0]=='.') {
 			/* skip this one */
 			continue;
 		}
 
-		if (!strcmp(buf, ".") || !strcmp(buf, "..")) {
+		if (!strcmp(name, ".") || !strcmp(name, "..")) {
 			/* always skip these */
 			continue;
 		}
@@ -162,6 +162,14 @@ dumpsb(void)
 	dumpvalf("Freemap size", "%u blocks",
 		 SFS_FREEMAPBLOCKS(SWAP32(sb.sb_nblocks)));
 	dumpvalf("Block size", "%u bytes", SFS_BLOCKSIZE);
+	if (sb.sb_journalblocks != 0) {
+		dumpvalf("Journal", "%u blocks at %u",
+			 SWAP32(sb.sb_journalblocks),
+			 SWAP32(sb.sb_journalstart));
+	}
+	else {
+		dumpval("Journal", "none");
+	}
 	dumplval("Volume name", sb.sb_volname);
 
 	for (i=0; i<ARRAYCOUNT(sb.reserved); i++) {
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *        The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * iostat - report block device I/O statistics.
+ *
+ * Usage: iostat [interval [count]]
+ *
+ * With no arguments, prints the totals since boot. With an interval
+ * (in seconds), prints the activity during each interval, COUNT
+ * times or forever.
+ *
+ * The numbers come from the iostat: device, which reads as an array
+ * of struct iostat.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <kern/iostat.h>
+
+#define MAXDEVS 16
+
+static struct iostat prev[MAXDEVS], cur[MAXDEVS];
+
+/*
+ * Read the current counters into BUF. Returns the number of devices.
+ */
+static
+int
+sample(struct iostat *buf)
+{
+	int fd;
+	ssize_t len;
+
+	fd = open("iostat:", O_RDONLY);
+	if (fd < 0) {
+		err(1, "iostat:");
+	}
+	len = read(fd, buf, MAXDEVS * sizeof(struct iostat));
+	if (len < 0) {
+		err(1, "iostat:: read");
+	}
+	close(fd);
+	return len / sizeof(struct iostat);
+}
+
+/*
+ * Wait until SECS seconds after (*when), and update *when.
+ * There's no sleep call, so this spins on the clock.
+ */
+static
+void
+waituntil(time_t *when, unsigned secs)
+{
+	time_t now;
+	unsigned long nsecs;
+
+	*when += secs;
+	do {
+		__time(&now, &nsecs);
+	} while (now < *when);
+}
+
+/*
+ * Print the difference between two samples of the same device, over
+ * SECS seconds (0 for totals since boot).
+ */
+static
+void
+report(const struct iostat *a, const struct iostat *b, unsigned secs)
+{
+	uint64_t rops, wops, rbytes, wbytes, lat, busy, ops;
+	uint64_t div = secs > 0 ? secs : 1;
+
+	rops = b->ios_ops[IOSTAT_READ] - a->ios_ops[IOSTAT_READ];
+	wops = b->ios_ops[IOSTAT_WRITE] - a->ios_ops[IOSTAT_WRITE];
+	rbytes = b->ios_bytes[IOSTAT_READ] - a->ios_bytes[IOSTAT_READ];
+	wbytes = b->ios_bytes[IOSTAT_WRITE] - a->ios_bytes[IOSTAT_WRITE];
+	lat = (b->ios_latusec[IOSTAT_READ] - a->ios_latusec[IOSTAT_READ]) +
+		(b->ios_latusec[IOSTAT_WRITE] - a->ios_latusec[IOSTAT_WRITE]);
+	busy = b->ios_busyusec - a->ios_busyusec;
+	ops = rops + wops;
+
+	printf("%-8s %8llu %8llu %9llu %9llu %9llu", b->ios_name,
+	       rops / div, wops / div, rbytes / 1024 / div,
+	       wbytes / 1024 / div, ops == 0 ? 0ULL : lat / ops);
+	if (secs > 0) {
+		printf(" %5llu%%", busy / (secs * 10000ULL));
+	}
+	else {
+		printf(" %6llu", busy / 1000000ULL);
+	}
+	printf(" %5u\n", b->ios_inflight);
+}
+
+static
+void
+header(unsigned secs)
+{
+	printf("%-8s %8s %8s %9s %9s %9s %6s %5s\n", "device",
+	       secs > 0 ? "r/s" : "reads", secs > 0 ? "w/s" : "writes",
+	       secs > 0 ? "rKB/s" : "rKB", secs > 0 ? "wKB/s" : "wKB",
+	       "lat(us)", secs > 0 ? "util" : "busy(s)", "queue");
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned interval = 0;
+	int count = -1;
+	int i, n, nprev;
+	time_t when;
+	unsigned long nsecs;
+
+	if (argc > 1) {
+		interval = atoi(argv[1]);
+		if (interval == 0) {
+			errx(1, "Usage: iostat [interval [count]]");
+		}
+	}
+	if (argc > 2) {
+		count = atoi(argv[2]);
+	}
+	if (argc > 3) {
+		errx(1, "Usage: iostat [interval [count]]");
+	}
+
+	nprev = sample(prev);
+	if (interval == 0) {
+		/* Totals since boot */
+		bzero(cur, sizeof(cur));
+		header(0);
+		for (i=0; i<nprev; i++) {
+			report(&cur[i], &prev[i], 0);
+		}
+		return 0;
+	}
+
+	__time(&when, &nsecs);
+	while (count != 0) {
+		waituntil(&when, interval);
+		n = sample(cur);
+		header(interval);
+		for (i=0; i<n; i++) {
+			if (i < nprev) {
+				report(&prev[i], &cur[i], interval);
+			}
+		}
+		printf("\n");
+		memcpy(prev, cur, sizeof(prev));
+		nprev = n;
+		if (count > 0) {
+			count--;
+		}
+	}
+	return 0;
+}
@@ -31,6 +31,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <assert.h>
+#include <stdlib.h>
 #include <limits.h>
 #include <err.h>
 
@@ -60,6 +61,10 @@
 /* Maximum size of freemap we support */
 #define MAXFREEMAPBLOCKS 32
 
+/* Default journal size; never more than 1/JOURNALFRACTION of the volume */
+#define DEFJOURNALBLOCKS 256
+#define JOURNALFRACTION  8
+
 /* Free block bitmap */
 static char freemapbuf[MAXFREEMAPBLOCKS * SFS_BLOCKSIZE];
 
@@ -73,6 +78,9 @@ check(void)
 	assert(sizeof(struct sfs_superblock)==SFS_BLOCKSIZE);
 	assert(sizeof(struct sfs_dinode)==SFS_BLOCKSIZE);
 	assert(SFS_BLOCKSIZE % sizeof(struct sfs_direntry) == 0);
+	assert(sizeof(struct sfs_jheader)==SFS_BLOCKSIZE);
+	assert(sizeof(struct sfs_jdesc)==SFS_BLOCKSIZE);
+	assert(sizeof(struct sfs_jcommit)==SFS_BLOCKSIZE);
 }
 
 /*
@@ -94,7 +102,7 @@ allocblock(uint32_t block)
  */
 static
 void
-initfreemap(uint32_t fsblocks)
+initfreemap(uint32_t fsblocks, uint32_t jstart, uint32_t jblocks)
 {
 	uint32_t freemapbits = SFS_FREEMAPBITS(fsblocks);
 	uint32_t freemapblocks = SFS_FREEMAPBLOCKS(fsblocks);
@@ -114,6 +122,11 @@ initfreemap(uint32_t fsblocks)
 		allocblock(SFS_FREEMAP_START + i);
 	}
 
+	/* so must the journal */
+	for (i=0; i<jblocks; i++) {
+		allocblock(jstart + i);
+	}
+
 	/* all blocks in the freemap but past the volume end are "in use" */
 	for (i=fsblocks; i<freemapbits; i++) {
 		allocblock(i);
@@ -125,7 +138,8 @@ initfreemap(uint32_t fsblocks)
  */
 static
 void
-writesuper(const char *volname, uint32_t nblocks)
+writesuper(const char *volname, uint32_t nblocks,
+	   uint32_t jstart, uint32_t jblocks)
 {
 	struct sfs_superblock sb;
 
@@ -140,6 +154,8 @@ writesuper(const char *volname, uint32_t nblocks)
 	sb.sb_magic = SWAP32(SFS_MAGIC);
 	sb.sb_nblocks = SWAP32(nblocks);
 	strcpy(sb.sb_volname, volname);
+	sb.sb_journalstart = SWAP32(jstart);
+	sb.sb_journalblocks = SWAP32(jblocks);
 
 	/* and write it out. */
 	diskwrite(&sb, SFS_SUPER_BLOCK);
@@ -183,6 +199,30 @@ writerootdir(void)
 	diskwrite(&sfi, SFS_ROOTDIR_INO);
 }
 
+/*
+ * Initialize the journal: write a header, and clear the first log
+ * block so nothing left over on the disk looks like a transaction.
+ */
+static
+void
+writejournal(uint32_t jstart, uint32_t jblocks)
+{
+	struct sfs_jheader jh;
+	char zeros[SFS_BLOCKSIZE];
+
+	if (jblocks == 0) {
+		return;
+	}
+
+	bzero((void *)&jh, sizeof(jh));
+	jh.jh_magic = SWAP32(SFS_JMAGIC_HEADER);
+	jh.jh_seq = SWAP32(0);
+	diskwrite(&jh, jstart);
+
+	bzero((void *)zeros, sizeof(zeros));
+	diskwrite(zeros, jstart+1);
+}
+
 /*
  * Main.
  */
@@ -190,14 +230,23 @@ int
 main(int argc, char **argv)
 {
 	uint32_t size, blocksize;
+	uint32_t jstart, jblocks;
 	char *volname, *s;
+	int jarg = -1;
 
 #ifdef HOST
 	hostcompat_init(argc, argv);
 #endif
 
-	if (argc!=3) {
-		errx(1, "Usage: mksfs device/diskfile volume-name");
+	if (argc!=3 && argc!=4) {
+		errx(1, "Usage: mksfs device/diskfile volume-name "
+		     "[journal-blocks]");
+	}
+	if (argc==4) {
+		jarg = atoi(argv[3]);
+		if (jarg < 0) {
+			errx(1, "Invalid journal size %s", argv[3]);
+		}
 	}
 
 	check();
@@ -228,11 +277,37 @@ main(int argc, char **argv)
 	}
 	size = diskblocks();
 
+	/* The journal goes right after the freemap. 0 means none. */
+	jstart = SFS_FREEMAP_START + SFS_FREEMAPBLOCKS(size);
+	if (jarg >= 0) {
+		jblocks = jarg;
+		if (jblocks > 0 && jblocks < SFS_JMINSIZE) {
+			errx(1, "Journal must be at least %u blocks",
+			     SFS_JMINSIZE);
+		}
+		if (jblocks > 0 && jstart + jblocks > size) {
+			errx(1, "Journal does not fit on the volume");
+		}
+	}
+	else {
+		jblocks = size / JOURNALFRACTION;
+		if (jblocks > DEFJOURNALBLOCKS) {
+			jblocks = DEFJOURNALBLOCKS;
+		}
+		if (jblocks < SFS_JMINSIZE) {
+			jblocks = 0;
+		}
+	}
+	if (jblocks == 0) {
+		jstart = 0;
+	}
+
 	/* Write out the on-disk structures */
-	initfreemap(size);
-	writesuper(volname, size);
+	initfreemap(size, jstart, jblocks);
+	writesuper(volname, size, jstart, jblocks);
 	writefreemap(size);
 	writerootdir();
+	writejournal(jstart, jblocks);
 
 	closedisk();
 
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *        The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * sfsck: metadata journal.
+ *
+ * Volumes made with a journal log metadata updates before writing
+ * them in place (see kern/sfs.h). Anything committed to the log but
+ * not yet copied home has to be replayed before the rest of the
+ * checks look at the volume, or they'd be checking (and "fixing")
+ * a stale version of it.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <err.h>
+
+#include "compat.h"
+#include <kern/sfs.h>
+
+#include "disk.h"
+#include "sb.h"
+#include "journal.h"
+#include "main.h"
+
+/*
+ * Write a fresh header, with sequence number SEQ, making everything
+ * in the log stale.
+ */
+static
+void
+journal_writeheader(uint32_t jstart, uint32_t seq)
+{
+	struct sfs_jheader jh;
+
+	memset(&jh, 0, sizeof(jh));
+	jh.jh_magic = SWAP32(SFS_JMAGIC_HEADER);
+	jh.jh_seq = SWAP32(seq);
+	diskwrite(&jh, jstart);
+}
+
+/*
+ * Fold one block image into a transaction checksum. The checksum is
+ * over the words as the kernel sees them, so swap each one first.
+ */
+static
+uint32_t
+journal_sum(uint32_t sum, const uint32_t *words)
+{
+	unsigned i;
+
+	for (i=0; i<SFS_BLOCKSIZE/sizeof(uint32_t); i++) {
+		sum = SFS_JSUM(sum, SWAP32(words[i]));
+	}
+	return sum;
+}
+
+/*
+ * Check whether the transaction at log offset POS is complete, with
+ * sequence number SEQ. If so, fill in JD (byte-swapped) and return 1.
+ */
+static
+int
+journal_checktxn(uint32_t jstart, uint32_t jblocks, uint32_t pos,
+		 uint32_t seq, struct sfs_jdesc *jd)
+{
+	struct sfs_jcommit jc;
+	uint32_t buf[SFS_BLOCKSIZE/sizeof(uint32_t)];
+	uint32_t i, n, sum, block;
+
+	diskread(jd, jstart + pos);
+	jd->jd_magic = SWAP32(jd->jd_magic);
+	jd->jd_seq = SWAP32(jd->jd_seq);
+	jd->jd_nblocks = SWAP32(jd->jd_nblocks);
+	n = jd->jd_nblocks;
+	if (jd->jd_magic != SFS_JMAGIC_DESC || jd->jd_seq != seq ||
+	    n > SFS_JMAXBLOCKS || pos + n + 2 > jblocks) {
+		return 0;
+	}
+
+	diskread(&jc, jstart + pos + n + 1);
+	if (SWAP32(jc.jc_magic) != SFS_JMAGIC_COMMIT ||
+	    SWAP32(jc.jc_seq) != seq || SWAP32(jc.jc_nblocks) != n) {
+		return 0;
+	}
+
+	sum = seq;
+	for (i=0; i<n; i++) {
+		block = jd->jd_blocks[i] = SWAP32(jd->jd_blocks[i]);
+		if (block >= sb_totalblocks() ||
+		    (block >= jstart && block < jstart + jblocks)) {
+			warnx("Journal transaction %lu has bad block %lu "
+			      "(ignored)", (unsigned long) seq,
+			      (unsigned long) block);
+			return 0;
+		}
+		diskread(buf, jstart + pos + 1 + i);
+		sum = journal_sum(sum, buf);
+	}
+	return sum == SWAP32(jc.jc_checksum);
+}
+
+int
+journal_replay(void)
+{
+	struct sfs_jheader jh;
+	struct sfs_jdesc jd;
+	char buf[SFS_BLOCKSIZE];
+	uint32_t jstart, jblocks, seq, pos, i;
+	unsigned long ntxns = 0, nblocks = 0;
+
+	jstart = sb_journalstart();
+	jblocks = sb_journalblocks();
+	if (jblocks == 0) {
+		return 0;
+	}
+	if (jblocks < SFS_JMINSIZE ||
+	    jstart < SFS_FREEMAP_START + sb_freemapblocks() ||
+	    jstart + jblocks > sb_totalblocks()) {
+		/* sb_check will complain about this */
+		return 0;
+	}
+
+	diskread(&jh, jstart);
+	if (SWAP32(jh.jh_magic) != SFS_JMAGIC_HEADER) {
+		warnx("Journal header invalid (fixed)");
+		setbadness(EXIT_RECOV);
+		journal_writeheader(jstart, 0);
+		memset(buf, 0, sizeof(buf));
+		diskwrite(buf, jstart + 1);
+		return 0;
+	}
+	seq = SWAP32(jh.jh_seq);
+
+	pos = 1;
+	while (pos + 2 <= jblocks &&
+	       journal_checktxn(jstart, jblocks, pos, seq, &jd)) {
+		for (i=0; i<jd.jd_nblocks; i++) {
+			diskread(buf, jstart + pos + 1 + i);
+			diskwrite(buf, jd.jd_blocks[i]);
+		}
+		ntxns++;
+		nblocks += jd.jd_nblocks;
+		pos += jd.jd_nblocks + 2;
+		seq++;
+	}
+
+	if (ntxns == 0) {
+		return 0;
+	}
+
+	journal_writeheader(jstart, seq);
+	warnx("Replayed %lu journal transactions (%lu blocks)",
+	      ntxns, nblocks);
+	setbadness(EXIT_RECOV);
+	return 1;
+}
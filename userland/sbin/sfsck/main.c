@@ -37,6 +37,7 @@
 #include "disk.h"
 #include "sfs.h"
 #include "sb.h"
+#include "journal.h"
 #include "freemap.h"
 #include "inode.h"
 #include "passes.h"
@@ -77,6 +78,10 @@ main(int argc, char **argv)
 
 	sfs_setup();
 	sb_load();
+	if (journal_replay()) {
+		/* the superblock may have been in it */
+		sb_load();
+	}
 	sb_check();
 	freemap_setup();
 
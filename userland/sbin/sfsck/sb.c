@@ -83,6 +83,25 @@ sb_check(void)
 		setbadness(EXIT_RECOV);
 		schanged = 1;
 	}
+	if (sb.sb_journalblocks != 0 &&
+	    (sb.sb_journalblocks < SFS_JMINSIZE ||
+	     sb.sb_journalstart < SFS_FREEMAP_START +
+	                          SFS_FREEMAPBLOCKS(sb.sb_nblocks) ||
+	     sb.sb_journalstart + sb.sb_journalblocks > sb.sb_nblocks)) {
+		warnx("Invalid journal location %lu+%lu (journal removed)",
+		      (unsigned long) sb.sb_journalstart,
+		      (unsigned long) sb.sb_journalblocks);
+		setbadness(EXIT_RECOV);
+		sb.sb_journalstart = 0;
+		sb.sb_journalblocks = 0;
+		schanged = 1;
+	}
+	if (sb.sb_journalblocks == 0 && sb.sb_journalstart != 0) {
+		warnx("Journal start set with no journal (fixed)");
+		setbadness(EXIT_RECOV);
+		sb.sb_journalstart = 0;
+		schanged = 1;
+	}
 	if (checkzeroed(sb.reserved, sizeof(sb.reserved))) {
 		warnx("Reserved section of superblock not zeroed (fixed)");
 		setbadness(EXIT_RECOV);
@@ -114,6 +133,21 @@ sb_freemapblocks(void)
 	return SFS_FREEMAPBLOCKS(sb.sb_nblocks);
 }
 
+/*
+ * Return the location and size of the journal (size 0 if none).
+ */
+uint32_t
+sb_journalstart(void)
+{
+	return sb.sb_journalstart;
+}
+
+uint32_t
+sb_journalblocks(void)
+{
+	return sb.sb_journalblocks;
+}
+
 /*
  * Return the volume name.
  */
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *        The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * syncbench - time sync() of a lot of dirty inodes.
+ *
+ * Usage: syncbench [nfiles [rounds]]
+ *
+ * Creates NFILES small files and keeps them all open, then for each of
+ * ROUNDS rounds appends to every file in a scrambled order (so the
+ * dirty inodes are not in block order) and times a sync(). The files
+ * have to stay open: closing the last reference to a vnode writes its
+ * inode back, which would leave sync() nothing to do. This is meant for
+ * comparing inode write-back strategies; mount the volume without a
+ * journal to see the raw inode writes. Run it on a fresh volume: the
+ * kernel may not support remove, so the files are left behind.
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <err.h>
+
+/* Every file stays open, so leave room for stdin/stdout/stderr */
+#define MAXFILES (OPEN_MAX - 8)
+#define NAMESIZE 32
+
+static int order[MAXFILES];
+static int fds[MAXFILES];
+
+static
+void
+mkname(char *buf, int n)
+{
+	snprintf(buf, NAMESIZE, "sb-%d", n);
+}
+
+/*
+ * Shuffle the order in which the files get touched.
+ */
+static
+void
+scramble(int nfiles)
+{
+	int i, j, t;
+
+	for (i=0; i<nfiles; i++) {
+		order[i] = i;
+	}
+	for (i=nfiles-1; i>0; i--) {
+		j = random() % (i+1);
+		t = order[i];
+		order[i] = order[j];
+		order[j] = t;
+	}
+}
+
+/*
+ * Return the time since (secs0, nsecs0) in microseconds.
+ */
+static
+unsigned long
+elapsed(time_t secs0, unsigned long nsecs0)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	if (nsecs < nsecs0) {
+		nsecs += 1000000000;
+		secs--;
+	}
+	return (secs - secs0) * 1000000 + (nsecs - nsecs0) / 1000;
+}
+
+static
+void
+openall(int nfiles)
+{
+	char name[NAMESIZE];
+	int i;
+
+	for (i=0; i<nfiles; i++) {
+		mkname(name, i);
+		fds[i] = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+		if (fds[i] < 0) {
+			err(1, "%s: open", name);
+		}
+	}
+}
+
+static
+void
+closeall(int nfiles)
+{
+	int i;
+
+	for (i=0; i<nfiles; i++) {
+		close(fds[i]);
+	}
+}
+
+/*
+ * Append DATA to every file, through the open fds. Growing the file
+ * is what makes the inode dirty.
+ */
+static
+void
+touchall(int nfiles, const char *data)
+{
+	char name[NAMESIZE];
+	int i;
+	size_t len;
+
+	len = strlen(data);
+	for (i=0; i<nfiles; i++) {
+		if (write(fds[order[i]], data, len) != (ssize_t)len) {
+			mkname(name, order[i]);
+			err(1, "%s: write", name);
+		}
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	int nfiles = 100, rounds = 5;
+	int i;
+	time_t secs;
+	unsigned long nsecs, us, total;
+
+	if (argc > 1) {
+		nfiles = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		rounds = atoi(argv[2]);
+	}
+	if (nfiles < 1 || nfiles > MAXFILES || rounds < 1) {
+		errx(1, "Usage: syncbench [nfiles (1-%d) [rounds]]", MAXFILES);
+	}
+
+	printf("syncbench: %d files, %d rounds\n", nfiles, rounds);
+
+	openall(nfiles);
+	scramble(nfiles);
+	touchall(nfiles, "created\n");
+	__time(&secs, &nsecs);
+	if (sync() < 0) {
+		err(1, "sync");
+	}
+	printf("create:   sync took %lu us\n", elapsed(secs, nsecs));
+
+	total = 0;
+	for (i=0; i<rounds; i++) {
+		scramble(nfiles);
+		touchall(nfiles, "appended\n");
+		__time(&secs, &nsecs);
+		if (sync() < 0) {
+			err(1, "sync");
+		}
+		us = elapsed(secs, nsecs);
+		total += us;
+		printf("round %2d: sync took %lu us\n", i, us);
+	}
+	printf("average:  %lu us per sync of %d dirty inodes\n",
+	       total / rounds, nfiles);
+	closeall(nfiles);
+	return 0;
+}